@@ -0,0 +1,326 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file bench.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+
+/* NOTE: The benchmark runs every module (and the T50 mix) through the
+         backends that send nothing (null and pcap, to /dev/null), so it
+         needs neither root nor a network. Each case is run a few times,
+         with the same seed, for a fixed time (not a fixed number of
+         packets: some modules are ten times slower than others), and
+         the median run counts: a single lucky or unlucky run (timer
+         interrupts, other processes) doesn't move it.
+
+         The times are CPU times, and each run is compared with a fixed
+         loop (the calibration) timed right before it: virtual machines
+         change speed by tens of percent from one second to the next
+         (other guests, frequency), and a case slower only because the
+         machine was slower then is slower than the calibration too. */
+
+#define BENCH_RUN_NS      50000000  /* time of a run (ns).          */
+#define BENCH_BATCH       1000      /* packets between clocks.      */
+#define BENCH_RUNS        9         /* runs per case (odd).         */
+#define BENCH_RETRIES     4         /* again, if a case is slower.  */
+#define BENCH_CALIBRATION 2000      /* buffers per calibration.     */
+#define BENCH_CASES       256
+
+struct bench_case
+{
+  char   backend[8];
+  char   options[16];
+  char   module[16];
+  double ns;                      /* per packet.             */
+  double pps;
+  double rel;                     /* ns over calibration ns. */
+};
+
+static const struct
+{
+  const char *name;
+  int        backend;
+} backends[] = { { "null", BACKEND_NULL }, { "pcap", BACKEND_PCAP } };
+
+static unsigned load_baseline(const char *, struct bench_case *);
+static void     save_baseline(const char *, const struct bench_case *, unsigned);
+static void     bench_case(struct config_options * const __restrict__, unsigned, struct bench_case *);
+static double   calibrate(void);
+static int      compare_ns(const void *, const void *);
+
+/**
+ * Runs the benchmark and compares it with a baseline.
+ *
+ * The baseline must be there, unless told to take it: a baseline taken
+ * from the build under test would guard nothing.
+ *
+ * @param co Pointer to T50 configuration structure (co->bench: baseline
+ *           file; co->bench_create: take it with this run;
+ *           co->bench_tolerance: slowdown allowed, percent).
+ * @return EXIT_SUCCESS or EXIT_FAILURE (regressions).
+ */
+int run_bench(struct config_options * const __restrict__ co)
+{
+  static struct bench_case base[BENCH_CASES], run[BENCH_CASES];
+  const struct bench_case *b;
+  struct bench_case *c, again;
+  unsigned nbase, n = 0, nmodules, bi, si, m, i, r, slower = 0;
+  double change;
+
+  if (!config_targets(co))
+    return EXIT_FAILURE;
+
+  nbase = co->bench_create ? 0 : load_baseline(co->bench, base);
+  if (!nbase && !co->bench_create)
+    fatal_error("No benchmark baseline '%s'. Take one from a good build with --bench-create.", co->bench);
+
+  nmodules = get_number_of_registered_modules();
+  if (!get_mix_length())
+    config_mix(co->mix);
+
+  alloc_packet(INITIAL_PACKET_SIZE);
+
+  printf(PACKAGE " " VERSION " benchmark: %u ms per run, median of %u.\n\n"
+         "%-7s %-8s %-7s %10s %12s %10s %8s\n",
+         BENCH_RUN_NS / 1000000, BENCH_RUNS, "backend", "options", "module", "ns/packet", "packets/s",
+         "baseline", "change");
+
+  for (bi = 0; bi < sizeof(backends) / sizeof(backends[0]); bi++)
+  {
+    co->backend = backends[bi].backend;
+    co->pcap = "/dev/null";
+    create_socket(co);
+
+    for (si = 0; si < OPTION_SETS; si++)
+    {
+      co->encapsulated = option_sets[si].encapsulated;
+      co->bogus_csum = option_sets[si].bogus_csum;
+
+      /* Every module, then the T50 mix. */
+      for (m = 0; m <= nmodules && n < BENCH_CASES; m++, n++)
+      {
+        c = &run[n];
+        snprintf(c->backend, sizeof(c->backend), "%s", backends[bi].name);
+        snprintf(c->options, sizeof(c->options), "%s", option_sets[si].name);
+        snprintf(c->module, sizeof(c->module), "%s", m < nmodules ? mod_table[m].acronym : "T50");
+
+        for (b = NULL, i = 0; i < nbase; i++)
+          if (!strcmp(base[i].backend, c->backend) && !strcmp(base[i].options, c->options) &&
+              !strcmp(base[i].module, c->module))
+          {
+            b = &base[i];
+            break;
+          }
+
+        /* A slower case is measured again: a real regression is slower
+           every time, noise isn't. The fastest measurement counts. */
+        bench_case(co, m, c);
+        for (r = 0; b && r < BENCH_RETRIES && 100.0 * (c->rel - b->rel) / b->rel > co->bench_tolerance; r++)
+        {
+          bench_case(co, m, &again);
+          if (again.rel < c->rel)
+          {
+            c->ns = again.ns;
+            c->rel = again.rel;
+          }
+        }
+        c->pps = 1e9 / c->ns;
+
+        printf("%-7s %-8s %-7s %10.1f %12.0f", c->backend, c->options, c->module, c->ns, c->pps);
+
+        if (b)
+        {
+          change = 100.0 * (c->rel - b->rel) / b->rel;
+          printf(" %10.1f %+7.1f%%", b->ns, change);
+          if (change > co->bench_tolerance)
+          {
+            printf("  REGRESSION");
+            slower++;
+          }
+        }
+        putchar('\n');
+      }
+    }
+
+    close_socket();
+  }
+
+  if (co->bench_create)
+  {
+    save_baseline(co->bench, run, n);
+    printf("\nBaseline saved to '%s' (%u cases).\n", co->bench, n);
+  }
+  else if (slower)
+    printf("\n%u of %u cases are more than %u%% slower than the baseline.\n",
+           slower, n, co->bench_tolerance);
+  else
+    printf("\nNo regressions (tolerance %u%%).\n", co->bench_tolerance);
+
+  close_targets();
+
+  return slower ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Runs a case: module 'm' (T50 mix if past the last one). Sets the
+   median time per packet (ns) and the median time relative to the
+   calibration. */
+static void bench_case(struct config_options * const __restrict__ co, unsigned m, struct bench_case *c)
+{
+  modules_table_t *ptbl;
+  struct timespec t0, t1;
+  double ns[BENCH_RUNS], rel[BENCH_RUNS], elapsed;
+  uint64_t packets;
+  unsigned r, i;
+  size_t size;
+
+  for (r = 0; r < BENCH_RUNS; r++)
+  {
+    SRANDOM_SEED(DETERMINISTIC_SEED);
+    split_mix(0, 1);    /* the mix from its start. */
+
+    rel[r] = calibrate();
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+
+    packets = 0;
+    do
+    {
+      for (i = 0; i < BENCH_BATCH; i++)
+      {
+        ptbl = (m < get_number_of_registered_modules()) ? &mod_table[m] : next_module();
+        co->ip.protocol = ptbl->protocol_id;
+        co->ip.daddr = next_target();
+
+        ptbl->func(co, &size);
+        if (send_packet(packet, size, co) != SEND_OK)
+          fatal_error("Benchmark: packet for protocol %s not sent.", ptbl->acronym);
+      }
+      packets += BENCH_BATCH;
+
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+      elapsed = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    } while (elapsed < BENCH_RUN_NS);
+
+    ns[r] = elapsed / packets;
+    rel[r] = ns[r] / rel[r];
+  }
+
+  qsort(ns, BENCH_RUNS, sizeof(double), compare_ns);
+  qsort(rel, BENCH_RUNS, sizeof(double), compare_ns);
+
+  c->ns = ns[BENCH_RUNS / 2];
+  c->rel = rel[BENCH_RUNS / 2];
+}
+
+/* The calibration: a fixed loop, much like building packets (random
+   bytes into a buffer, and a checksum over it), with code of its own.
+   Returns its time (ns). */
+static double calibrate(void)
+{
+  static uint64_t buf[188];       /* 1504 bytes. */
+  static volatile uint32_t sink __attribute__((unused));
+  struct timespec t0, t1;
+  uint64_t x = DETERMINISTIC_SEED;
+  uint32_t sum = 0;
+  unsigned i, j;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+
+  for (i = 0; i < BENCH_CALIBRATION; i++)
+  {
+    for (j = 0; j < sizeof(buf) / sizeof(buf[0]); j++)
+    {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      buf[j] = x;
+    }
+
+    for (j = 0; j < sizeof(buf) / sizeof(buf[0]); j++)
+      sum += (uint32_t)buf[j] + (uint32_t)(buf[j] >> 32);
+  }
+  sink = sum;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+
+  return (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+}
+
+/* qsort() callback: times, shortest first. */
+static int compare_ns(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Reads a baseline: "backend options module ns/packet packets/s relative"
+   per line, '#' starts a comment. Returns the number of cases (0 if the
+   file doesn't exist). */
+static unsigned load_baseline(const char *filename, struct bench_case *base)
+{
+  char line[256];
+  unsigned n = 0;
+  FILE *f;
+
+  if ((f = fopen(filename, "r")) == NULL)
+  {
+    if (errno != ENOENT)
+      fatal_error("Cannot read '%s'.", filename);
+    return 0;
+  }
+
+  while (n < BENCH_CASES && fgets(line, sizeof(line), f))
+  {
+    if (*line == '#' || *line == '\n')
+      continue;
+
+    if (sscanf(line, "%7s %15s %15s %lf %lf %lf", base[n].backend, base[n].options,
+               base[n].module, &base[n].ns, &base[n].pps, &base[n].rel) != 6 ||
+        !(base[n].ns > 0.0) || !(base[n].rel > 0.0))
+      fatal_error("'%s' is not a benchmark baseline.", filename);
+    n++;
+  }
+
+  fclose(f);
+
+  if (!n)
+    fatal_error("'%s' is an empty benchmark baseline.", filename);
+
+  return n;
+}
+
+/* Writes a baseline. */
+static void save_baseline(const char *filename, const struct bench_case *run, unsigned n)
+{
+  unsigned i;
+  FILE *f;
+
+  if ((f = fopen(filename, "w")) == NULL)
+    fatal_error("Cannot create '%s'.", filename);
+
+  fprintf(f, "# " PACKAGE " " VERSION " benchmark baseline (--bench-create takes a new one).\n"
+             "# backend options module ns/packet packets/s relative\n");
+  for (i = 0; i < n; i++)
+    fprintf(f, "%s %s %s %.1f %.0f %.6g\n", run[i].backend, run[i].options, run[i].module,
+            run[i].ns, run[i].pps, run[i].rel);
+
+  if (fclose(f))
+    fatal_error("Cannot write '%s'.", filename);
+}
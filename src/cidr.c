@@ -107,3 +107,18 @@ struct cidr *config_cidr(const struct config_options * const __restrict__ co)
 
   return &cidr;
 }
+
+/**
+ * Gets the number of destinations of a CIDR block, counted as the
+ * targets iterator counts them (config_cidr()).
+ *
+ * @param bits Number of "valid" bits on netmask.
+ * @return Number of destinations.
+ */
+uint32_t get_cidr_hosts(uint32_t bits)
+{
+  uint32_t hostid = (bits < CIDR_MAXIMUM) ? (1U << (32 - bits)) - 2U : 0;
+
+  /* hostid == 0 means: use the address as is! */
+  return hostid ? hostid : 1;
+}
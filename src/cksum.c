@@ -54,3 +54,36 @@ uint16_t cksum(void *data, size_t length)
 
   return ~sum;
 }
+
+/**
+ * Updates a checksum after a 16 bits word of the data changed.
+ *
+ * RFC 1624 incremental update: HC' = ~(~HC + ~m + m').
+ *
+ * @param sum Pointer to the checksum.
+ * @param old Old value of the word.
+ * @param new New value of the word.
+ */
+void cksum_update16(uint16_t *sum, uint16_t old, uint16_t new)
+{
+  uint32_t s;
+
+  s = (uint16_t)~*sum + (uint16_t)~old + new;
+  s = (s & 0xffff) + (s >> 16);
+  s = (s & 0xffff) + (s >> 16);
+
+  *sum = ~s;
+}
+
+/**
+ * Updates a checksum after a 32 bits word (an address) of the data changed.
+ *
+ * @param sum Pointer to the checksum.
+ * @param old Old value of the word.
+ * @param new New value of the word.
+ */
+void cksum_update32(uint16_t *sum, uint32_t old, uint32_t new)
+{
+  cksum_update16(sum, old >> 16, new >> 16);
+  cksum_update16(sum, old & 0xffff, new & 0xffff);
+}
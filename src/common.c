@@ -20,13 +20,28 @@
 */
 
 #include <common.h>
+#include <sys/random.h>
+#include <sys/stat.h>
 
 /* Actual packet buffer. Allocated dynamically. */
 void  *packet = NULL;
+struct packet_offload pkt_offload = { .segs = 1 };
+
+/* Option sets of the deterministic runs (--bench, --golden).
+   NOTE: The names are on the golden corpus file names. */
+const struct option_set option_sets[OPTION_SETS] =
+{
+  { "plain", FALSE, FALSE }, { "gre", TRUE, FALSE }, { "bogus", FALSE, TRUE }
+};
 
 /* Used by alloc_packet(). */
 static size_t current_packet_size = 0;
 
+/* Deterministic mode (--seed): the seeds taken from the kernel come
+   from this one instead. */
+static int      fixed_seed = FALSE;
+static uint64_t fixed_seed_state;
+
 /* Holds the number of modules. Use get_number_of_registered_modules() funcion to get it. */
 static size_t number_of_modules = 0;
 
@@ -88,6 +103,76 @@ void SRANDOM(void)
     fatal_error("Cannot read initial seed from /dev/random.");
 }
 
+/**
+ * Sets a fixed random seed, so the sequence (and the packets) repeat.
+ *
+ * @param seed The seed.
+ */
+void SRANDOM_SEED(uint64_t seed)
+{
+#ifdef _EXPERIMENTAL_
+  /* xorshift128+ state must not be all zeros. */
+  _seed[0] = seed;
+  _seed[1] = seed ^ 0x9e3779b97f4a7c15ULL;
+#else
+  _seed = seed;
+#endif
+}
+
+/**
+ * Enters the deterministic mode: the PRNG, and every other seed (target
+ * permutation, flows), start from 'seed', so a run can be repeated
+ * byte by byte.
+ *
+ * @param seed The seed.
+ */
+void set_fixed_seed(uint64_t seed)
+{
+  fixed_seed = TRUE;
+  fixed_seed_state = seed;
+  SRANDOM_SEED(seed);
+}
+
+/**
+ * Is the deterministic mode on (set_fixed_seed())?
+ */
+int has_fixed_seed(void)
+{
+  return fixed_seed;
+}
+
+/**
+ * Gets random bytes to seed something else (not the PRNG), before the
+ * PRNG is seeded: from the kernel or, in deterministic mode, from the
+ * fixed seed (splitmix64).
+ *
+ * @param buffer Where to put them.
+ * @param size How many.
+ * @return TRUE (success) or FALSE.
+ */
+int get_seed_bytes(void *buffer, size_t size)
+{
+  uint8_t *p = buffer;
+  uint64_t z;
+  size_t n;
+
+  if (!fixed_seed)
+    return getrandom(buffer, size, 0) == (ssize_t)size;
+
+  for (; size; size -= n, p += n)
+  {
+    z = (fixed_seed_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+
+    n = size < sizeof(z) ? size : sizeof(z);
+    memcpy(p, &z, n);
+  }
+
+  return TRUE;
+}
+
 /** 
  * Returns the Randomized netmask if foo is 0 or the parameter, otherwise.
  *
@@ -145,6 +230,36 @@ void alloc_packet(size_t new_packet_size)
   }
 }
 
+/**
+ * Marks the packet buffer for checksum offload (and GSO).
+ *
+ * Called by TCP and UDP modules, when L4_OFFLOAD() is true, instead of
+ * computing the checksum: the checksum field must hold the pseudo header
+ * sum, not complemented, and the packet socket's virtio header tells the
+ * kernel (or the NIC) where to put the real one.
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @param l4 TCP or UDP header, inside the packet buffer.
+ * @param hdrlen L4 header length (with options).
+ * @param check Offset of the checksum field on the L4 header.
+ */
+void set_offload(const struct config_options *const __restrict__ co,
+                 const void *l4,
+                 size_t hdrlen,
+                 size_t check)
+{
+  pkt_offload.csum_start  = (const uint8_t *)l4 - (const uint8_t *)packet;
+  pkt_offload.csum_offset = check;
+  pkt_offload.hdr_len     = pkt_offload.csum_start + hdrlen;
+  pkt_offload.protocol    = co->ip.protocol;
+
+  if (co->gso)
+  {
+    pkt_offload.gso_size  = co->payload;
+    pkt_offload.segs      = co->gso;
+  }
+}
+
 /**
  * Get the number of registered modules on modules.c.
  *
@@ -178,6 +293,31 @@ int *get_module_valid_options_list(int protocol)
   return NULL;
 }
 
+/**
+ * Removes a unix socket left behind by an earlier run, before binding
+ * to its path again. Anything else on the path is left alone.
+ *
+ * @param path Socket path (given by the user).
+ */
+void remove_stale_socket(const char *path)
+{
+  struct stat st;
+
+  if (lstat(path, &st) == -1)
+  {
+    if (errno != ENOENT)
+      fatal_error("Cannot check '%s'.", path);
+    return;
+  }
+
+  /* NOTE: Running as root, a wrong path would delete any file. */
+  if (!S_ISSOCK(st.st_mode))
+    fatal_error("'%s' exists and is not a socket.", path);
+
+  if (unlink(path) == -1)
+    fatal_error("Cannot remove the old socket '%s'.", path);
+}
+
 /* --- Using vfprintf for flexibility. */
 static void verror(char *fmt, va_list args)
 {
@@ -55,6 +55,7 @@ static struct config_options co =
 {
   /* XXX COMMON OPTIONS                                                         */
   .threshold = 1000,                  /* default threshold                      */
+  .flow_zipf = 1.0,                   /* default Zipf exponent                  */
 
   /* XXX IP HEADER OPTIONS  (IPPROTO_IP = 0)                                    */
   .ip = {
@@ -154,6 +155,48 @@ static struct options_table_s options[] =
 #endif
   { OPTION_THRESHOLD,               0,  "threshold",        1 },
   { OPTION_FLOOD,                   0,  "flood",            0 },
+  { OPTION_TARGETS,                 0,  "targets",          1 },
+  { OPTION_TARGETS_SAVE,            0,  "targets-save",     1 },
+  { OPTION_TARGET_ORDER,            0,  "target-order",     1 },
+  { OPTION_MIX,                     0,  "mix",              1 },
+  { OPTION_FLOWS,                   0,  "flows",            1 },
+  { OPTION_FLOW_SCHED,              0,  "flow-sched",       1 },
+  { OPTION_STATS_INTERVAL,          0,  "stats-interval",   1 },
+  { OPTION_RX,                      0,  "rx",               0 },
+  { OPTION_RX_IFACE,                0,  "rx-iface",         1 },
+  { OPTION_DURATION,                0,  "duration",         1 },
+  { OPTION_RATE,                    0,  "rate",             1 },
+  { OPTION_RAMP,                    0,  "ramp",             1 },
+  { OPTION_IFACE,                   0,  "iface",            1 },
+  { OPTION_WORKERS,                 0,  "workers",          1 },
+  { OPTION_BACKEND,                 0,  "backend",          1 },
+  { OPTION_DST_MAC,                 0,  "dst-mac",          1 },
+  { OPTION_VLAN,                    0,  "vlan",             1 },
+  { OPTION_REPLAY,                  0,  "replay",           1 },
+  { OPTION_REWRITE,                 0,  "rewrite",          1 },
+  { OPTION_IO_URING,                0,  "io-uring",         0 },
+  { OPTION_URING_DEPTH,             0,  "uring-depth",      1 },
+  { OPTION_URING_BATCH,             0,  "uring-batch",      1 },
+  { OPTION_ON_FULL,                 0,  "on-full",          1 },
+  { OPTION_PAYLOAD,                 0,  "payload",          1 },
+  { OPTION_OFFLOAD,                 0,  "offload",          0 },
+  { OPTION_GSO,                     0,  "gso",              1 },
+  { OPTION_TX_QUEUES,               0,  "tx-queues",        0 },
+  { OPTION_TXTIME,                  0,  "txtime",           0 },
+  { OPTION_LATENCY,                 0,  "latency",          0 },
+  { OPTION_COUNTERS,                0,  "counters",         0 },
+  { OPTION_IF_STATS,                0,  "if-stats",         0 },
+  { OPTION_METRICS,                 0,  "metrics",          1 },
+  { OPTION_CONTROL,                 0,  "control",          1 },
+  { OPTION_REPORT,                  0,  "report",           1 },
+  { OPTION_CSV,                     0,  "csv",              1 },
+  { OPTION_BENCH,                   0,  "bench",            1 },
+  { OPTION_BENCH_TOLERANCE,         0,  "bench-tolerance",  1 },
+  { OPTION_BENCH_CREATE,            0,  "bench-create",     0 },
+  { OPTION_SEED,                    0,  "seed",             1 },
+  { OPTION_GOLDEN,                  0,  "golden",           1 },
+  { OPTION_GOLDEN_CREATE,           0,  "golden-create",    0 },
+  { OPTION_SCALE,                   0,  "scale",            1 },
   { OPTION_ENCAPSULATED,            0,  "encapsulated",     0 },
   { OPTION_BOGUSCSUM,             'B',  "bogus-csum",       0 },
 
@@ -515,6 +558,28 @@ struct config_options *parse_command_line(char **argv)
   /* We got all the options. Now, check their rules! */
   check_options_rules(&co);
 
+  /* Index the capture here too. Without --threshold, it's replayed once. */
+  if (co.replay)
+  {
+    uint32_t n = load_replay(co.replay, co.rewrite);
+
+    if (!co.flood && !find_option("--threshold")->in_use_)
+      co.threshold = n;
+  }
+
+  /* Load the target list here, so any error is reported before going on. */
+  if (co.targets)
+  {
+    load_targets(co.targets);
+
+    /* Just convert the list to binary form? */
+    if (co.targets_save)
+    {
+      save_targets(co.targets_save);
+      exit(EXIT_SUCCESS);
+    }
+  }
+
   return &co;
 }
 
@@ -574,9 +639,150 @@ void check_options_rules(struct config_options *__restrict__ co)
 {
   struct options_table_s *ptbl;
 
-  /* Address field is mandatory! */
-  if (!co->ip.daddr)
-    fatal_error("Target address needed.");
+  if (co->bench && co->golden)
+    fatal_error("--bench and --golden cannot be used at the same time.");
+
+  if (co->golden_create && !co->golden)
+    fatal_error("--golden-create needs --golden.");
+
+  /* The benchmark and the golden corpus don't send anything: any
+     destination will do. */
+  if (co->golden && !co->ip.daddr && !co->targets)
+  {
+    co->ip.daddr = htonl(BENCH_TARGET);
+    co->bits = CIDR_MAXIMUM;
+  }
+
+  if (co->bench)
+  {
+    if (!co->ip.daddr && !co->targets)
+    {
+      co->ip.daddr = htonl(BENCH_TARGET);
+      co->bits = CIDR_MAXIMUM;
+    }
+    if (!co->bench_tolerance)
+      co->bench_tolerance = BENCH_TOLERANCE;
+  }
+  else if (co->bench_tolerance || co->bench_create)
+    fatal_error("--bench-tolerance and --bench-create need --bench.");
+
+  /* The scaling benchmark chooses the backends and the workers, and
+     sends as fast as it can: --duration is the time of each step. */
+  if (co->scale)
+  {
+    if (co->bench || co->golden)
+      fatal_error("--scale cannot be used with --bench or --golden.");
+    if (co->replay || co->flows || co->rate > 0.0 || co->ramp || co->workers || co->control)
+      fatal_error("--scale cannot be used with --replay, --flows, --rate, --ramp, --workers or --control.");
+    /* Offloads are for the packet backend only, and a GSO packet leaves
+       as many: the steps would not count the same things. */
+    if (co->offload)
+      fatal_error("--scale cannot be used with --offload or --gso.");
+    if (co->duration == 0.0)
+      co->duration = SCALE_DURATION;
+  }
+
+  /* Replaying, the destination (if any) goes into every packet. */
+  if (co->replay)
+  {
+    if (co->ip.daddr || co->targets)
+      co->rewrite |= REWRITE_DADDR;
+
+    if (co->mix || co->flows)
+      fatal_error("--replay cannot be used with --mix or --flows.");
+  }
+  else if (co->rewrite)
+    fatal_error("--rewrite needs --replay.");
+
+  /* Address field is mandatory, unless a target list is given
+     (or the packets are replayed as they are)! */
+  if (co->replay && !(co->rewrite & REWRITE_DADDR))
+    co->bits = CIDR_MAXIMUM;    /* No sweep: destinations come from the capture. */
+  else if (co->targets)
+  {
+    if (co->ip.daddr)
+      fatal_error("Target address and --targets cannot be used at the same time.");
+  }
+  else
+  {
+    if (!co->ip.daddr)
+      fatal_error("Target address needed.");
+
+    if (co->targets_save)
+      fatal_error("--targets-save needs a target list (--targets).");
+  }
+
+  if (co->rate > 0.0 && co->ramp)
+    fatal_error("--rate and --ramp cannot be used at the same time.");
+
+  /* Ramps with an end (linear and step) set the duration, if not given. */
+  if (co->duration == 0.0)
+    co->duration = config_pacing(co);
+  else
+    config_pacing(co);
+
+  /* The kernel paces through the qdisc of the interfaces. */
+  if (co->txtime && (co->rate == 0.0 && !co->ramp))
+    fatal_error("--txtime needs --rate or --ramp.");
+  if (co->txtime && !co->iface)
+    fatal_error("--txtime needs --iface.");
+
+  if (co->csv && !co->stats_interval)
+    fatal_error("--csv needs --stats-interval.");
+
+  if ((co->uring_depth || co->uring_batch) && !co->io_uring)
+    fatal_error("--uring-depth and --uring-batch need --io-uring.");
+
+  /* Paced runs submit each packet on time, unless told otherwise
+     (or the kernel paces them). */
+  if (co->io_uring)
+  {
+    if (!co->uring_depth)
+      co->uring_depth = URING_DEFAULT_DEPTH;
+    if (!co->uring_batch)
+      co->uring_batch = ((co->rate > 0.0 || co->ramp) && !co->txtime) ? 1 : URING_DEFAULT_BATCH;
+    if (co->uring_batch > co->uring_depth)
+      fatal_error("--uring-batch cannot be greater than --uring-depth.");
+  }
+
+  /* Nothing leaves the host: no interfaces, and a single writer. */
+  if (IS_OFFLINE_BACKEND(co->backend))
+  {
+    if (co->iface || co->rx || co->io_uring || co->txtime)
+      fatal_error("--backend null and pcap cannot be used with --iface, --rx, --io-uring or --txtime.");
+    if (co->backend == BACKEND_PCAP && co->workers > 1)
+      fatal_error("--backend pcap needs a single worker.");
+    if (co->if_stats)
+      fatal_error("--if-stats needs a backend that sends (raw or packet).");
+  }
+
+  /* Ethernet framing needs to know where the frames go. */
+  if (co->backend == BACKEND_PACKET && !co->iface)
+    fatal_error("--backend packet needs --iface.");
+
+  if ((co->dst_mac || co->vlan) && co->backend != BACKEND_PACKET)
+    fatal_error("--dst-mac and --vlan need --backend packet.");
+
+  if (co->tx_queues && co->backend != BACKEND_PACKET)
+    fatal_error("--tx-queues needs --backend packet.");
+
+  /* Checksums (and segmentation) are left to the kernel or the NIC
+     through a virtio header on each frame. */
+  if (co->offload)
+  {
+    if (co->backend != BACKEND_PACKET)
+      fatal_error("--offload and --gso need --backend packet.");
+
+    if (!co->payload)
+      fatal_error("--offload and --gso need --payload.");
+
+    if (co->gso && co->payload * co->gso > PAYLOAD_MAXIMUM)
+      fatal_error("GSO packets too big (--payload times --gso is over %u bytes).", PAYLOAD_MAXIMUM);
+  }
+
+  /* --duration (without --threshold) sends until the time is over. */
+  if (co->duration > 0.0 && !((ptbl = find_option("--threshold")) && ptbl->in_use_))
+    co->flood = TRUE;
 
 #ifdef __HAVE_TURBO__
   if (co->turbo && !co->flood)
@@ -598,6 +804,23 @@ void check_options_rules(struct config_options *__restrict__ co)
   if (TEST_BITS(co->tcp.options, TCP_OPTION_CC) && (co->tcp.cc_echo))
     fatal_error("TCP options T/TCP CC and T/TCP CC.ECHO are not allowed.");
 
+  /* A protocol mix implies T50 protocol. */
+  if (co->mix)
+  {
+    if (co->ip.protocol != IPPROTO_T50 && (ptbl = find_option("--protocol")) && ptbl->in_use_)
+      fatal_error("--mix can be used only with protocol T50.");
+
+    co->ip.protocol = IPPROTO_T50;
+    co->ip.protoname = get_number_of_registered_modules();
+  }
+
+  if (!co->flows && (ptbl = find_option("--flow-sched")) && ptbl->in_use_)
+    fatal_error("--flow-sched needs --flows.");
+
+  /* Builds the T50 schedule here, since the threshold depends on it. */
+  if (co->ip.protocol == IPPROTO_T50)
+    config_mix(co->mix);
+
   /* FIX: Checks only if flooding isn't used! */
   if (!co->flood)
     if (check_threshold(co))
@@ -727,6 +950,250 @@ void set_config_option(struct config_options *__restrict__ co, char *optname, in
     co->bogus_csum = TRUE;
     break;
 
+  case OPTION_TARGETS:
+    co->targets = arg;
+    break;
+
+  case OPTION_TARGETS_SAVE:
+    co->targets_save = arg;
+    break;
+
+  case OPTION_TARGET_ORDER:
+    /* NOTE: it doesn't matter if order names are upper
+             or lower case. */
+    if (!strcasecmp(arg, "random"))
+      co->target_order = TARGET_ORDER_RANDOM;
+    else if (!strcasecmp(arg, "sequential"))
+      co->target_order = TARGET_ORDER_SEQUENTIAL;
+    else if (!strcasecmp(arg, "permutation"))
+      co->target_order = TARGET_ORDER_PERMUTATION;
+    else
+      fatal_error("Option '%s' must be 'random', 'sequential' or 'permutation'.", optname);
+    break;
+
+  case OPTION_MIX:
+    co->mix = arg;
+    break;
+
+  case OPTION_FLOWS:
+    co->flows = toULongCheckRange(optname, arg, 1, FLOWS_MAXIMUM);
+    break;
+
+  case OPTION_FLOW_SCHED:
+    /* NOTE: it doesn't matter if scheduler names are upper
+             or lower case. */
+    if (!strcasecmp(arg, "rr"))
+      co->flow_sched = FLOW_SCHED_RR;
+    else if (!strncasecmp(arg, "zipf", 4) && (arg[4] == '\0' || arg[4] == ':'))
+    {
+      co->flow_sched = FLOW_SCHED_ZIPF;
+
+      if (arg[4] == ':')
+      {
+        char *p;
+
+        errno = 0;
+        co->flow_zipf = strtod(arg + 5, &p);
+        if (errno || *p || p == arg + 5 || !(co->flow_zipf > 0.0 && co->flow_zipf <= 10.0))
+          fatal_error("Zipf exponent for option '%s' must be greater than 0 and up to 10.", optname);
+      }
+    }
+    else
+      fatal_error("Option '%s' must be 'rr' or 'zipf[:S]'.", optname);
+    break;
+
+  case OPTION_STATS_INTERVAL:
+    co->stats_interval = toULongCheckRange(optname, arg, 1, 3600);
+    break;
+
+  case OPTION_RX_IFACE:
+    co->rx_iface = arg;
+    /* fall through */
+  case OPTION_RX:
+    co->rx = TRUE;
+    break;
+
+  case OPTION_DURATION:
+    if ((co->duration = parse_time(arg)) <= 0.0)
+      fatal_error("Option '%s' needs a time (ex: 500ms, 60s, 5m, 1h).", optname);
+    break;
+
+  case OPTION_RATE:
+    if ((co->rate = parse_rate(arg)) <= 0.0)
+      fatal_error("Option '%s' needs a rate in packets per second (ex: 500, 10k, 2M).", optname);
+    break;
+
+  case OPTION_RAMP:
+    co->ramp = arg;
+    break;
+
+  case OPTION_IFACE:
+    co->iface = arg;
+    break;
+
+  case OPTION_WORKERS:
+    co->workers = toULongCheckRange(optname, arg, 1, STATS_MAX_WORKERS);
+    break;
+
+  case OPTION_BACKEND:
+    if (!strcasecmp(arg, "raw"))
+      co->backend = BACKEND_RAW;
+    else if (!strcasecmp(arg, "packet"))
+      co->backend = BACKEND_PACKET;
+    else if (!strcasecmp(arg, "null"))
+      co->backend = BACKEND_NULL;
+    else if (!strncasecmp(arg, "pcap:", 5) && arg[5])
+    {
+      co->backend = BACKEND_PCAP;
+      co->pcap = arg + 5;
+    }
+    else
+      fatal_error("Option '%s' must be 'raw', 'packet', 'null' or 'pcap:FILE'.", optname);
+    break;
+
+  case OPTION_DST_MAC:
+    co->dst_mac = arg;
+    break;
+
+  case OPTION_VLAN:
+    co->vlan = arg;
+    break;
+
+  case OPTION_REPLAY:
+    co->replay = arg;
+    break;
+
+  case OPTION_IO_URING:
+    co->io_uring = TRUE;
+    break;
+
+  case OPTION_URING_DEPTH:
+    co->uring_depth = toULongCheckRange(optname, arg, 8, 4096);
+    break;
+
+  case OPTION_URING_BATCH:
+    co->uring_batch = toULongCheckRange(optname, arg, 1, 4096);
+    break;
+
+  case OPTION_ON_FULL:
+    if (!strcasecmp(arg, "wait"))
+      co->on_full = ON_FULL_WAIT;
+    else if (!strcasecmp(arg, "spin"))
+      co->on_full = ON_FULL_SPIN;
+    else if (!strcasecmp(arg, "drop"))
+      co->on_full = ON_FULL_DROP;
+    else
+      fatal_error("Option '%s' must be 'wait', 'spin' or 'drop'.", optname);
+    break;
+
+  case OPTION_PAYLOAD:
+    co->payload = toULongCheckRange(optname, arg, 1, PAYLOAD_MAXIMUM);
+    break;
+
+  case OPTION_OFFLOAD:
+    co->offload = TRUE;
+    break;
+
+  case OPTION_GSO:
+    co->gso = toULongCheckRange(optname, arg, 2, GSO_MAXIMUM);
+    co->offload = TRUE;
+    break;
+
+  case OPTION_TX_QUEUES:
+    co->tx_queues = TRUE;
+    break;
+
+  case OPTION_TXTIME:
+    co->txtime = TRUE;
+    break;
+
+  case OPTION_LATENCY:
+    co->latency = TRUE;
+    break;
+
+  case OPTION_COUNTERS:
+    co->counters = TRUE;
+    break;
+
+  case OPTION_IF_STATS:
+    co->if_stats = TRUE;
+    break;
+
+  case OPTION_METRICS:
+    co->metrics = arg;
+    break;
+
+  case OPTION_CONTROL:
+    co->control = arg;
+    break;
+
+  case OPTION_REPORT:
+    co->report = arg;
+    break;
+
+  case OPTION_CSV:
+    co->csv = arg;
+    break;
+
+  case OPTION_BENCH:
+    co->bench = arg;
+    break;
+
+  case OPTION_BENCH_TOLERANCE:
+    co->bench_tolerance = toULongCheckRange(optname, arg, 1, 1000);
+    break;
+
+  case OPTION_BENCH_CREATE:
+    co->bench_create = TRUE;
+    break;
+
+  case OPTION_SEED:
+    {
+      char *p;
+
+      errno = 0;
+      co->seed = strtoull(arg, &p, 0);
+      if (errno || p == arg || *p || *arg == '-')
+        fatal_error("Invalid numeric value for option '%s'.", optname);
+      co->seeded = TRUE;
+    }
+    break;
+
+  case OPTION_GOLDEN:
+    co->golden = arg;
+    break;
+
+  case OPTION_GOLDEN_CREATE:
+    co->golden_create = TRUE;
+    break;
+
+  case OPTION_SCALE:
+    co->scale = toULongCheckRange(optname, arg, 1, STATS_MAX_WORKERS);
+    break;
+
+  case OPTION_REWRITE:
+    {
+      static const struct { const char *name; unsigned flag; } fields[] =
+      {
+        { "daddr", REWRITE_DADDR }, { "saddr", REWRITE_SADDR },
+        { "sport", REWRITE_SPORT }, { "dport", REWRITE_DPORT },
+        { "ttl",   REWRITE_TTL },   { NULL, 0 }
+      };
+      char *tok, *saveptr;
+      unsigned i;
+
+      /* NOTE: 'arg' is ours to change. */
+      for (tok = strtok_r(arg, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr))
+      {
+        for (i = 0; fields[i].name && strcasecmp(tok, fields[i].name); i++)
+          ;
+        if (!fields[i].name)
+          fatal_error("Option '%s' fields are daddr, saddr, sport, dport and ttl.", optname);
+        co->rewrite |= fields[i].flag;
+      }
+    }
+    break;
+
   case OPTION_GRE_SEQUENCE_PRESENT:
     co->gre.S = TRUE;
     break;
@@ -1993,16 +2460,17 @@ int check_threshold(const struct config_options *const __restrict__ co)
   if (co->ip.protocol == IPPROTO_T50)
   {
     /* When sending multiple packets using T50 "protocol", the threshold
-       must be greater than the number of protocols! */
-    minThreshold = (threshold_t)get_number_of_registered_modules();
+       must be enough to complete the mix (every protocol once, by default)! */
+    minThreshold = (threshold_t)get_mix_length();
   }
   else
     minThreshold = 1;
 
   if (co->threshold < minThreshold)
   {
-    error("Protool %s cannot have threshold smaller than %d.",
-          mod_table[co->ip.protoname].acronym, minThreshold);
+    error("Protocol %s cannot have threshold smaller than %d.",
+          co->ip.protocol == IPPROTO_T50 ? "T50" : mod_table[co->ip.protoname].acronym,
+          minThreshold);
     return -1;
   }
 
@@ -0,0 +1,542 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file control.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* NOTE: The protocol is a line per command, answered by some lines
+         and a last one starting with "ok" or "error". A client at a
+         time: 'nc -U' and 'socat' work as well as scripts. */
+
+/* Longest command line. */
+#define CONTROL_LINE_SIZE  1024
+
+/* How often the thread checks if it must stop (ms). */
+#define CONTROL_POLL_MS    200
+
+/* How often a paused worker looks for a new snapshot (ns). */
+#define CONTROL_PAUSE_NS   10000000
+
+struct t50_control *control = NULL;
+uint64_t            control_seen = 0;
+int                 control_paused = FALSE;
+
+/* Worker side: the parameters this worker is using. */
+static struct control_config ctl_cur;
+static unsigned              ctl_worker = 0;
+static unsigned              ctl_nworkers = 1;
+
+/* Control thread (parent process). */
+static pthread_t             ctl_thread;
+static int                   ctl_running = 0;
+static volatile sig_atomic_t ctl_stop = 0;
+static int                   ctl_fd = -1;
+static char                  ctl_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static struct control_config ctl_next;        /* the last one published. */
+static struct control_config ctl_first;       /* the command line.       */
+static const char           *ctl_mix_given;   /* --mix (or the default). */
+static int                   ctl_mixable;     /* T50 mode.               */
+static int                   ctl_retargetable;/* a CIDR block.           */
+static int                   ctl_txtime;
+static struct stats_snapshot ctl_last;        /* at the last "stats".    */
+
+static uint64_t read_control(struct control_config *);
+static void  apply_control(struct config_options *, const struct control_config *);
+static void *control_loop(void *);
+static void  control_serve(int);
+static void  control_command(int, char *);
+static void  control_publish(const char *, ...) __attribute__((format(printf, 1, 2)));
+static void  control_reply(int, const char *, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Allocates the parameters snapshots shared by all processes.
+ *
+ * Must be called before fork().
+ *
+ * @param co Pointer to T50 configuration structure.
+ */
+void config_control(const struct config_options *const __restrict__ co)
+{
+  control = mmap(NULL, sizeof(struct t50_control), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (control == MAP_FAILED)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Cannot allocate the control snapshots: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Cannot allocate the control snapshots");
+    #endif
+
+  /* Version 0: the command line. */
+  control->config[0].paused = FALSE;
+  control->config[0].rate   = -1.0;
+  control->config[0].daddr  = co->ip.daddr;
+  control->config[0].bits   = co->bits;
+
+  ctl_first = ctl_cur = ctl_next = control->config[0];
+
+  /* What can be changed: flows and captures bring their own
+     protocols and destinations; a list isn't a CIDR block. */
+  ctl_mix_given    = co->mix ? co->mix : "default";
+  ctl_mixable      = (co->ip.protocol == IPPROTO_T50) && !co->flows && !co->replay;
+  ctl_retargetable = !co->targets && !co->flows && !co->replay;
+  ctl_txtime       = co->txtime;
+}
+
+/**
+ * Selects the share of the work of this process (for new parameters).
+ *
+ * @param worker Index of this process (0 .. nworkers - 1).
+ * @param nworkers Number of processes.
+ */
+void split_control(unsigned worker, unsigned nworkers)
+{
+  assert(worker < nworkers);
+
+  ctl_worker = worker;
+  ctl_nworkers = nworkers;
+}
+
+/**
+ * Takes the newest parameters, if there are new ones, and waits a bit
+ * if paused.
+ *
+ * Used by every worker, between packets, when control_pending().
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @return TRUE (go on sending) or FALSE (paused: send nothing now).
+ */
+int update_control(struct config_options *const __restrict__ co)
+{
+  struct timespec nap = { 0, CONTROL_PAUSE_NS };
+  struct control_config c;
+  uint64_t v;
+
+  if (__atomic_load_n(&control->version, __ATOMIC_ACQUIRE) != control_seen)
+  {
+    v = read_control(&c);
+    apply_control(co, &c);
+    control_seen = v;
+  }
+
+  if (control_paused)
+  {
+    nanosleep(&nap, NULL);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * Opens the control socket and starts its thread.
+ *
+ * Used only by the parent process.
+ *
+ * @param co Pointer to T50 configuration structure (co->control: the
+ *           unix socket path).
+ */
+void start_control(const struct config_options *const __restrict__ co)
+{
+  struct sockaddr_un addr;
+  mode_t mask;
+  int r;
+
+  if (strlen(co->control) >= sizeof(addr.sun_path))
+    fatal_error("Control socket path '%s' is too long.", co->control);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, co->control);
+  strcpy(ctl_path, co->control);
+
+  /* A socket left behind by an earlier run. */
+  remove_stale_socket(ctl_path);
+
+  if ((ctl_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+    fatal_error("Cannot create the control socket.");
+
+  /* NOTE: Whoever can write on the socket can change the flood: it is
+           created for the owner only. */
+  mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+  r = bind(ctl_fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+
+  if (r == -1 || listen(ctl_fd, 4) == -1)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Cannot listen on '%s' for control: \"%s\"", co->control, strerror(errno));
+    #else
+    fatal_error("Cannot listen on '%s' for control.", co->control);
+    #endif
+
+  take_stats_snapshot(&ctl_last);
+
+  if (pthread_create(&ctl_thread, NULL, control_loop, NULL))
+    fatal_error("Cannot create the control thread.");
+
+  ctl_running = 1;
+
+  printf("Control on unix:%s.\n", ctl_path);
+}
+
+/**
+ * Stops the control thread and closes the socket.
+ */
+void stop_control(void)
+{
+  if (ctl_running)
+  {
+    ctl_stop = 1;
+    pthread_join(ctl_thread, NULL);
+    ctl_running = 0;
+  }
+
+  if (ctl_fd != -1)
+  {
+    close(ctl_fd);
+    ctl_fd = -1;
+    unlink(ctl_path);
+  }
+}
+
+/**
+ * Gets the sizes of the pools of the newest parameters (--metrics): the
+ * destinations of the CIDR block and the schedule length of the mix.
+ * Those still as on the command line are left as they are.
+ *
+ * @param targets Number of destinations.
+ * @param mix Schedule length of the mix.
+ */
+void get_control_pools(uint32_t *targets, unsigned *mix)
+{
+  struct control_config c;
+
+  if (!control)
+    return;
+
+  read_control(&c);
+
+  if (c.daddr != ctl_first.daddr || c.bits != ctl_first.bits)
+    *targets = get_cidr_hosts(c.bits);
+
+  if (*c.mix)
+    *mix = get_mix_spec_length(c.mix);
+}
+
+/* Copies the newest parameters. Returns their version.
+   NOTE: The slot being written (odd sequence), or written while copying
+         (another sequence), is copied again. */
+static uint64_t read_control(struct control_config *c)
+{
+  uint64_t v, seq;
+
+  for (;;)
+  {
+    v = __atomic_load_n(&control->version, __ATOMIC_ACQUIRE);
+    seq = __atomic_load_n(&control->seq[v & 1], __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+
+    memcpy(c, &control->config[v & 1], sizeof(*c));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&control->seq[v & 1], __ATOMIC_RELAXED) == seq)
+      return v;
+  }
+}
+
+/* Switches this worker to new parameters (only what changed). */
+static void apply_control(struct config_options *co, const struct control_config *c)
+{
+  if (c->rate != ctl_cur.rate && c->rate >= 0.0)
+    set_pacing_rate(c->rate);
+
+  if (strcmp(c->mix, ctl_cur.mix) && *c->mix)
+  {
+    config_mix(c->mix);
+    split_mix(ctl_worker, ctl_nworkers);
+  }
+
+  if (c->daddr != ctl_cur.daddr || c->bits != ctl_cur.bits)
+  {
+    co->ip.daddr = c->daddr;
+    co->bits = c->bits;
+    if (!change_targets(co, c->perm, ctl_worker, ctl_nworkers))
+      fatal_error("Cannot change the destinations.");
+
+    /* A socket connect()ed to the first destination sends nowhere else. */
+    unconnect_socket();
+  }
+
+  control_paused = c->paused;
+  ctl_cur = *c;
+}
+
+/* Control thread: a client at a time, until stop_control(). */
+static void *control_loop(void *arg)
+{
+  struct pollfd pfd = { .fd = ctl_fd, .events = POLLIN };
+  int fd;
+
+  (void)arg;
+
+  while (!ctl_stop)
+  {
+    if (poll(&pfd, 1, CONTROL_POLL_MS) <= 0)
+      continue;
+
+    if ((fd = accept4(ctl_fd, NULL, NULL, SOCK_CLOEXEC)) != -1)
+    {
+      control_serve(fd);
+      close(fd);
+    }
+  }
+
+  return NULL;
+}
+
+/* Reads commands, a line each, until the client is gone. */
+static void control_serve(int fd)
+{
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  char buf[CONTROL_LINE_SIZE], *line, *eol;
+  size_t n = 0;
+  ssize_t r;
+
+  while (!ctl_stop)
+  {
+    if ((r = poll(&pfd, 1, CONTROL_POLL_MS)) == 0 || (r == -1 && errno == EINTR))
+      continue;
+
+    if (r == -1 || (r = recv(fd, buf + n, sizeof(buf) - 1 - n, 0)) <= 0)
+      return;
+    n += r;
+    buf[n] = '\0';
+
+    for (line = buf; (eol = strchr(line, '\n')) != NULL; line = eol + 1)
+    {
+      *eol = '\0';
+      if (eol > line && eol[-1] == '\r')
+        eol[-1] = '\0';
+      control_command(fd, line);
+    }
+
+    /* The rest of the line comes later. */
+    n -= line - buf;
+    memmove(buf, line, n + 1);
+
+    if (n == sizeof(buf) - 1)
+    {
+      control_reply(fd, "error: line too long\n");
+      return;
+    }
+  }
+}
+
+/* Runs a command. */
+static void control_command(int fd, char *line)
+{
+  struct control_config c = ctl_next;
+  struct stats_snapshot s;
+  struct in_addr addr;
+  const char *why;
+  char *cmd, *arg, *p, *saveptr;
+  unsigned long bits;
+  double t;
+
+  if ((cmd = strtok_r(line, " \t", &saveptr)) == NULL)
+    return;
+  if ((arg = strtok_r(NULL, " \t", &saveptr)) != NULL && strtok_r(NULL, " \t", &saveptr))
+  {
+    control_reply(fd, "error: too many arguments\n");
+    return;
+  }
+
+  if (!strcasecmp(cmd, "pause") || !strcasecmp(cmd, "resume"))
+  {
+    c.paused = !strcasecmp(cmd, "pause");
+    ctl_next = c;
+    control_publish("%s", c.paused ? "paused" : "resumed");
+  }
+  else if (!strcasecmp(cmd, "rate") && arg)
+  {
+    if ((c.rate = parse_rate(arg)) < 0.0)
+    {
+      control_reply(fd, "error: invalid rate '%s'\n", arg);
+      return;
+    }
+    if (c.rate == 0.0 && ctl_txtime)
+    {
+      control_reply(fd, "error: --txtime needs a rate\n");
+      return;
+    }
+    ctl_next = c;
+    control_publish("rate %.0f pps", c.rate);
+  }
+  else if (!strcasecmp(cmd, "mix") && arg)
+  {
+    if (!ctl_mixable)
+    {
+      control_reply(fd, "error: the mix needs -p T50 (without --flows or --replay)\n");
+      return;
+    }
+    if (strlen(arg) >= sizeof(c.mix))
+    {
+      control_reply(fd, "error: mix too long\n");
+      return;
+    }
+    if ((why = check_mix(arg)) != NULL)
+    {
+      control_reply(fd, "error: invalid mix '%s': %s\n", arg, why);
+      return;
+    }
+    strcpy(c.mix, arg);
+    ctl_next = c;
+    control_publish("mix %s", c.mix);
+  }
+  else if (!strcasecmp(cmd, "target") && arg)
+  {
+    if (!ctl_retargetable)
+    {
+      control_reply(fd, "error: the target needs a CIDR block (not --targets, --flows or --replay)\n");
+      return;
+    }
+
+    bits = CIDR_MAXIMUM;
+    if ((p = strchr(arg, '/')) != NULL)
+    {
+      *p++ = '\0';
+      errno = 0;
+      bits = strtoul(p, &p, 10);
+      if (errno || *p || bits < CIDR_MINIMUM || bits > CIDR_MAXIMUM)
+      {
+        control_reply(fd, "error: CIDR must be between %u and %u\n", CIDR_MINIMUM, CIDR_MAXIMUM);
+        return;
+      }
+    }
+    if (!inet_pton(AF_INET, arg, &addr))
+    {
+      control_reply(fd, "error: invalid address '%s'\n", arg);
+      return;
+    }
+
+    c.daddr = addr.s_addr;
+    c.bits = bits;
+
+    /* Every worker on the same permutation. */
+    if (!get_seed_bytes(c.perm, sizeof(c.perm)))
+    {
+      control_reply(fd, "error: cannot get random permutation parameters\n");
+      return;
+    }
+    ctl_next = c;
+    control_publish("target %s/%u", inet_ntoa(addr), c.bits);
+  }
+  else if (!strcasecmp(cmd, "stats") && !arg)
+  {
+    take_stats_snapshot(&s);
+    t = s.elapsed - ctl_last.elapsed;
+    addr.s_addr = c.daddr;
+
+    control_reply(fd,
+                  "version %" PRIu64 "\n"
+                  "paused %d\n"
+                  "elapsed %.3f\n"
+                  "packets %" PRIu64 "\n"
+                  "bytes %" PRIu64 "\n"
+                  "errors %" PRIu64 "\n"
+                  "drops %" PRIu64 "\n"
+                  "pps %.0f\n"
+                  "mbps %.2f\n"
+                  "target_pps %.0f\n"
+                  "mix %s\n"
+                  "target %s/%u\n",
+                  control->version,
+                  c.paused, s.elapsed, s.packets, s.bytes, s.errors, s.drops,
+                  t > 0.0 ? (s.packets - ctl_last.packets) / t : 0.0,
+                  t > 0.0 ? (s.bytes - ctl_last.bytes) * 8 / t / 1e6 : 0.0,
+                  c.paused ? 0.0 : (c.rate >= 0.0 ? c.rate : get_target_rate(s.elapsed)),
+                  *c.mix ? c.mix : ctl_mix_given,
+                  inet_ntoa(addr), c.bits);
+    ctl_last = s;
+  }
+  else if (!strcasecmp(cmd, "help") && !arg)
+  {
+    control_reply(fd,
+                  "pause             stop sending (the time still counts)\n"
+                  "resume            send again\n"
+                  "rate PPS          target rate, all workers (0: unpaced)\n"
+                  "mix SPEC          protocol mix (-p T50)\n"
+                  "target ADDR[/N]   destination CIDR block\n"
+                  "stats             counters, rate since the last stats, parameters\n");
+  }
+  else
+  {
+    control_reply(fd, "error: unknown command '%s'%s (try help)\n", cmd, arg ? " or missing argument" : "");
+    return;
+  }
+
+  control_reply(fd, "ok\n");
+}
+
+/* Publishes ctl_next as a new version, and tells the operator. */
+static void control_publish(const char *fmt, ...)
+{
+  struct stats_snapshot s;
+  char msg[CONTROL_LINE_SIZE];
+  uint64_t v = control->version + 1;
+  va_list ap;
+
+  /* NOTE: The workers are on the other slot, unless they are late
+           (two commands since their last copy): the odd sequence
+           tells them to copy again. */
+  __atomic_store_n(&control->seq[v & 1], control->seq[v & 1] + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  control->config[v & 1] = ctl_next;
+  __atomic_store_n(&control->seq[v & 1], control->seq[v & 1] + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&control->version, v, __ATOMIC_RELEASE);
+
+  va_start(ap, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, ap);
+  va_end(ap);
+
+  take_stats_snapshot(&s);
+  printf("[%8.1fs] control: %s (version %" PRIu64 ").\n", s.elapsed, msg, v);
+}
+
+/* Sends (a part of) an answer. */
+static void control_reply(int fd, const char *fmt, ...)
+{
+  char buf[CONTROL_LINE_SIZE];
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  if (n > 0)
+    send(fd, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1, MSG_NOSIGNAL);
+}
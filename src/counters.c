@@ -0,0 +1,277 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file counters.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* NOTE: The parent opens the counters of every worker (by pid), after
+         fork(): workers don't change at all, and the counters can be
+         read even after a worker is gone. Only the worker's main thread
+         is counted (not the statistics, metrics or receive threads). */
+
+/* Counters, as shown. */
+enum { CNT_CYCLES = 0, CNT_INSTRUCTIONS, CNT_CACHE_MISSES, CNT_BRANCH_MISSES, CNT_CTX_SWITCHES, CNT_EVENTS };
+
+static const struct
+{
+  uint32_t   type;
+  uint64_t   config;
+  const char *name;
+} events[CNT_EVENTS] =
+{
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,        "cycles"       },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,      "instructions" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,      "cache-misses" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,     "branch-misses" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,  "ctx-switches" }
+};
+
+/* Counter values and the packets sent, per worker. */
+struct counters
+{
+  uint64_t value[CNT_EVENTS];
+  uint64_t packets;
+};
+
+static int              cnt_fd[STATS_MAX_WORKERS][CNT_EVENTS];
+static unsigned         cnt_workers = 0;
+static int              cnt_available[CNT_EVENTS];
+static int              cnt_user_only = FALSE;   /* kernel not counted. */
+static struct counters  cnt_last[STATS_MAX_WORKERS + 1];   /* last interval; the last one is the sum. */
+
+static int      open_counter(pid_t, unsigned, int);
+static uint64_t read_counter(int);
+static void     read_counters(struct counters *);
+static void     show_row(const char *, const struct counters *, const struct counters *);
+
+/**
+ * Opens the performance counters of every worker.
+ *
+ * Used only by the parent process, right after the workers are created.
+ * Counters the CPU (or the hypervisor) doesn't have are left out; if the
+ * kernel can't be counted (perf_event_paranoid), only user space is.
+ *
+ * @param pids Processes of the workers 1 .. nworkers - 1 (the parent
+ *             is worker 0).
+ * @param nworkers Number of workers.
+ */
+void start_counters(const pid_t *pids, unsigned nworkers)
+{
+  unsigned w, e, opened = 0;
+  pid_t pid;
+
+  assert(nworkers <= STATS_MAX_WORKERS);
+
+  cnt_workers = nworkers;
+
+  for (e = 0; e < CNT_EVENTS; e++)
+    cnt_available[e] = TRUE;
+
+  for (w = 0; w < nworkers; w++)
+  {
+    pid = w ? pids[w - 1] : getpid();
+
+    for (e = 0; e < CNT_EVENTS; e++)
+    {
+      cnt_fd[w][e] = -1;
+      if (!cnt_available[e])
+        continue;
+
+      if ((cnt_fd[w][e] = open_counter(pid, e, cnt_user_only)) == -1 &&
+          (errno == EACCES || errno == EPERM) && !cnt_user_only)
+      {
+        /* Not allowed to count the kernel: from now on, user space only. */
+        cnt_user_only = TRUE;
+        cnt_fd[w][e] = open_counter(pid, e, TRUE);
+      }
+
+      if (cnt_fd[w][e] == -1)
+      {
+        /* Worker 0 decides what is there; the others may just be gone. */
+        if (!w)
+        {
+          #ifdef __HAVE_DEBUG__
+          error("Counter %s not available: \"%s\"", events[e].name, strerror(errno));
+          #endif
+          cnt_available[e] = FALSE;
+        }
+        continue;
+      }
+
+      opened++;
+    }
+  }
+
+  if (!opened)
+  {
+    error("Cannot open any performance counter (perf_event_open).");
+    cnt_workers = 0;
+    return;
+  }
+
+  if (cnt_user_only)
+    error("Performance counters count user space only (see /proc/sys/kernel/perf_event_paranoid).");
+
+  memset(cnt_last, 0, sizeof(cnt_last));
+}
+
+/**
+ * Shows the counters per packet, for each worker and for all of them.
+ *
+ * @param interval TRUE: since the last interval report; FALSE: the
+ *                 whole run.
+ */
+void show_counters(int interval)
+{
+  static const struct counters zero;
+  struct counters cur[STATS_MAX_WORKERS + 1];
+  char name[24];
+  unsigned w;
+
+  if (!cnt_workers)
+    return;
+
+  read_counters(cur);
+
+  printf("%s%-10s %11s %11s %6s %12s %12s %12s%s\n", interval ? "" : "\n",
+         "Counters", "cycles/pkt", "instr/pkt", "IPC", "cache-miss", "branch-miss", "ctx-switch",
+         cnt_user_only ? "  (user space only)" : "");
+
+  if (cnt_workers > 1)
+    for (w = 0; w < cnt_workers; w++)
+    {
+      snprintf(name, sizeof(name), "worker %u", w);
+      show_row(name, &cur[w], interval ? &cnt_last[w] : &zero);
+    }
+  show_row("all", &cur[STATS_MAX_WORKERS], interval ? &cnt_last[STATS_MAX_WORKERS] : &zero);
+
+  if (interval)
+    memcpy(cnt_last, cur, sizeof(cur));
+}
+
+/**
+ * Closes the counters.
+ */
+void stop_counters(void)
+{
+  unsigned w, e;
+
+  for (w = 0; w < cnt_workers; w++)
+    for (e = 0; e < CNT_EVENTS; e++)
+      if (cnt_fd[w][e] != -1)
+        close(cnt_fd[w][e]);
+
+  cnt_workers = 0;
+}
+
+/* Opens a counter of a process (every CPU), counting right away. */
+static int open_counter(pid_t pid, unsigned e, int user_only)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = events[e].type;
+  attr.config         = events[e].config;
+  attr.exclude_kernel = user_only;
+  attr.exclude_hv     = TRUE;
+
+  /* More counters than the CPU has are multiplexed: scaled on read. */
+  attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Reads a counter, scaled if it wasn't counting all the time. */
+static uint64_t read_counter(int fd)
+{
+  uint64_t v[3];    /* value, time enabled, time running. */
+
+  if (fd == -1 || read(fd, v, sizeof(v)) != sizeof(v) || !v[2])
+    return 0;
+
+  if (v[2] < v[1])
+    return (uint64_t)((double)v[0] * v[1] / v[2]);
+
+  return v[0];
+}
+
+/* Reads every counter, and the packets sent, per worker; the sum goes
+   on the last entry. */
+static void read_counters(struct counters *cur)
+{
+  unsigned w, e;
+
+  memset(&cur[STATS_MAX_WORKERS], 0, sizeof(cur[STATS_MAX_WORKERS]));
+
+  for (w = 0; w < cnt_workers; w++)
+  {
+    cur[w].packets = __atomic_load_n(&stats->worker[w].packets, __ATOMIC_RELAXED);
+    cur[STATS_MAX_WORKERS].packets += cur[w].packets;
+
+    for (e = 0; e < CNT_EVENTS; e++)
+    {
+      cur[w].value[e] = read_counter(cnt_fd[w][e]);
+      cur[STATS_MAX_WORKERS].value[e] += cur[w].value[e];
+    }
+  }
+}
+
+/* A line of counters per packet (what isn't available is '-'). */
+static void show_row(const char *name, const struct counters *cur, const struct counters *last)
+{
+  uint64_t packets = cur->packets - last->packets;
+  uint64_t d[CNT_EVENTS];
+  unsigned e;
+
+  for (e = 0; e < CNT_EVENTS; e++)
+    d[e] = cur->value[e] - last->value[e];
+
+  printf("  %-8s", name);
+
+  if (!packets)
+  {
+    puts("  (no packets)");
+    return;
+  }
+
+#define PER_PACKET(e, width, prec) \
+  if (cnt_available[e]) printf(" %*.*f", width, prec, (double)d[e] / packets); \
+  else printf(" %*s", width, "-")
+
+  PER_PACKET(CNT_CYCLES, 11, 1);
+  PER_PACKET(CNT_INSTRUCTIONS, 11, 1);
+
+  if (cnt_available[CNT_CYCLES] && cnt_available[CNT_INSTRUCTIONS] && d[CNT_CYCLES])
+    printf(" %6.2f", (double)d[CNT_INSTRUCTIONS] / d[CNT_CYCLES]);
+  else
+    printf(" %6s", "-");
+
+  PER_PACKET(CNT_CACHE_MISSES, 12, 4);
+  PER_PACKET(CNT_BRANCH_MISSES, 12, 4);
+  PER_PACKET(CNT_CTX_SWITCHES, 12, 6);
+
+#undef PER_PACKET
+
+  putchar('\n');
+}
@@ -0,0 +1,332 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file flows.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <math.h>
+
+/* Flow table, one array per field (SoA): the scheduler and the per packet
+   update touch only what they need, and consecutive flows share cache lines.
+
+   Every value stored here is non zero, since zero on the configuration
+   structure means "random". Values given on command line (non zero) are
+   used by every flow as is; the others get a random start per flow and,
+   when they are counters, are incremented on every packet of the flow. */
+static struct
+{
+  uint32_t   count;
+
+  uint32_t  *saddr;       /* source address (as co->ip.saddr).  */
+  in_addr_t *daddr;       /* destination (network order).       */
+  uint16_t  *sport;       /* source port.                       */
+  uint16_t  *dport;       /* destination port.                  */
+  uint8_t   *module;      /* mod_table index.                   */
+
+  uint16_t  *ip_id;       /* IP identification counter.         */
+  uint16_t  *icmp_id;     /* ICMP echo identifier.              */
+  uint16_t  *icmp_seq;    /* ICMP echo sequence counter.        */
+  uint32_t  *tcp_seq;     /* TCP sequence (+1 per SYN or FIN).  */
+  uint32_t  *tcp_ack;     /* TCP acknowledgment (stable).       */
+  uint32_t  *gre_seq;     /* GRE sequence counter.              */
+
+  /* Round robin state. */
+  uint32_t   pos;
+  uint32_t   step;
+  uint32_t   worker;
+
+  /* Zipf: Walker/Vose alias table. Flow 'k' is taken if a random
+     32 bits value is below prob[k]; otherwise alias[k] is taken. */
+  int        sched;
+  uint32_t  *prob;
+  uint32_t  *alias;
+} flw;
+
+/* Which fields are counters (not given on command line)? */
+static int ip_id_rnd, icmp_seq_rnd, tcp_seq_rnd, gre_seq_rnd;
+
+static uint64_t flow_seed;
+
+static uint32_t flow_random(void);
+static uint16_t flow_random16(uint16_t, uint16_t);
+static void    *flow_alloc(size_t);
+static void     build_zipf(double);
+
+/**
+ * Creates the flow table.
+ *
+ * Must be called after config_targets() and, on T50 mode, config_mix():
+ * each flow takes its destination from the targets iterator and its
+ * module from the protocol mix.
+ *
+ * @param co Pointer to T50 configuration structure.
+ */
+void config_flows(const struct config_options *const __restrict__ co)
+{
+  uint32_t i, n;
+
+  n = flw.count = co->flows;
+
+  /* NOTE: The PRNG isn't seeded yet (and will be seeded per process),
+           so get the seed straight from the kernel (or from --seed). */
+  if (!get_seed_bytes(&flow_seed, sizeof(flow_seed)))
+    fatal_error("Cannot get a random seed to create the flows.");
+
+  flw.saddr    = flow_alloc(n * sizeof(uint32_t));
+  flw.daddr    = flow_alloc(n * sizeof(in_addr_t));
+  flw.sport    = flow_alloc(n * sizeof(uint16_t));
+  flw.dport    = flow_alloc(n * sizeof(uint16_t));
+  flw.module   = flow_alloc(n * sizeof(uint8_t));
+  flw.ip_id    = flow_alloc(n * sizeof(uint16_t));
+  flw.icmp_id  = flow_alloc(n * sizeof(uint16_t));
+  flw.icmp_seq = flow_alloc(n * sizeof(uint16_t));
+  flw.tcp_seq  = flow_alloc(n * sizeof(uint32_t));
+  flw.tcp_ack  = flow_alloc(n * sizeof(uint32_t));
+  flw.gre_seq  = flow_alloc(n * sizeof(uint32_t));
+
+  ip_id_rnd    = !co->ip.id;
+  icmp_seq_rnd = !co->icmp.sequence;
+  tcp_seq_rnd  = !co->tcp.sequence;
+  gre_seq_rnd  = !co->gre.sequence;
+
+  for (i = 0; i < n; i++)
+  {
+    flw.saddr[i]    = co->ip.saddr ? co->ip.saddr : flow_random() | 1;
+    flw.daddr[i]    = next_target();
+
+    /* Random source ports are taken from the ephemeral range. */
+    flw.sport[i]    = co->source ? co->source : flow_random16(1024, 65535);
+    flw.dport[i]    = co->dest ? co->dest : flow_random16(1, 65535);
+
+    /* On T50 mode the flows follow the mix (flow i gets slot i). */
+    flw.module[i]   = (co->ip.protocol == IPPROTO_T50) ?
+                        next_module() - mod_table : co->ip.protoname;
+
+    flw.ip_id[i]    = co->ip.id ? co->ip.id : flow_random16(1, 65535);
+    flw.icmp_id[i]  = co->icmp.id ? co->icmp.id : flow_random16(1, 65535);
+    flw.icmp_seq[i] = co->icmp.sequence ? co->icmp.sequence : 1;
+    flw.tcp_seq[i]  = co->tcp.sequence ? co->tcp.sequence : flow_random() | 1;
+    flw.tcp_ack[i]  = co->tcp.acknowledge ? co->tcp.acknowledge : flow_random() | 1;
+    flw.gre_seq[i]  = co->gre.sequence ? co->gre.sequence : 1;
+  }
+
+  flw.sched  = co->flow_sched;
+  flw.pos    = 0;
+  flw.step   = 1;
+  flw.worker = 0;
+
+  if (flw.sched == FLOW_SCHED_ZIPF)
+    build_zipf(co->flow_zipf);
+}
+
+/**
+ * Splits the flows between processes.
+ *
+ * Each process owns the flows 'worker', 'worker + nworkers', ..., so the
+ * per flow state (counters) is never shared. If there are fewer flows than
+ * processes, flows are shared.
+ *
+ * @param worker Index of this process (0 .. nworkers - 1).
+ * @param nworkers Number of processes.
+ */
+void split_flows(unsigned worker, unsigned nworkers)
+{
+  assert(worker < nworkers);
+
+  if (flw.count < nworkers)
+    return;
+
+  flw.pos    = worker;
+  flw.step   = nworkers;
+  flw.worker = worker;
+}
+
+/**
+ * Gets the next flow and loads it on the configuration structure.
+ *
+ * Sets source and destination addresses, ports and the per flow header
+ * fields, then advances the flow counters.
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @return Pointer to the modules table entry of the flow.
+ */
+modules_table_t *next_flow(struct config_options *const __restrict__ co)
+{
+  uint32_t f;
+
+  if (flw.sched == FLOW_SCHED_ZIPF)
+  {
+    f = ((uint64_t)RANDOM() * flw.count) >> 32;
+    if (RANDOM() >= flw.prob[f])
+      f = flw.alias[f];
+
+    /* Map the popularity rank to a flow owned by this process. */
+    if (flw.step > 1)
+    {
+      f += flw.worker - f % flw.step;
+      if (f >= flw.count)
+        f -= flw.step;
+    }
+  }
+  else
+  {
+    f = flw.pos;
+    if ((flw.pos += flw.step) >= flw.count)
+      flw.pos = flw.worker;
+  }
+
+  co->ip.saddr        = flw.saddr[f];
+  co->ip.daddr        = flw.daddr[f];
+  co->source          = flw.sport[f];
+  co->dest            = flw.dport[f];
+  co->ip.id           = flw.ip_id[f];
+  co->icmp.id         = flw.icmp_id[f];
+  co->icmp.sequence   = flw.icmp_seq[f];
+  co->tcp.sequence    = flw.tcp_seq[f];
+  co->tcp.acknowledge = flw.tcp_ack[f];
+  co->gre.sequence    = flw.gre_seq[f];
+
+  /* Counters never become zero (which means random). */
+  if (ip_id_rnd && !++flw.ip_id[f])
+    flw.ip_id[f] = 1;
+  if (icmp_seq_rnd && !++flw.icmp_seq[f])
+    flw.icmp_seq[f] = 1;
+  if (gre_seq_rnd && !++flw.gre_seq[f])
+    flw.gre_seq[f] = 1;
+
+  /* SYN and FIN take one sequence number each, and the payload its size. */
+  if (tcp_seq_rnd && (co->tcp.syn || co->tcp.fin || co->payload))
+    if (!(flw.tcp_seq[f] += co->tcp.syn + co->tcp.fin + L4_PAYLOAD(co)))
+      flw.tcp_seq[f] = 1;
+
+  return &mod_table[flw.module[f]];
+}
+
+/**
+ * Releases the flow table.
+ */
+void close_flows(void)
+{
+  free(flw.saddr);
+  free(flw.daddr);
+  free(flw.sport);
+  free(flw.dport);
+  free(flw.module);
+  free(flw.ip_id);
+  free(flw.icmp_id);
+  free(flw.icmp_seq);
+  free(flw.tcp_seq);
+  free(flw.tcp_ack);
+  free(flw.gre_seq);
+  free(flw.prob);
+  free(flw.alias);
+
+  memset(&flw, 0, sizeof(flw));
+}
+
+/* Builds the alias table for P(rank k) proportional to 1/k^s (Vose's method).
+   Sampling is O(1): two random numbers and two table lookups. */
+static void build_zipf(double s)
+{
+  double *p, sum;
+  uint32_t *small, *large, ns, nl, i, l, g, n;
+
+  n = flw.count;
+
+  flw.prob  = flow_alloc(n * sizeof(uint32_t));
+  flw.alias = flow_alloc(n * sizeof(uint32_t));
+  p     = flow_alloc(n * sizeof(double));
+  small = flow_alloc(n * sizeof(uint32_t));
+  large = flow_alloc(n * sizeof(uint32_t));
+
+  for (sum = 0.0, i = 0; i < n; i++)
+    sum += p[i] = pow(i + 1, -s);
+
+  /* Scaled so the mean probability is 1. */
+  for (ns = nl = i = 0; i < n; i++)
+  {
+    p[i] *= n / sum;
+    if (p[i] < 1.0)
+      small[ns++] = i;
+    else
+      large[nl++] = i;
+  }
+
+  while (ns && nl)
+  {
+    l = small[--ns];
+    g = large[nl - 1];
+
+    flw.prob[l]  = p[l] * 4294967296.0;
+    flw.alias[l] = g;
+
+    if ((p[g] -= 1.0 - p[l]) < 1.0)
+    {
+      nl--;
+      small[ns++] = g;
+    }
+  }
+
+  /* What's left has probability 1 (within rounding errors). */
+  while (nl)
+  {
+    g = large[--nl];
+    flw.prob[g]  = UINT32_MAX;
+    flw.alias[g] = g;
+  }
+
+  while (ns)
+  {
+    l = small[--ns];
+    flw.prob[l]  = UINT32_MAX;
+    flw.alias[l] = l;
+  }
+
+  free(p);
+  free(small);
+  free(large);
+}
+
+/* splitmix64: used only while creating the flows. */
+static uint32_t flow_random(void)
+{
+  uint64_t z;
+
+  z = (flow_seed += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return (z ^ (z >> 31)) >> 32;
+}
+
+/* Random number between 'min' and 'max' (inclusive). */
+static uint16_t flow_random16(uint16_t min, uint16_t max)
+{
+  return min + ((uint64_t)flow_random() * (max - min + 1U) >> 32);
+}
+
+static void *flow_alloc(size_t size)
+{
+  void *p;
+
+  if ((p = malloc(size)) == NULL)
+    fatal_error("Cannot allocate memory for %u flows.", flw.count);
+
+  return p;
+}
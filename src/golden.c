@@ -0,0 +1,344 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file golden.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+/* NOTE: The golden corpus holds the packets the builders make in
+         deterministic mode: a pcap file per case (module, message type,
+         GRE, bogus checksums), written through the pcap backend. Any
+         change on the way packets are built (or on the PRNG sequence)
+         must give the same bytes, and --golden tells if it does. */
+
+#define GOLDEN_PACKETS   16     /* packets per case. */
+#define GOLDEN_MANIFEST  "MANIFEST"
+#define GOLDEN_BUFFER    65535  /* never reallocated. */
+
+/* The corpus is only good for the same PRNG. */
+#ifdef _EXPERIMENTAL_
+# define GOLDEN_RNG      "xorshift128+"
+#else
+# define GOLDEN_RNG      "lcg"
+#endif
+
+static const uint8_t rsvp_types[] =
+{
+  RSVP_MESSAGE_TYPE_PATH, RSVP_MESSAGE_TYPE_RESV, RSVP_MESSAGE_TYPE_PATHERR,
+  RSVP_MESSAGE_TYPE_RESVERR, RSVP_MESSAGE_TYPE_PATHTEAR, RSVP_MESSAGE_TYPE_RESVTEAR,
+  RSVP_MESSAGE_TYPE_RESVCONF, RSVP_MESSAGE_TYPE_BUNDLE, RSVP_MESSAGE_TYPE_ACK,
+  RSVP_MESSAGE_TYPE_SREFRESH, RSVP_MESSAGE_TYPE_HELLO, RSVP_MESSAGE_TYPE_NOTIFY
+};
+
+static const uint16_t eigrp_hello_types[] =
+{
+  EIGRP_TYPE_PARAMETER, EIGRP_TYPE_AUTH, EIGRP_TYPE_SEQUENCE,
+  EIGRP_TYPE_SOFTWARE, EIGRP_TYPE_MULTICAST
+};
+
+#define ELEMENTS(a)  (sizeof(a) / sizeof((a)[0]))
+
+static const char *set_variant(struct config_options * const __restrict__, unsigned, unsigned);
+static int         golden_case(struct config_options * const __restrict__, unsigned, const char *, int);
+static int         manifest(const char *, uint64_t, int);
+
+static uint64_t golden_seed;
+
+/**
+ * Creates the golden corpus or checks the packets against it.
+ *
+ * A corpus (its MANIFEST) must be there, unless told to create it: a
+ * corpus made by the build under test would guard nothing. A new corpus
+ * is checked too, to make sure the packets repeat and every byte is
+ * written by the builders.
+ *
+ * @param co Pointer to T50 configuration structure (co->golden: corpus
+ *           directory; co->golden_create: (re)create it first; co->seed:
+ *           the seed, if co->seeded).
+ * @return EXIT_SUCCESS or EXIT_FAILURE (packets differ).
+ */
+int run_golden(struct config_options * const __restrict__ co)
+{
+  static struct config_options base;
+  char path[PATH_MAX];
+  const char *variant;
+  unsigned nmodules, m, k, si, n = 0, differ = 0;
+  int create;
+
+  if (!config_targets(co))
+    return EXIT_FAILURE;
+
+  nmodules = get_number_of_registered_modules();
+  if (!get_mix_length())
+    config_mix(co->mix);
+
+  golden_seed = co->seeded ? co->seed : DETERMINISTIC_SEED;
+  if (!(create = co->golden_create) && !manifest(co->golden, golden_seed, FALSE))
+    fatal_error("No golden corpus on '%s' (its " GOLDEN_MANIFEST " is missing). "
+                "Create it from a good build with --golden-create.", co->golden);
+  if (create && mkdir(co->golden, 0755) == -1 && errno != EEXIST)
+    fatal_error("Cannot create the directory '%s'.", co->golden);
+
+  alloc_packet(GOLDEN_BUFFER);
+  base = *co;
+
+  printf(PACKAGE " " VERSION " golden corpus '%s': seed %#" PRIx64 ", %s PRNG, %u packets per case.\n",
+         co->golden, golden_seed, GOLDEN_RNG, GOLDEN_PACKETS);
+
+  /* Every module (and its message types), then the T50 mix. */
+  for (m = 0; m <= nmodules; m++)
+    for (k = 0; ; k++)
+    {
+      for (si = 0; si < OPTION_SETS; si++)
+      {
+        *co = base;
+        co->encapsulated = option_sets[si].encapsulated;
+        co->bogus_csum = option_sets[si].bogus_csum;
+
+        if ((variant = set_variant(co, m, k)) == NULL)
+          break;
+
+        snprintf(path, sizeof(path), "%s/%s%s%s-%s.pcap", co->golden,
+                 m < nmodules ? mod_table[m].acronym : "T50",
+                 *variant ? "-" : "", variant, option_sets[si].name);
+
+        if (create)
+          golden_case(co, m, path, TRUE);
+
+        if (!golden_case(co, m, path, FALSE))
+          differ++;
+        n++;
+      }
+
+      if (si < OPTION_SETS)
+        break;
+    }
+
+  *co = base;
+  close_targets();
+
+  if (create)
+  {
+    manifest(co->golden, golden_seed, TRUE);
+    printf("Corpus created (%u cases).\n", n);
+  }
+
+  if (differ)
+    printf("%u of %u cases differ from the corpus.\n", differ, n);
+  else
+    printf("%u cases match the corpus.\n", n);
+
+  return differ ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Sets the k-th variant (message type) of module 'm'. Returns its name
+   ("" for the module as is) or NULL, past the last one. */
+static const char *set_variant(struct config_options * const __restrict__ co, unsigned m, unsigned k)
+{
+  static char name[32];
+
+  /* The T50 mix has no variants. */
+  if (m >= get_number_of_registered_modules())
+    return k ? NULL : "";
+
+  switch (mod_table[m].protocol_id)
+  {
+  case IPPROTO_OSPF:
+    /* Every type, then every LSA on LSUpdate. */
+    if (k < OSPF_TYPE_LSACK)
+    {
+      co->ospf.type = k + 1;
+      snprintf(name, sizeof(name), "type%u", k + 1);
+      return name;
+    }
+    if ((k -= OSPF_TYPE_LSACK) < LSA_TYPE_NSSA)
+    {
+      co->ospf.type = OSPF_TYPE_LSUPDATE;
+      co->ospf.lsa_type = k + 1;
+      snprintf(name, sizeof(name), "type%u-lsa%u", OSPF_TYPE_LSUPDATE, k + 1);
+      return name;
+    }
+    return NULL;
+
+  case IPPROTO_RSVP:
+    if (k >= ELEMENTS(rsvp_types))
+      return NULL;
+    co->rsvp.type = rsvp_types[k];
+    snprintf(name, sizeof(name), "type%u", rsvp_types[k]);
+    return name;
+
+  case IPPROTO_EIGRP:
+    /* Every opcode, then Hello with each TLV and Update with the external
+       route TLV. */
+    if (k < EIGRP_OPCODE_IPX_SAP)
+    {
+      co->eigrp.opcode = k + 1;
+      snprintf(name, sizeof(name), "opcode%u", k + 1);
+      return name;
+    }
+    if ((k -= EIGRP_OPCODE_IPX_SAP) < ELEMENTS(eigrp_hello_types))
+    {
+      co->eigrp.opcode = EIGRP_OPCODE_HELLO;
+      co->eigrp.type = eigrp_hello_types[k];
+    }
+    else if (k == ELEMENTS(eigrp_hello_types))
+    {
+      co->eigrp.opcode = EIGRP_OPCODE_UPDATE;
+      co->eigrp.type = EIGRP_TYPE_EXTERNAL;
+    }
+    else
+      return NULL;
+    snprintf(name, sizeof(name), "opcode%u-type%u", co->eigrp.opcode, co->eigrp.type);
+    return name;
+
+  case IPPROTO_DCCP:
+    if (k > DCCP_PKT_SYNCACK)
+      return NULL;
+    co->dccp.type = k;
+    snprintf(name, sizeof(name), "type%u", k);
+    return name;
+  }
+
+  return k ? NULL : "";
+}
+
+/* Writes the packets of a case to its file (through the pcap backend)
+   or checks them against it. Returns FALSE if they differ. */
+static int golden_case(struct config_options * const __restrict__ co, unsigned m, const char *path, int create)
+{
+  static uint8_t *built = NULL;
+  modules_table_t *ptbl, *replay;
+  size_t size, rsize;
+  unsigned i, count = 0;
+
+  if (!create)
+  {
+    if (access(path, R_OK) == -1)
+    {
+      printf("%s: not in the corpus.\n", path);
+      return FALSE;
+    }
+
+    if ((count = load_replay(path, 0)) != GOLDEN_PACKETS)
+    {
+      printf("%s: %u packets in the corpus, expected %u.\n", path, count, GOLDEN_PACKETS);
+      close_replay();
+      return FALSE;
+    }
+  }
+  else
+  {
+    co->backend = BACKEND_PCAP;
+    co->pcap = (char *)path;
+    create_socket(co);
+  }
+
+  set_fixed_seed(golden_seed);
+  split_mix(0, 1);    /* the mix from its start. */
+  replay = get_replay_module();
+
+  for (i = 0; i < GOLDEN_PACKETS; i++)
+  {
+    ptbl = (m < get_number_of_registered_modules()) ? &mod_table[m] : next_module();
+    co->ip.protocol = ptbl->protocol_id;
+    co->ip.daddr = next_target();
+
+    /* A byte the builder doesn't write would come from the last packet:
+       it can't be the same on the corpus and on the check. */
+    memset(packet, create ? 0x00 : 0xa5, GOLDEN_BUFFER);
+    ptbl->func(co, &size);
+
+    if (create)
+    {
+      if (send_packet(packet, size, co) != SEND_OK)
+        fatal_error("Cannot write '%s'.", path);
+      continue;
+    }
+
+    /* The replay module puts the corpus packet on the packet buffer. */
+    if ((built = realloc(built, size)) == NULL)
+      fatal_error("Cannot allocate memory for the golden corpus.");
+    memcpy(built, packet, size);
+    replay->func(co, &rsize);
+
+    if (rsize != size || memcmp(built, packet, size))
+    {
+      size_t off;
+
+      for (off = 0; off < size && off < rsize && built[off] == ((uint8_t *)packet)[off]; off++)
+        ;
+      printf("%s: packet %u differs at byte %zu (%zu bytes, %zu in the corpus).\n",
+             path, i + 1, off, size, rsize);
+      break;
+    }
+  }
+
+  if (create)
+    close_socket();
+  else
+    close_replay();
+
+  return create || i == GOLDEN_PACKETS;
+}
+
+/* Reads (check: FALSE if missing; fatal if it's for another seed or
+   PRNG) or writes the corpus manifest. */
+static int manifest(const char *dir, uint64_t seed, int write)
+{
+  char path[PATH_MAX], rng[32];
+  unsigned packets;
+  uint64_t s;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "%s/" GOLDEN_MANIFEST, dir);
+
+  if (write)
+  {
+    if ((f = fopen(path, "w")) == NULL)
+      fatal_error("Cannot create '%s'.", path);
+
+    fprintf(f, "# " PACKAGE " golden corpus (--golden-create takes a new one).\n"
+               "seed %#" PRIx64 "\nrng %s\npackets %u\n", seed, GOLDEN_RNG, GOLDEN_PACKETS);
+
+    if (fclose(f))
+      fatal_error("Cannot write '%s'.", path);
+
+    return TRUE;
+  }
+
+  if ((f = fopen(path, "r")) == NULL)
+  {
+    if (errno != ENOENT)
+      fatal_error("Cannot read '%s'.", path);
+    return FALSE;
+  }
+
+  if (fscanf(f, "%*[^\n]\nseed %" SCNx64 "\nrng %31s\npackets %u", &s, rng, &packets) != 3)
+    fatal_error("'%s' is not a golden corpus manifest.", path);
+  fclose(f);
+
+  if (s != seed || strcmp(rng, GOLDEN_RNG) || packets != GOLDEN_PACKETS)
+    fatal_error("The corpus on '%s' was made with seed %#" PRIx64 ", %s PRNG and %u packets per case.",
+                dir, s, rng, packets);
+
+  return TRUE;
+}
@@ -27,6 +27,53 @@ void general_help(void)
   puts("Common Options:\n"
        "    --threshold NUM           Threshold of packets to send     (default 1000)\n"
        "    --flood                   This option supersedes the \'threshold\'\n"
+       "    --targets FILE            Destination list (text or binary)\n"
+       "    --targets-save FILE       Save the list in binary form and exit\n"
+       "    --target-order ORDER      random|sequential|permutation  (default random)\n"
+       "    --mix PROTO:W[,...]       Weighted T50 protocol mix (ex: tcp:70,udp:30)\n"
+       "    --flows NUM               Send NUM stable flows instead of random ones\n"
+       "    --flow-sched SCHED        rr|zipf[:S]                  (default rr)\n"
+       "    --stats-interval SECS     Show statistics every SECS seconds\n"
+       "    --rx                      Capture and classify responses   (default OFF)\n"
+       "    --rx-iface IFACE          Capture only on IFACE (implies --rx)\n"
+       "    --duration TIME           Send for TIME (ex: 500ms, 60s, 5m, 1h)\n"
+       "    --rate PPS                Packets per second (ex: 500, 10k, 2M)\n"
+       "    --ramp PROFILE            linear:FROM:TO:TIME, step:FROM:TO:INC:DWELL\n"
+       "                              or sine:MIN:MAX:PERIOD\n"
+       "    --iface IFACE[,...]       Send through these interfaces\n"
+       "    --workers NUM             Worker processes per interface   (default 1)\n"
+       "    --backend BACKEND         raw|packet|null|pcap:FILE    (default raw)\n"
+       "    --dst-mac MAC             Next hop MAC address (packet backend)\n"
+       "    --vlan VID[:PCP][,...]    VLAN tag(s), two for QinQ (packet backend)\n"
+       "    --replay FILE             Send the IPv4 packets of a pcap file\n"
+       "    --rewrite FIELD[,...]     daddr,saddr,sport,dport,ttl (replay)\n"
+       "    --io-uring                Asynchronous sends (io_uring)    (default OFF)\n"
+       "    --uring-depth NUM         Sends in flight                  (default 256)\n"
+       "    --uring-batch NUM         Sends per submission (default 32, 1 if paced)\n"
+       "    --on-full POLICY          wait|spin|drop when the socket is full\n"
+       "                                                         (default wait)\n"
+       "    --payload NUM             TCP and UDP payload size (bytes)\n"
+       "    --offload                 Offload TCP and UDP checksums (packet backend)\n"
+       "    --gso NUM                 Send GSO packets of NUM segments (implies --offload)\n"
+       "    --tx-queues               A TX queue (and CPU) per worker (packet backend)\n"
+       "    --txtime                  Kernel pacing (SO_TXTIME, fq or etf qdisc)\n"
+       "    --latency                 Build and send time percentiles, per module\n"
+       "    --counters                CPU counters per packet, per worker (perf)\n"
+       "    --if-stats                Compare with the interface and qdisc counters\n"
+       "    --metrics ENDPOINT        Prometheus metrics on [ADDR:]PORT or a unix\n"
+       "                              socket PATH\n"
+       "    --control PATH            Control socket: pause, resume, rate, mix,\n"
+       "                              target, stats (while running)\n"
+       "    --report FILE             Write a JSON report of the run\n"
+       "    --csv FILE                Write each statistics interval as CSV\n"
+       "    --bench BASELINE          Benchmark the modules, compare with BASELINE\n"
+       "    --bench-tolerance PCT     Slowdown taken as a regression  (default 10)\n"
+       "    --bench-create            Take a new baseline (from a good build)\n"
+       "    --seed NUM                Fixed random seed: the same packets each run\n"
+       "    --golden DIR              Check the packets against a golden corpus\n"
+       "    --golden-create           Create the corpus first (from a good build)\n"
+       "    --scale N                 Scaling benchmark: 1, 2, 4 ... N workers on\n"
+       "                              each backend, --duration each  (default 2s)\n"
        "    --encapsulated            Encapsulated protocol (GRE)      (default OFF)\n"
        " -B,--bogus-csum              Bogus checksum                   (default OFF)\n"
 #ifdef  __HAVE_TURBO__
@@ -0,0 +1,280 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file ifstats.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/gen_stats.h>
+#include <linux/pkt_sched.h>
+
+/* NOTE: t50 counts what the kernel took (sendto(), or the ring); the
+         interface counts what its driver transmitted. Whatever is in
+         between was dropped by the qdisc or by the driver, or is still
+         queued. Both are read with rtnetlink dumps (the links, with
+         IFLA_STATS64, and the root qdiscs, with TCA_STATS2), by the
+         parent, so the workers don't change at all.
+
+         The interface counts every packet it sends, not only t50's:
+         other traffic makes the difference smaller (even negative). */
+
+/* Backlog drain at the end of the run: 10 times 100 ms, at most. */
+#define IFSTATS_DRAIN_TRIES  10
+
+/* Counters of an interface and of its root qdisc. */
+struct if_sample
+{
+  uint64_t tx_packets;      /* transmitted by the driver.     */
+  uint64_t tx_dropped;      /* dropped by the driver.         */
+  uint64_t tx_errors;
+  uint32_t q_drops;         /* root qdisc (32 bits, wraps).   */
+  uint32_t q_overlimits;
+  uint32_t q_requeues;
+  uint32_t q_qlen;          /* backlog (packets).             */
+};
+
+static unsigned         if_count = 0;
+static int              if_index[STATS_MAX_GROUPS];
+static char             if_name[STATS_MAX_GROUPS][IF_NAMESIZE];
+static char             if_qdisc[STATS_MAX_GROUPS][16];
+static struct if_sample if_first[STATS_MAX_GROUPS];  /* before the first packet. */
+static struct if_sample if_last[STATS_MAX_GROUPS];   /* last interval.           */
+
+static int  take_sample(struct if_sample *);
+static int  sample_link(const struct nlmsghdr *, void *);
+static int  sample_qdisc(const struct nlmsghdr *, void *);
+static int  find_iface(int);
+static void show_iface(double, unsigned, uint64_t, const struct if_sample *, const struct if_sample *);
+
+/**
+ * Selects the interfaces to watch and takes their counters before
+ * anything is sent.
+ *
+ * The interfaces are the ones on --iface (a worker group each) or,
+ * without it, the interface of the route to the first destination.
+ *
+ * Used only by the parent process, before the workers are created.
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @param ngroups Number of worker groups (interfaces).
+ */
+void start_ifstats(const struct config_options *const __restrict__ co, unsigned ngroups)
+{
+  struct in_addr daddr;
+  unsigned i;
+
+  if (co->iface)
+  {
+    for (i = 0; i < ngroups; i++)
+    {
+      if_index[i] = get_iface_index(i);
+      snprintf(if_name[i], IF_NAMESIZE, "%s", get_iface_name(i));
+    }
+    if_count = ngroups;
+  }
+  else
+  {
+    daddr.s_addr = get_first_target();
+    if (!(if_index[0] = get_route_iface(daddr.s_addr)) || !if_indextoname(if_index[0], if_name[0]))
+    {
+      error("No route to %s: no interface statistics.", inet_ntoa(daddr));
+      return;
+    }
+    if_count = 1;
+  }
+
+  for (i = 0; i < if_count; i++)
+    strcpy(if_qdisc[i], "none");
+
+  if (!take_sample(if_first))
+  {
+    error("Cannot read the interface statistics (rtnetlink).");
+    if_count = 0;
+    return;
+  }
+
+  memcpy(if_last, if_first, sizeof(if_first));
+}
+
+/**
+ * Shows what t50 sent and what the interfaces transmitted, and where
+ * the difference went.
+ *
+ * @param prev Counters at the start of the interval (NULL: the whole run).
+ * @param cur Counters now.
+ */
+void show_ifstats(const struct stats_snapshot *prev, const struct stats_snapshot *cur)
+{
+  struct if_sample s[STATS_MAX_GROUPS];
+  struct timespec nap = { 0, 100000000 };   /* 100 ms */
+  unsigned i, tries = 0;
+  uint32_t backlog;
+
+  if (!if_count)
+    return;
+
+  for (;;)
+  {
+    if (!take_sample(s))
+      return;
+
+    /* At the end, gives the queued packets a chance to go. */
+    for (backlog = 0, i = 0; i < if_count; i++)
+      backlog += s[i].q_qlen;
+    if (prev || !backlog || ++tries > IFSTATS_DRAIN_TRIES)
+      break;
+
+    nanosleep(&nap, NULL);
+  }
+
+  if (!prev)
+    printf("\n%-12s %14s %14s %18s %12s %12s %8s  %s\n", "Interface", "sent by t50",
+           "transmitted", "dropped in stack", "qdisc drops", "driver drops", "backlog", "qdisc");
+
+  for (i = 0; i < if_count; i++)
+    if (prev)
+    {
+      show_iface(cur->elapsed, i, cur->group_packets[i] - prev->group_packets[i], &s[i], &if_last[i]);
+      if_last[i] = s[i];
+    }
+    else
+      show_iface(-1.0, i, cur->group_packets[i], &s[i], &if_first[i]);
+}
+
+/* Reads the counters of every interface watched (and of its root qdisc). */
+static int take_sample(struct if_sample *s)
+{
+  memset(s, 0, sizeof(struct if_sample) * STATS_MAX_GROUPS);
+
+  return rtnl_dump(RTM_GETLINK, sizeof(struct ifinfomsg), sample_link, s) &&
+         rtnl_dump(RTM_GETQDISC, sizeof(struct tcmsg), sample_qdisc, s);
+}
+
+/* rtnl_dump() callback: the counters of a link, if watched. */
+static int sample_link(const struct nlmsghdr *nlh, void *arg)
+{
+  struct if_sample *s = arg;
+  const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+  const struct rtattr *rta;
+  struct rtnl_link_stats64 st;
+  int i;
+
+  if ((i = find_iface(ifi->ifi_index)) < 0 ||
+      (rta = rtnl_attr(nlh, sizeof(*ifi), IFLA_STATS64)) == NULL ||
+      RTA_PAYLOAD(rta) < sizeof(st))
+    return TRUE;
+
+  /* NOTE: Attributes are only 4 bytes aligned. */
+  memcpy(&st, RTA_DATA(rta), sizeof(st));
+  s[i].tx_packets = st.tx_packets;
+  s[i].tx_dropped = st.tx_dropped;
+  s[i].tx_errors  = st.tx_errors;
+
+  return TRUE;
+}
+
+/* rtnl_dump() callback: the counters of a root qdisc, if watched.
+   NOTE: Multiqueue roots (mq, mqprio) add up their children's. */
+static int sample_qdisc(const struct nlmsghdr *nlh, void *arg)
+{
+  struct if_sample *s = arg;
+  const struct tcmsg *tcm = NLMSG_DATA(nlh);
+  const struct rtattr *rta, *st;
+  struct gnet_stats_queue q;
+  struct tc_stats old;
+  int i, len;
+
+  if (tcm->tcm_parent != TC_H_ROOT || (i = find_iface(tcm->tcm_ifindex)) < 0)
+    return TRUE;
+
+  if ((rta = rtnl_attr(nlh, sizeof(*tcm), TCA_KIND)) != NULL)
+    snprintf(if_qdisc[i], sizeof(if_qdisc[i]), "%.*s", (int)RTA_PAYLOAD(rta),
+             (const char *)RTA_DATA(rta));
+
+  if ((rta = rtnl_attr(nlh, sizeof(*tcm), TCA_STATS2)) != NULL)
+  {
+    for (st = RTA_DATA(rta), len = RTA_PAYLOAD(rta); RTA_OK(st, len); st = RTA_NEXT(st, len))
+      if (st->rta_type == TCA_STATS_QUEUE && RTA_PAYLOAD(st) >= sizeof(q))
+      {
+        memcpy(&q, RTA_DATA(st), sizeof(q));
+        s[i].q_drops      = q.drops;
+        s[i].q_overlimits = q.overlimits;
+        s[i].q_requeues   = q.requeues;
+        s[i].q_qlen       = q.qlen;
+      }
+  }
+  else if ((rta = rtnl_attr(nlh, sizeof(*tcm), TCA_STATS)) != NULL &&
+           RTA_PAYLOAD(rta) >= sizeof(old))
+  {
+    /* Old kernels. */
+    memcpy(&old, RTA_DATA(rta), sizeof(old));
+    s[i].q_drops      = old.drops;
+    s[i].q_overlimits = old.overlimits;
+    s[i].q_qlen       = old.qlen;
+  }
+
+  return TRUE;
+}
+
+/* Index of a watched interface, or -1. */
+static int find_iface(int ifindex)
+{
+  unsigned i;
+
+  for (i = 0; i < if_count; i++)
+    if (if_index[i] == ifindex)
+      return i;
+
+  return -1;
+}
+
+/* A line of an interface: an interval (ending at 'elapsed'), or the
+   whole run (a table row, 'elapsed' < 0). */
+static void show_iface(double elapsed,
+                       unsigned i,
+                       uint64_t sent,
+                       const struct if_sample *cur,
+                       const struct if_sample *last)
+{
+  uint64_t transmitted = cur->tx_packets - last->tx_packets;
+  int64_t  lost = (int64_t)(sent - transmitted);
+  uint32_t q_drops = cur->q_drops - last->q_drops;    /* modulo 2^32. */
+
+  if (elapsed >= 0.0)
+    printf("[%8.1fs]   %-12s sent by t50 %" PRIu64 ", transmitted %" PRIu64 ", dropped in stack %"
+           PRId64 " (qdisc %" PRIu32 ", driver %" PRIu64 ", backlog %" PRIu32 ")\n",
+           elapsed, if_name[i], sent, transmitted, lost, q_drops,
+           cur->tx_dropped - last->tx_dropped, cur->q_qlen);
+  else
+  {
+    printf("  %-10s %14" PRIu64 " %14" PRIu64 " %10" PRId64 " (%4.1f%%) %12" PRIu32 " %12" PRIu64
+           " %8" PRIu32 "  %s\n",
+           if_name[i], sent, transmitted, lost, sent ? 100.0 * lost / sent : 0.0, q_drops,
+           cur->tx_dropped - last->tx_dropped, cur->q_qlen, if_qdisc[i]);
+
+    if (cur->tx_errors != last->tx_errors || cur->q_overlimits != last->q_overlimits ||
+        cur->q_requeues != last->q_requeues)
+      printf("  %-10s transmit errors %" PRIu64 ", qdisc overlimits %" PRIu32 ", requeues %" PRIu32 ".\n",
+             "", cur->tx_errors - last->tx_errors, (uint32_t)(cur->q_overlimits - last->q_overlimits),
+             (uint32_t)(cur->q_requeues - last->q_requeues));
+  }
+}
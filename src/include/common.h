@@ -47,6 +47,7 @@
 #include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <net/if.h>   /* NOTE: Must come before any linux/if.h. */
 
 /* This code prefers to use Linux headers rather than BSD favored */
 #include <linux/ip.h>
@@ -64,25 +65,180 @@
 #include <config.h>
 #include <help.h>
 #include <modules.h>
+#include <stats.h>
+#include <control.h>
+#include <probes.h>
 
 /* NOTE: Protocols and modules definitions are on modules.h now. */
 
+/* Counters slot of a module: its index on mod_table or, for a module
+   out of it (replay), the last one. */
+static inline unsigned module_slot(const modules_table_t *ptbl)
+{
+  unsigned m = ptbl - mod_table;
+
+  return m < STATS_MAX_MODULES - 1 ? m : STATS_MAX_MODULES - 1;
+}
+
 /* The packet buffer. Reallocated as needed! */
 extern void     *packet;
 
+/* First Ctrl+C: stop sending (and stop waiting for room to send). */
+extern volatile sig_atomic_t stop_requested;
+
 /* Realloc packet as needed. Used on module functions. */
 extern void     alloc_packet(size_t);
 
+/* Option sets of the deterministic runs (--bench, --golden). */
+extern const struct option_set option_sets[OPTION_SETS];
+
+/* Offloads of the packet buffer (--offload). */
+extern struct packet_offload pkt_offload;
+extern void     set_offload(const struct config_options * const __restrict__,
+                            const void *, size_t, size_t);
+
 /* NOTE: Since this is not a macro, it's here insted of defines.h. */
 _NOINLINE extern uint32_t RANDOM(void);
 extern void     SRANDOM(void);
+extern void     SRANDOM_SEED(uint64_t);
+extern void     set_fixed_seed(uint64_t);
+extern int      has_fixed_seed(void);
+extern int      get_seed_bytes(void *, size_t);
 extern uint32_t NETMASK_RND(uint32_t) __attribute__((noinline));
 
 /* Common routines used by code */
 extern struct cidr *config_cidr(const struct config_options * const __restrict__);
+extern uint32_t     get_cidr_hosts(uint32_t);     /* Destinations of a CIDR block. */
+extern size_t       load_targets(const char *);   /* Loads a target list file. */
+extern void         save_targets(const char *);   /* Saves the target list in binary form. */
+extern int          config_targets(const struct config_options * const __restrict__);
+extern void         split_targets(unsigned, unsigned);
+extern in_addr_t    next_target(void);            /* Next destination (network order). */
+extern uint32_t     get_number_of_targets(void);
+extern in_addr_t    get_fixed_target(void);       /* The destination, if only one. */
+extern in_addr_t    get_first_target(void);
+extern int          change_targets(const struct config_options * const __restrict__, const uint32_t *, unsigned, unsigned);
+extern void         close_targets(void);
+
+/* T50 protocol mix (schedule of modules). */
+extern unsigned         config_mix(const char *);
+extern unsigned         get_mix_length(void);
+extern unsigned         get_mix_weight(unsigned);
+extern void             split_mix(unsigned, unsigned);
+extern const char      *check_mix(const char *);
+extern unsigned         get_mix_spec_length(const char *);
+extern modules_table_t *next_module(void);
+
+/* Flow table (stable 5-tuples with per flow state). */
+extern void             config_flows(const struct config_options * const __restrict__);
+extern void             split_flows(unsigned, unsigned);
+extern modules_table_t *next_flow(struct config_options * const __restrict__);
+extern void             close_flows(void);
+
+/* io_uring send path. */
+extern void         config_uring(unsigned, unsigned);
+extern int          uring_send(socket_t, const struct msghdr *, size_t);
+extern void         uring_flush(void);
+extern void         close_uring(void);
+
+/* pcap replay. */
+extern uint32_t         load_replay(const char *, unsigned);
+extern uint32_t         get_replay_count(void);
+extern uint32_t         get_replay_skipped(void);
+extern modules_table_t *get_replay_module(void);
+extern void             split_replay(unsigned, unsigned);
+extern void             close_replay(void);
+extern void             open_pcap_output(const char *);
+extern int              write_pcap(const void *, size_t);
+extern void             close_pcap_output(void);
+
+/* rtnetlink dumps (links, qdiscs). */
+struct nlmsghdr;
+struct rtattr;
+extern int                  rtnl_dump(uint16_t, size_t, int (*)(const struct nlmsghdr *, void *), void *);
+extern const struct rtattr *rtnl_attr(const struct nlmsghdr *, size_t, unsigned);
+
+/* Build and send latency histograms. */
+extern void         config_latency(void);
+extern void         split_latency(unsigned);
+extern void         record_latency(const modules_table_t *, uint64_t, uint64_t);
+extern void         show_latency(int);
+
+/* Performance counters (--counters). */
+extern void         start_counters(const pid_t *, unsigned);
+extern void         show_counters(int);
+extern void         stop_counters(void);
+
+/* Interface and qdisc counters (--if-stats). */
+extern void         start_ifstats(const struct config_options *const __restrict__, unsigned);
+extern void         show_ifstats(const struct stats_snapshot *, const struct stats_snapshot *);
+
+/* Performance benchmarks (--bench, --scale). */
+extern int          run_bench(struct config_options * const __restrict__);
+extern int          run_scale(struct config_options * const __restrict__);
+
+/* Golden packet corpus (--golden). */
+extern int          run_golden(struct config_options * const __restrict__);
+
+/* Prometheus metrics endpoint. */
+extern void         start_metrics(const struct config_options * const __restrict__);
+extern void         stop_metrics(void);
+
+/* Live reconfiguration (--control). */
+extern void         config_control(const struct config_options * const __restrict__);
+extern void         split_control(unsigned, unsigned);
+extern int          update_control(struct config_options * const __restrict__);
+extern void         start_control(const struct config_options * const __restrict__);
+extern void         stop_control(void);
+extern void         get_control_pools(uint32_t *, unsigned *);
+
+/* End of run report (JSON) and per interval CSV. */
+extern void         start_report(const struct config_options * const __restrict__, char **);
+extern void         report_interval(const struct stats_snapshot *, const struct stats_snapshot *);
+extern void         write_report(const struct config_options * const __restrict__);
+
+/* Statistics and receive thread. */
+extern void         config_stats(unsigned);
+extern void         split_stats(unsigned, unsigned);
+extern void         start_stats(const struct config_options * const __restrict__);
+extern void         stop_stats(void);
+extern void         take_stats_snapshot(struct stats_snapshot *);
+extern const char  *get_module_slot_name(unsigned);
+extern void         get_peak_rates(double *, double *);
+extern void         show_stats(const struct config_options * const __restrict__);
+extern void         start_rx(const struct config_options * const __restrict__);
+extern void         stop_rx(void);
+
+/* Pacing clock, duration and rate profiles. */
+extern double       parse_rate(const char *);
+extern double       parse_time(const char *);
+extern double       config_pacing(const struct config_options * const __restrict__);
+extern void         start_pacing(double);
+extern void         split_pacing(unsigned, unsigned);
+extern int          pace(void);
+extern void         set_pacing_rate(double);
+extern int          pacing_expired(void);
+extern double       get_target_rate(double);
+extern int          get_pacing_step(double);
+extern uint64_t     get_txtime(void);
+
 extern uint16_t     cksum(void *, size_t);  /* Checksum calc. */
+extern void         cksum_update16(uint16_t *, uint16_t, uint16_t);  /* Incremental update. */
+extern void         cksum_update32(uint16_t *, uint32_t, uint32_t);
 extern in_addr_t    resolv(char *);         /* Resolve name to ip address. */
-extern void         create_socket(void);    /* Creates the sending socket */
+extern unsigned     create_socket(const struct config_options * const __restrict__);  /* Creates the sending sockets */
+extern void         select_socket(unsigned);        /* Selects the interface of this worker */
+extern void         unconnect_socket(void);         /* Destination on each packet again */
+extern const char  *get_iface_name(unsigned);
+extern int          get_iface_index(unsigned);
+extern size_t       config_l2(const struct config_options * const __restrict__, const char *, uint8_t *);
+extern int          get_qdisc_kind(int, char *, size_t);   /* Root qdisc of an interface. */
+extern int          get_route_iface(in_addr_t);   /* Interface of the route to an address. */
+extern in_addr_t    get_route_source(in_addr_t);  /* Our address on the route to an address. */
+extern int          has_qdisc(int, const char *);
+extern int          get_etf_clockid(int);
+extern void         bind_tx_queue(unsigned);   /* A socket and a TX queue per worker */
+extern void         flush_socket(void);     /* Waits for the packets in flight */
 extern void         close_socket(void);     /* Close the previously created socket */
 
 /* Send the actual packet from buffer, with size bytes, using config options. */
@@ -92,6 +248,7 @@ extern int  send_packet(const void *const,
 
 extern void show_version(void); /* Prints version info. */
 extern void usage(void);        /* Prints usage message */
+extern void remove_stale_socket(const char *);  /* A unix socket left behind. */
 
 _NOINLINE extern void error(char *, ...);
 _NOINLINE extern void fatal_error(char *, ...) __attribute__((noreturn));
@@ -43,6 +43,48 @@ enum
 #endif  /* __HAVE_TURBO__ */
   OPTION_LIST_PROTOCOLS,
   OPTION_BOGUSCSUM,
+  OPTION_TARGETS,
+  OPTION_TARGETS_SAVE,
+  OPTION_TARGET_ORDER,
+  OPTION_MIX,
+  OPTION_FLOWS,
+  OPTION_FLOW_SCHED,
+  OPTION_STATS_INTERVAL,
+  OPTION_RX,
+  OPTION_RX_IFACE,
+  OPTION_DURATION,
+  OPTION_RATE,
+  OPTION_RAMP,
+  OPTION_IFACE,
+  OPTION_WORKERS,
+  OPTION_BACKEND,
+  OPTION_DST_MAC,
+  OPTION_VLAN,
+  OPTION_REPLAY,
+  OPTION_REWRITE,
+  OPTION_IO_URING,
+  OPTION_URING_DEPTH,
+  OPTION_URING_BATCH,
+  OPTION_ON_FULL,
+  OPTION_PAYLOAD,
+  OPTION_OFFLOAD,
+  OPTION_GSO,
+  OPTION_TX_QUEUES,
+  OPTION_TXTIME,
+  OPTION_LATENCY,
+  OPTION_METRICS,
+  OPTION_REPORT,
+  OPTION_CSV,
+  OPTION_BENCH,
+  OPTION_BENCH_TOLERANCE,
+  OPTION_SEED,
+  OPTION_GOLDEN,
+  OPTION_COUNTERS,
+  OPTION_IF_STATS,
+  OPTION_CONTROL,
+  OPTION_SCALE,
+  OPTION_GOLDEN_CREATE,
+  OPTION_BENCH_CREATE,
 
   /* XXX DCCP, TCP & UDP HEADER OPTIONS            */
   OPTION_SOURCE,
@@ -305,6 +347,51 @@ struct config_options
 #ifdef  __HAVE_TURBO__
   int       turbo;                  /* duplicate the attack        */
 #endif  /* __HAVE_TURBO__ */
+  char      *targets;               /* target list file            */
+  char      *targets_save;          /* binary target list output   */
+  int       target_order;           /* destination address order   */
+  char      *mix;                   /* T50 protocol mix            */
+  uint32_t  flows;                  /* number of flows (0 = off)   */
+  int       flow_sched;             /* flow scheduling             */
+  double    flow_zipf;              /* Zipf exponent               */
+  unsigned  stats_interval;         /* stats interval (seconds)    */
+  int       rx;                     /* receive thread              */
+  char      *rx_iface;              /* receive interface           */
+  double    duration;               /* run duration (seconds)      */
+  double    rate;                   /* packets per second          */
+  char      *ramp;                  /* rate profile                */
+  char      *iface;                 /* sending interfaces list     */
+  unsigned  workers;                /* workers per interface       */
+  int       backend;                /* sending backend             */
+  char      *pcap;                  /* pcap backend file           */
+  char      *dst_mac;               /* next hop MAC address        */
+  char      *vlan;                  /* VLAN tags                   */
+  char      *replay;                /* pcap file to replay         */
+  unsigned  rewrite;                /* replay rewritten fields     */
+  int       io_uring;               /* send through io_uring       */
+  unsigned  uring_depth;            /* sends in flight             */
+  unsigned  uring_batch;            /* sends per submission        */
+  int       on_full;                /* socket full policy          */
+  unsigned  payload;                /* TCP and UDP payload size    */
+  int       offload;                /* offload checksums (vnet)    */
+  unsigned  gso;                    /* segments per GSO packet     */
+  int       tx_queues;              /* a TX queue per worker       */
+  int       txtime;                 /* kernel pacing (SO_TXTIME)   */
+  int       latency;                /* build and send histograms   */
+  int       counters;               /* perf counters per worker    */
+  int       if_stats;               /* interface and qdisc stats   */
+  char      *metrics;               /* Prometheus endpoint         */
+  char      *control;               /* control socket path         */
+  char      *report;                /* JSON report file            */
+  char      *csv;                   /* CSV file (per interval)     */
+  char      *bench;                 /* benchmark baseline file     */
+  unsigned  bench_tolerance;        /* regression threshold (%)    */
+  int       bench_create;           /* take a new baseline         */
+  int       seeded;                 /* deterministic (--seed)      */
+  uint64_t  seed;                   /* fixed random seed           */
+  char      *golden;                /* golden corpus directory     */
+  int       golden_create;          /* (re)create the corpus       */
+  unsigned  scale;                  /* scaling benchmark (workers) */
 
   /* XXX DCCP, TCP & UDP HEADER OPTIONS                            */
   uint16_t  source;                 /* general source port         */
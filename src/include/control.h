@@ -0,0 +1,73 @@
+/* vim: set ts=2 et sw=2 : */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CONTROL_INCLUDED__
+#define __CONTROL_INCLUDED__
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* Longest protocol mix given on the control socket. */
+#define CONTROL_MIX_SIZE  512
+
+/**
+ * Parameters which can be changed while running (--control).
+ */
+struct control_config
+{
+  int       paused;                 /* nothing is sent.               */
+  double    rate;                   /* pps, all workers; < 0: --rate
+                                       or --ramp, as given.           */
+  char      mix[CONTROL_MIX_SIZE];  /* "": --mix, as given.           */
+  in_addr_t daddr;                  /* CIDR block (network order).    */
+  uint32_t  bits;
+  uint32_t  perm[3];                /* its permutation parameters.    */
+};
+
+/**
+ * Versioned snapshots of the parameters, shared by all processes.
+ *
+ * Mapped (shared) before fork(). The control thread is the only writer:
+ * it writes the slot the workers aren't reading ('version + 1'), then
+ * publishes it by bumping 'version'. Each slot has a sequence number,
+ * odd while the slot is written (a seqlock): workers copy the slot of
+ * the version they saw, and copy again unless they read the same even
+ * sequence before and after the copy. No locks: a worker never waits
+ * for the control thread, only for a copy of a slot.
+ */
+struct t50_control
+{
+  uint64_t              version;
+  uint64_t              seq[2];     /* odd: config[i] being written.     */
+  struct control_config config[2];  /* 'version & 1' is the current one. */
+} __attribute__((aligned(64)));
+
+extern struct t50_control *control;
+extern uint64_t            control_seen;    /* This worker's version. */
+extern int                 control_paused;
+
+/* Is there a new snapshot (or is this worker paused)? Checked on every
+   packet: a load from a cache line written only on a command. */
+static inline int control_pending(void)
+{
+  return __atomic_load_n(&control->version, __ATOMIC_RELAXED) != control_seen || control_paused;
+}
+
+#endif  /* __CONTROL_INCLUDED__ */
@@ -40,6 +40,78 @@
  */
 #define INITIAL_PACKET_SIZE 2048
 
+/* Destination addresses iteration order (--target-order). */
+#define TARGET_ORDER_RANDOM      0
+#define TARGET_ORDER_SEQUENTIAL  1
+#define TARGET_ORDER_PERMUTATION 2
+
+/* Flow scheduling (--flow-sched). */
+#define FLOW_SCHED_RR            0
+#define FLOW_SCHED_ZIPF          1
+#define FLOWS_MAXIMUM            (1U << 24)
+
+/* Sending backends (--backend). */
+#define BACKEND_RAW              0  /* raw IP socket.                 */
+#define BACKEND_PACKET           1  /* AF_PACKET, Ethernet framing.   */
+#define BACKEND_NULL             2  /* discarded (no socket).         */
+#define BACKEND_PCAP             3  /* written to a pcap file.        */
+
+/* Benchmark (--bench): destination (TEST-NET-1), if none is given, and
+   the default regression threshold (percent). */
+#define BENCH_TARGET             0xc0000201U  /* 192.0.2.1 */
+#define BENCH_TOLERANCE          10
+
+/* Deterministic runs (--bench, --golden): the seed, if no --seed is
+   given, and the option sets of the cases (see option_sets[]). */
+#define DETERMINISTIC_SEED       0x7435305eedULL
+#define OPTION_SETS              3
+
+/* Scaling benchmark (--scale): time of each step (seconds), if no
+   --duration is given. */
+#define SCALE_DURATION           2.0
+
+/* Backends sending nothing: no sockets, no root needed. */
+#define IS_OFFLINE_BACKEND(b)    ((b) >= BACKEND_NULL)
+
+/* Fields rewritten on replayed packets (--rewrite). */
+#define REWRITE_DADDR            0x01
+#define REWRITE_SADDR            0x02
+#define REWRITE_SPORT            0x04
+#define REWRITE_DPORT            0x08
+#define REWRITE_TTL              0x10
+
+/* TCP and UDP payload: room left for the IP header, the largest TCP header
+   and GRE encapsulation in a 64 KiB packet. Also the limit of GSO packets. */
+#define PAYLOAD_MAXIMUM          65000
+#define GSO_MAXIMUM              64
+
+/* Checksums offloaded (--offload): TCP and UDP packets with payload,
+   not encapsulated and not bogus. GSO packets carry --gso segments. */
+#define L4_OFFLOAD(co)           ((co)->offload && !(co)->encapsulated && !(co)->bogus_csum)
+#define L4_PAYLOAD(co)           ((co)->payload * (L4_OFFLOAD(co) && (co)->gso ? (co)->gso : 1))
+
+/* What to do when the socket is full (--on-full). */
+#define ON_FULL_WAIT             0
+#define ON_FULL_SPIN             1
+#define ON_FULL_DROP             2
+
+/* send_packet() results. */
+#define SEND_ERROR               0
+#define SEND_OK                  1
+#define SEND_DROPPED             2
+
+/* Ethernet header plus two VLAN tags (QinQ). */
+#define L2_MAX_HEADER            (ETH_HLEN + 2 * 4)
+
+/* io_uring: buffer pool slot size (frame). Bigger packets are sent
+   synchronously. */
+#define URING_MAX_PACKET         2048
+#define URING_DEFAULT_DEPTH      256
+#define URING_DEFAULT_BATCH      32
+
+/* io_uring: room for control messages (a transmit time). */
+#define URING_MAX_CONTROL        32
+
 #define CIDR_MINIMUM 8
 #define CIDR_MAXIMUM 32 // fix #7
 
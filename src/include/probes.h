@@ -0,0 +1,58 @@
+/* vim: set ts=2 et sw=2 : */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PROBES_INCLUDED__
+#define __PROBES_INCLUDED__
+
+/* USDT probes (provider "t50"), for bpftrace, perf or systemtap:
+
+     bpftrace -e 'usdt:./t50:t50:send_full { @[arg2] = count(); }'
+
+   Each probe is a single nop on the binary (and a note on the ELF file,
+   with where to find its arguments); a tracer turns it into a trap only
+   while attached. Without <sys/sdt.h> (systemtap-sdt-dev), they're gone.
+
+   Probes and arguments:
+     build_start   protocol
+     build_done    protocol, size
+     send_ok       protocol, size
+     send_full     protocol, size, errno (EAGAIN, ENOBUFS)
+     send_error    protocol, size, errno
+     io_stall      fd, timeout (ms)          poll() timed out (--on-full=wait)
+     stats_tick    packets, bytes, errors    totals, each --stats-interval */
+
+#if defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define __HAVE_PROBES__
+# endif
+#endif
+
+#ifdef __HAVE_PROBES__
+# define PROBE1(name, a)        DTRACE_PROBE1(t50, name, a)
+# define PROBE2(name, a, b)     DTRACE_PROBE2(t50, name, a, b)
+# define PROBE3(name, a, b, c)  DTRACE_PROBE3(t50, name, a, b, c)
+#else
+# define PROBE1(name, a)        do {} while (0)
+# define PROBE2(name, a, b)     do {} while (0)
+# define PROBE3(name, a, b, c)  do {} while (0)
+#endif
+
+#endif
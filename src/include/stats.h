@@ -0,0 +1,132 @@
+/* vim: set ts=2 et sw=2 : */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __STATS_INCLUDED__
+#define __STATS_INCLUDED__
+
+#include <stdint.h>
+#include <time.h>
+
+/* Maximum number of sending processes. */
+#define STATS_MAX_WORKERS 64
+
+/* Maximum number of worker groups (interfaces on --iface list). */
+#define STATS_MAX_GROUPS  16
+
+/* Counters per module: the T50 modules and, on the last one, replayed
+   packets (see module_slot()). */
+#define STATS_MAX_MODULES 16
+
+/* Classes of packets seen by the receive thread. */
+enum
+{
+  RX_SYNACK = 0,
+  RX_RST,
+  RX_TCP_OTHER,
+  RX_ICMP_ECHOREPLY,
+  RX_ICMP_UNREACH,
+  RX_ICMP_OTHER,
+  RX_UDP,
+  RX_OTHER,
+
+  RX_CLASSES
+};
+
+/**
+ * Transmit counters of a worker.
+ *
+ * Each worker writes only its own counters, so there are no locks or atomics
+ * on the hot path. Every worker has its own cache line.
+ */
+struct worker_stats
+{
+  uint64_t packets;           /* packets sent.                  */
+  uint64_t bytes;             /* bytes sent (IP).               */
+  uint64_t errors;            /* send errors.                   */
+  uint64_t full;              /* socket (or queue) found full.  */
+  uint64_t full_ns;           /* time waiting or spinning.      */
+  uint64_t drops;             /* dropped when full (not sent).  */
+  int32_t  txq;               /* TX queue (--tx-queues), or -1. */
+  int32_t  cpu;               /* CPU it's pinned to.            */
+
+  uint64_t module_packets[STATS_MAX_MODULES];
+  uint64_t module_bytes[STATS_MAX_MODULES];
+} __attribute__((aligned(64)));
+
+/**
+ * Statistics shared by all processes.
+ *
+ * Mapped (shared) before fork(), so the parent sees the counters of
+ * every worker.
+ */
+struct t50_stats
+{
+  struct timespec     start;  /* CLOCK_MONOTONIC.               */
+  struct timespec     stop;   /* zero while running.            */
+  unsigned            nworkers;
+  unsigned            ngroups;  /* worker 'i' is on group 'i % ngroups'. */
+
+  struct worker_stats worker[STATS_MAX_WORKERS];
+
+  /* Written only by the receive thread (parent process). */
+  uint64_t            rx[RX_CLASSES];
+  uint64_t            rx_drops;   /* dropped by the RX ring.    */
+} __attribute__((aligned(64)));
+
+/* Summed up counters. */
+struct stats_snapshot
+{
+  double   elapsed;           /* seconds since start.           */
+  uint64_t packets;
+  uint64_t bytes;
+  uint64_t errors;
+  uint64_t full;
+  uint64_t full_ns;
+  uint64_t drops;
+  uint64_t rx[RX_CLASSES];
+  uint64_t rx_total;
+
+  /* Per group (interface). */
+  uint64_t group_packets[STATS_MAX_GROUPS];
+  uint64_t group_bytes[STATS_MAX_GROUPS];
+  uint64_t group_errors[STATS_MAX_GROUPS];
+
+  /* Per module. */
+  uint64_t module_packets[STATS_MAX_MODULES];
+  uint64_t module_bytes[STATS_MAX_MODULES];
+};
+
+/* Latency clock: the TSC (cheap, no system call), or a clock in ns. */
+static inline uint64_t latency_clock(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+extern struct t50_stats    *stats;
+extern struct worker_stats *wstats;   /* This worker's counters. */
+
+#endif
@@ -90,4 +90,24 @@ struct psdhdr
   uint16_t  len;        /* header length       */
 };
 
+/* Offloads of the packet just built (--offload), for the virtio header
+   on packet sockets. Offsets are from the IP header. */
+struct packet_offload
+{
+  uint16_t  csum_start; /* L4 header (0: no offload)      */
+  uint16_t  csum_offset;/* checksum, from csum_start      */
+  uint16_t  hdr_len;    /* IP and L4 headers              */
+  uint16_t  gso_size;   /* payload per segment (0: no GSO) */
+  uint8_t   protocol;   /* IPPROTO_TCP or IPPROTO_UDP     */
+  uint8_t   segs;       /* segments on the wire           */
+};
+
+/* Options of the cases of the deterministic runs (--bench, --golden). */
+struct option_set
+{
+  const char *name;
+  int        encapsulated;  /* GRE (--encapsulated). */
+  int        bogus_csum;    /* -B.                   */
+};
+
 #endif
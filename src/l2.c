@@ -0,0 +1,261 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file l2.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <sys/ioctl.h>
+#include <linux/if_arp.h>
+
+/* Next hop resolution: tries (100 ms apart) before giving up. */
+#define L2_ARP_TRIES  20
+
+/* Flags on /proc/net/route and /proc/net/arp. */
+#define L2_RTF_UP       0x0001
+#define L2_RTF_GATEWAY  0x0002
+#define L2_ATF_COM      0x02
+
+static int  parse_mac(const char *, uint8_t *);
+static int  get_next_hop(const char *, in_addr_t, in_addr_t *);
+static int  arp_lookup(const char *, in_addr_t, uint8_t *);
+static void arp_solicit(const char *, in_addr_t);
+
+/**
+ * Builds the Ethernet header (and VLAN tags) used on an interface.
+ *
+ * The source address is the interface's. The destination is the next
+ * hop: given by --dst-mac or resolved once, here, from the routing
+ * table and the neighbour (ARP) cache. Every packet goes to the same
+ * next hop, so the kernel does no per destination lookup.
+ *
+ * --vlan takes one or two tags: VID[:PCP][,VID[:PCP]]. With two tags,
+ * the first is the outer (802.1ad) and the second the inner (802.1Q).
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @param iface Interface name.
+ * @param hdr Buffer (at least L2_MAX_HEADER bytes).
+ * @return Length of the header.
+ */
+size_t config_l2(const struct config_options *const __restrict__ co,
+                 const char *iface,
+                 uint8_t *hdr)
+{
+  struct ifreq ifr;
+  socket_t s;
+  in_addr_t nh = 0;
+  uint8_t *p;
+  char *vlan, *tok, *saveptr;
+  unsigned ntags = 0, vid, pcp, i;
+  uint16_t tci[2];
+  int loopback, noarp, try;
+
+  if ((s = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error opening socket: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Error opening socket");
+    #endif
+
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, iface, IFNAMSIZ - 1);
+
+  if (ioctl(s, SIOCGIFFLAGS, &ifr) == -1)
+    fatal_error("Cannot get flags of interface '%s'.", iface);
+  loopback = !!(ifr.ifr_flags & IFF_LOOPBACK);
+  noarp    = !!(ifr.ifr_flags & IFF_NOARP);
+
+  if (ioctl(s, SIOCGIFHWADDR, &ifr) == -1)
+    fatal_error("Cannot get hardware address of interface '%s'.", iface);
+  close(s);
+
+  if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER && ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK)
+    fatal_error("Interface '%s' is not an Ethernet interface.", iface);
+
+  /* Destination: the next hop. */
+  if (co->dst_mac)
+  {
+    if (!parse_mac(co->dst_mac, hdr))
+      fatal_error("Invalid MAC address '%s'.", co->dst_mac);
+  }
+  else if (loopback)
+    memset(hdr, 0, ETH_ALEN);
+  else if (noarp)
+    memset(hdr, 0xff, ETH_ALEN);
+  else
+  {
+    if (!get_next_hop(iface, co->ip.daddr, &nh))
+      fatal_error("No route to the destination through '%s'. Use --dst-mac.", iface);
+
+    for (try = 0; !arp_lookup(iface, nh, hdr); try++)
+    {
+      struct timespec ts = { 0, 100000000 };    /* 100 ms */
+
+      if (try == L2_ARP_TRIES)
+        fatal_error("Cannot resolve the next hop %s on '%s'. Use --dst-mac.",
+                    inet_ntoa(*(struct in_addr *)&nh), iface);
+
+      /* Makes the kernel ask for it. */
+      if (try % 5 == 0)
+        arp_solicit(iface, nh);
+      nanosleep(&ts, NULL);
+    }
+  }
+
+  /* Source: the interface. */
+  memcpy(hdr + ETH_ALEN, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+  p = hdr + 2 * ETH_ALEN;
+
+  /* VLAN tags: TPID + TCI each. */
+  if (co->vlan)
+  {
+    /* strtok_r() changes the string. */
+    if ((vlan = strdup(co->vlan)) == NULL)
+      fatal_error("Cannot allocate memory to parse the VLAN tags.");
+
+    for (tok = strtok_r(vlan, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr))
+    {
+      char *e;
+
+      pcp = 0;
+      errno = 0;
+      vid = strtoul(tok, &e, 10);
+      if (*e == ':')
+        pcp = strtoul(e + 1, &e, 10);
+
+      if (errno || *e || e == tok || vid > 4095 || pcp > 7 || ntags == 2)
+        fatal_error("Invalid VLAN tags '%s' (VID[:PCP][,VID[:PCP]]).", co->vlan);
+
+      tci[ntags++] = pcp << 13 | vid;
+    }
+
+    free(vlan);
+
+    /* QinQ: outer S-tag, inner C-tag. */
+    for (i = 0; i < ntags; i++, p += 4)
+    {
+      *(uint16_t *)p       = htons((ntags == 2 && i == 0) ? ETH_P_8021AD : ETH_P_8021Q);
+      *(uint16_t *)(p + 2) = htons(tci[i]);
+    }
+  }
+
+  *(uint16_t *)p = htons(ETH_P_IP);
+  p += 2;
+
+  return p - hdr;
+}
+
+/* Parses a MAC address (aa:bb:cc:dd:ee:ff or aa-bb-cc-dd-ee-ff). */
+static int parse_mac(const char *s, uint8_t *mac)
+{
+  unsigned m[ETH_ALEN];
+  char sep[ETH_ALEN - 1];
+  int i, n = 0;
+
+  if (sscanf(s, "%2x%c%2x%c%2x%c%2x%c%2x%c%2x%n",
+             &m[0], &sep[0], &m[1], &sep[1], &m[2], &sep[2],
+             &m[3], &sep[3], &m[4], &sep[4], &m[5], &n) != 11 || s[n])
+    return FALSE;
+
+  for (i = 0; i < ETH_ALEN - 1; i++)
+    if (sep[i] != sep[0] || (sep[i] != ':' && sep[i] != '-'))
+      return FALSE;
+
+  for (i = 0; i < ETH_ALEN; i++)
+    mac[i] = m[i];
+
+  return TRUE;
+}
+
+/* Finds the next hop to 'daddr' through 'iface' on the main routing table
+   (longest prefix match). It's the gateway or 'daddr' itself (on link).
+   NOTE: Addresses on /proc/net/route are in network order. */
+static int get_next_hop(const char *iface, in_addr_t daddr, in_addr_t *nh)
+{
+  FILE *f;
+  char line[256], name[IFNAMSIZ + 1];
+  unsigned dest, gw, flags, mask;
+  int found = FALSE;
+  uint32_t best = 0;
+
+  if ((f = fopen("/proc/net/route", "r")) == NULL)
+    return FALSE;
+
+  /* Skips the header. */
+  if (fgets(line, sizeof(line), f))
+    while (fgets(line, sizeof(line), f))
+    {
+      if (sscanf(line, "%16s %x %x %x %*d %*d %*d %x", name, &dest, &gw, &flags, &mask) != 5 ||
+          strcmp(name, iface) || !(flags & L2_RTF_UP) || (daddr & mask) != dest)
+        continue;
+
+      /* Longest prefix wins. */
+      if (!found || ntohl(mask) >= best)
+      {
+        best = ntohl(mask);
+        *nh = (flags & L2_RTF_GATEWAY) ? gw : daddr;
+        found = TRUE;
+      }
+    }
+
+  fclose(f);
+
+  /* NOTE: Without a destination (random or from a list), only a
+           gateway makes sense. */
+  return found && *nh;
+}
+
+/* Looks for a complete entry on the neighbour (ARP) cache. */
+static int arp_lookup(const char *iface, in_addr_t ip, uint8_t *mac)
+{
+  FILE *f;
+  char line[256], addr[16], hw[18], name[IFNAMSIZ + 1];
+  unsigned flags;
+  int found = FALSE;
+
+  if ((f = fopen("/proc/net/arp", "r")) == NULL)
+    return FALSE;
+
+  /* Skips the header. */
+  if (fgets(line, sizeof(line), f))
+    while (!found && fgets(line, sizeof(line), f))
+      if (sscanf(line, "%15s %*x %x %17s %*s %16s", addr, &flags, hw, name) == 4 &&
+          (flags & L2_ATF_COM) && !strcmp(name, iface) &&
+          inet_addr(addr) == ip)
+        found = parse_mac(hw, mac);
+
+  fclose(f);
+
+  return found;
+}
+
+/* Sends a datagram to 'ip' (discard port), so the kernel resolves it. */
+static void arp_solicit(const char *iface, in_addr_t ip)
+{
+  struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(9), .sin_addr.s_addr = ip };
+  socket_t s;
+
+  if ((s = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    return;
+
+  /* NOTE: Errors don't matter here; the lookup tells. */
+  setsockopt(s, SOL_SOCKET, SO_BINDTODEVICE, iface, strlen(iface) + 1);
+  sendto(s, "", 0, MSG_DONTWAIT, (struct sockaddr *)&sin, sizeof(sin));
+
+  close(s);
+}
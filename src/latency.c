@@ -0,0 +1,269 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file latency.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+/* Log-linear (HDR like) histograms: 16 linear sub-buckets per power of
+   two, so each bucket is within 1/16 (6%) of its values. Values up to
+   2^40 clock ticks (minutes); longer ones go on the last bucket. */
+#define LAT_SUB_BITS   4
+#define LAT_SUB        (1U << LAT_SUB_BITS)
+#define LAT_MAX_BITS   40
+#define LAT_BUCKETS    ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB)
+
+/* What is measured. */
+enum { LAT_BUILD = 0, LAT_SEND, LAT_KINDS };
+
+struct lat_hist
+{
+  uint64_t count;
+  uint64_t max;
+  uint64_t bucket[LAT_BUCKETS];
+};
+
+/* A worker's histograms. Written only by the worker. */
+struct worker_latency
+{
+  struct lat_hist h[STATS_MAX_MODULES][LAT_KINDS];
+};
+
+static struct worker_latency *lat = NULL;   /* shared, one per worker. */
+static struct worker_latency *wlat = NULL;  /* this worker's.          */
+static double                 ns_per_tick = 1.0;
+
+/* Interval reports (parent only): the sums at the last report. */
+static struct worker_latency *last = NULL;
+
+static unsigned lat_bucket(uint64_t);
+static uint64_t lat_value(unsigned);
+static void     lat_sum(struct worker_latency *);
+static uint64_t lat_percentile(const struct lat_hist *, const struct lat_hist *, double);
+
+/**
+ * Allocates the latency histograms, shared by all processes, and
+ * calibrates the clock (TSC).
+ *
+ * Must be called before fork().
+ */
+void config_latency(void)
+{
+  struct timespec t0, t1, nap = { 0, 20000000 };   /* 20 ms */
+  uint64_t c0, c1;
+
+  lat = mmap(NULL, STATS_MAX_WORKERS * sizeof(struct worker_latency), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (lat == MAP_FAILED)
+    fatal_error("Cannot allocate the latency histograms.");
+
+  wlat = &lat[0];
+
+  if ((last = calloc(1, sizeof(struct worker_latency))) == NULL)
+    fatal_error("Cannot allocate the latency histograms.");
+
+  /* Clock ticks per nanosecond. */
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  c0 = latency_clock();
+  nanosleep(&nap, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  c1 = latency_clock();
+
+  ns_per_tick = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / (double)(c1 - c0);
+}
+
+/**
+ * Selects the histograms used by this process.
+ *
+ * @param worker Index of this process.
+ */
+void split_latency(unsigned worker)
+{
+  assert(worker < STATS_MAX_WORKERS);
+
+  if (lat)
+    wlat = &lat[worker];
+}
+
+/**
+ * Records the build and send times of a packet.
+ *
+ * @param ptbl Module of the packet.
+ * @param build Time building the packet (clock ticks).
+ * @param send Time sending it (clock ticks).
+ */
+void record_latency(const modules_table_t *ptbl, uint64_t build, uint64_t send)
+{
+  struct lat_hist *h;
+  unsigned m = module_slot(ptbl);
+
+  h = &wlat->h[m][LAT_BUILD];
+  h->count++;
+  h->bucket[lat_bucket(build)]++;
+  if (build > h->max)
+    h->max = build;
+
+  h = &wlat->h[m][LAT_SEND];
+  h->count++;
+  h->bucket[lat_bucket(send)]++;
+  if (send > h->max)
+    h->max = send;
+}
+
+/**
+ * Shows p50, p99, p99.9 and max of the build and send times, per module.
+ *
+ * @param interval TRUE: since the last interval report (max is the
+ *                 bucket's); FALSE: the whole run.
+ */
+void show_latency(int interval)
+{
+  static const char *kinds[LAT_KINDS] = { "build", "send" };
+  static const struct worker_latency zero;
+  struct worker_latency *sum;
+  const struct worker_latency *base;
+  const struct lat_hist *h, *b;
+  unsigned m, k;
+  uint64_t max;
+  int i;
+
+  if (!lat || (sum = malloc(sizeof(*sum))) == NULL)
+    return;
+
+  lat_sum(sum);
+  base = interval ? last : &zero;
+
+  printf("%s%-8s %-5s %10s %10s %10s %10s %10s\n", interval ? "" : "\n",
+         "Latency", "(ns)", "packets", "p50", "p99", "p99.9", "max");
+
+  for (m = 0; m < STATS_MAX_MODULES; m++)
+  {
+    if (sum->h[m][LAT_BUILD].count == base->h[m][LAT_BUILD].count)
+      continue;
+
+    for (k = 0; k < LAT_KINDS; k++)
+    {
+      h = &sum->h[m][k];
+      b = &base->h[m][k];
+
+      /* The exact max is only known for the whole run. */
+      if (interval)
+      {
+        for (max = 0, i = LAT_BUCKETS - 1; i >= 0; i--)
+          if (h->bucket[i] != b->bucket[i])
+          {
+            max = lat_value(i);
+            break;
+          }
+      }
+      else
+        max = h->max;
+
+      printf("  %-6s %-5s %10" PRIu64 " %10.0f %10.0f %10.0f %10.0f\n",
+             k ? "" : get_module_slot_name(m), kinds[k],
+             h->count - b->count,
+             lat_percentile(h, b, 0.50) * ns_per_tick,
+             lat_percentile(h, b, 0.99) * ns_per_tick,
+             lat_percentile(h, b, 0.999) * ns_per_tick,
+             max * ns_per_tick);
+    }
+  }
+
+  if (interval)
+    memcpy(last, sum, sizeof(*sum));
+
+  free(sum);
+}
+
+/* Bucket of a value: the first LAT_SUB are exact; then, for each power of
+   two, LAT_SUB buckets split it linearly. */
+static unsigned lat_bucket(uint64_t v)
+{
+  unsigned msb, shift;
+
+  if (v < LAT_SUB)
+    return v;
+
+  msb = 63 - __builtin_clzll(v);
+  if (msb >= LAT_MAX_BITS)
+    return LAT_BUCKETS - 1;
+
+  shift = msb - LAT_SUB_BITS;
+
+  return (shift + 1) * LAT_SUB + ((v >> shift) & (LAT_SUB - 1));
+}
+
+/* Highest value of a bucket. */
+static uint64_t lat_value(unsigned b)
+{
+  unsigned shift;
+
+  if (b < LAT_SUB)
+    return b;
+
+  shift = b / LAT_SUB - 1;
+
+  return ((uint64_t)(LAT_SUB + b % LAT_SUB) << shift) + (1ULL << shift) - 1;
+}
+
+/* Adds up the histograms of every worker. */
+static void lat_sum(struct worker_latency *sum)
+{
+  unsigned w, m, k, i;
+
+  memset(sum, 0, sizeof(*sum));
+
+  for (w = 0; w < stats->nworkers; w++)
+    for (m = 0; m < STATS_MAX_MODULES; m++)
+      for (k = 0; k < LAT_KINDS; k++)
+      {
+        const struct lat_hist *h = &lat[w].h[m][k];
+
+        if (!h->count)
+          continue;
+
+        sum->h[m][k].count += h->count;
+        if (h->max > sum->h[m][k].max)
+          sum->h[m][k].max = h->max;
+        for (i = 0; i < LAT_BUCKETS; i++)
+          sum->h[m][k].bucket[i] += h->bucket[i];
+      }
+}
+
+/* Percentile 'p' (0..1) of the difference between two histograms. */
+static uint64_t lat_percentile(const struct lat_hist *h, const struct lat_hist *base, double p)
+{
+  uint64_t n, rank, seen = 0;
+  unsigned i;
+
+  if ((n = h->count - base->count) == 0)
+    return 0;
+
+  rank = (uint64_t)(p * n);
+  if (rank >= n)
+    rank = n - 1;
+
+  for (i = 0; i < LAT_BUCKETS; i++)
+    if ((seen += h->bucket[i] - base->bucket[i]) > rank)
+      return lat_value(i);
+
+  return lat_value(LAT_BUCKETS - 1);
+}
@@ -25,10 +25,14 @@
 #include <linux/if_ether.h>
 #endif
 
-static pid_t pid = -1;      /* -1 is a trick used when __HAVE_TURBO__ isn't defined. */
-static sig_atomic_t child_is_dead = 0; /* Used to kill child process if necessary. */
+static pid_t pid = -1;      /* -1 is a trick used when there is a single worker. */
+static pid_t children[STATS_MAX_WORKERS];  /* Parent only: the workers it forked. */
+static unsigned nchildren = 0;
+volatile sig_atomic_t stop_requested = 0;         /* First Ctrl+C stops the main loop. */
 
 _NOINLINE static void               initialize(const struct config_options *);
+_NOINLINE static unsigned           get_number_of_workers(const struct config_options *, unsigned);
+_NOINLINE static void               split_work(struct config_options *, unsigned, unsigned, unsigned);
 _NOINLINE static modules_table_t *  selectProtocol(const struct config_options * const, int *);
 _NOINLINE static const char *       get_ordinal_suffix(unsigned);
 _NOINLINE static const char *       get_month(unsigned);
@@ -42,63 +46,102 @@ _NOINLINE static const char *       get_month(unsigned);
 int main(int argc, char *argv[])
 {
   struct config_options *co;
-  struct cidr           *cidr_ptr;
   modules_table_t       *ptbl;
   int                   proto; /* Used on main loop. */
+  unsigned              ngroups, nworkers, worker;
+  in_addr_t             daddr;
 
   /* Parse_command_line returns ONLY if there are no errors. 
      This must be called before testing user privileges. */
   co = parse_command_line(argv);
 
-  /* User must have root privileges to run T50, unless --help or --version options are found on command line. */
-  if (getuid())
+  /* The benchmark builds every module's packets and exits. */
+  if (co->bench)
+    return run_bench(co);
+
+  /* ... and so does the golden corpus (checked against it). */
+  if (co->golden)
+    return run_golden(co);
+
+  /* The scaling benchmark forks its own workers, on each backend. */
+  if (co->scale)
+    return run_scale(co);
+
+  /* Deterministic mode: everything random starts from the seed. */
+  if (co->seeded)
+    set_fixed_seed(co->seed);
+
+  /* User must have root privileges to run T50, unless --help or --version options are found on command line,
+     or nothing is sent. */
+  if (getuid() && !IS_OFFLINE_BACKEND(co->backend))
     fatal_error("User must have root priviledge to run.");
 
+  /* Prepares the destination addresses (CIDR or target list). */
+  if (!config_targets(co))
+    return EXIT_FAILURE;
+
+  /* The flows take their destinations from the targets. */
+  if (co->flows)
+    config_flows(co);
+
   /* General initializations. */
   initialize(co);
 
-  /* create_socket() handles its own errors before returning. */
-  create_socket();
+  /* create_socket() handles its own errors before returning.
+     There is a group of workers for each interface. */
+  ngroups = create_socket(co);
+  nworkers = get_number_of_workers(co, ngroups);
 
-  /* Calculates CIDR for destination address. */
-  if (!(cidr_ptr = config_cidr(co)))
-    return EXIT_FAILURE;
+  /* Counters must be shared before fork(). */
+  config_stats(ngroups);
+  if (co->latency)
+    config_latency();
 
-#ifdef  __HAVE_TURBO__
-  /* Creates the forked process if turbo is turned on. */
-  if (co->turbo)
-  {
-    /* if it's necessary to fork a new process... */
-    if ((co->ip.protocol == IPPROTO_T50 && 
-         co->threshold > (threshold_t)get_number_of_registered_modules()) ||
-        (co->ip.protocol != IPPROTO_T50 && 
-         co->threshold > 1))
-    {
-      threshold_t new_threshold;
+  /* Parameters which may change while running. */
+  if (co->control)
+    config_control(co);
 
-      if ((pid = fork()) == -1)
-        #ifdef __HAVE_DEBUG__
-        fatal_error("Error creating child process: \"%s\".\nExiting..", strerror(errno));
-        #else
-        fatal_error("Error creating child process");
-        #endif
+  /* The interfaces' counters, before anything is sent. */
+  if (co->if_stats)
+    start_ifstats(co, ngroups);
 
-      /* Divide the process iterations in main loop between processes. 
-         Since we have only 2 processes, max, i'll divide by 2. */
-      new_threshold = co->threshold / 2;
+  /* Starts the pacing clock (and --duration). */
+  start_pacing(co->duration);
 
-      /* Don't let parent process get the extra packet if threshold is odd. */
-      if (!IS_CHILD_PID(pid))
-        new_threshold += (co->threshold & 1);
+  /* The receive ring must be there before any worker sends a packet.
+     NOTE: Its thread doesn't print, so it is safe to fork() now. */
+  if (co->rx)
+    start_rx(co);
 
-      /* Updates threshold for this process. */
-      co->threshold = new_threshold;
-    }
+  /* Creates the worker processes. The parent is worker 0. */
+  for (worker = 1; worker < nworkers; worker++)
+  {
+    if ((pid = fork()) == -1)
+      #ifdef __HAVE_DEBUG__
+      fatal_error("Error creating child process: \"%s\".\nExiting..", strerror(errno));
+      #else
+      fatal_error("Error creating child process");
+      #endif
+
+    if (IS_CHILD_PID(pid))
+      break;
+
+    children[nchildren++] = pid;
   }
-#endif  /* __HAVE_TURBO__ */
+
+  /* The parent leaves the loop with worker == nworkers. */
+  if (!IS_CHILD_PID(pid))
+    worker = 0;
+
+  if (nworkers > 1)
+    split_work(co, worker, nworkers, ngroups);
+
+  /* Each worker on its own TX queue (and CPU), with its own socket. */
+  if (co->tx_queues)
+    bind_tx_queue(worker / ngroups);
 
   /* Setting the priority to both parent and child process to highly favorable scheduling value. */
-  if (setpriority(PRIO_PROCESS, PRIO_PROCESS, -15)  == -1)
+  if (setpriority(PRIO_PROCESS, PRIO_PROCESS, -15)  == -1 && !IS_OFFLINE_BACKEND(co->backend))
   #ifdef __HAVE_DEBUG__
     fatal_error("Error setting process priority: \"%s\".\nExiting..", strerror(errno));
   #else
@@ -127,7 +170,10 @@ int main(int argc, char *argv[])
 
   /* NOTE: Changed the random seed init to here to make
            sure both processes have their own! */
-  SRANDOM();
+  if (co->seeded)
+    SRANDOM_SEED(co->seed + worker * 0x9e3779b97f4a7c15ULL);
+  else
+    SRANDOM();
 
   /* Preallocate packet buffer. */
   alloc_packet(INITIAL_PACKET_SIZE);
@@ -136,27 +182,71 @@ int main(int argc, char *argv[])
   /* NOTE: Minor hack: back here from the last branch to avoid page fault using ptbl pointer. */
   ptbl = selectProtocol(co, &proto);  /* No problems here. ptbl will never be NULL. */
 
+  /* Statistics thread runs on parent process only. */
+  if (!IS_CHILD_PID(pid))
+  {
+    if (co->counters)
+      start_counters(children, nworkers);
+    start_report(co, argv);
+    start_stats(co);
+    if (co->metrics)
+      start_metrics(co);
+    if (co->control)
+      start_control(co);
+  }
+
+  /* A single destination is set once, not on each packet. */
+  if ((daddr = get_fixed_target()) != INADDR_ANY)
+    co->ip.daddr = daddr;
+
   /* MAIN LOOP: Executed if flooding or if threshold is given. */
-  while (co->flood || co->threshold)
+  while ((co->flood || co->threshold) && !stop_requested)
   {
     /* Holds the actual packet size after module function call. */
     size_t size;
+    int    r;
+    uint64_t t0 = 0, t1 = 0, t2 = 0;  /* --latency. */
 
-    /* Set the destination IP address to RANDOM IP address. */
-    /* NOTE: The previous code did not account for 'hostid == 0'! */
-    co->ip.daddr = cidr_ptr->__1st_addr;
+    /* New parameters (--control)? Paused, nothing is sent, but the
+       time still counts. */
+    if (unlikely(co->control) && control_pending())
+    {
+      if (!update_control(co))
+      {
+        if (pacing_expired())
+          break;
+        continue;
+      }
 
-    if (cidr_ptr->hostid)
-      co->ip.daddr += RANDOM() % cidr_ptr->hostid;  /* FIXME: Shouldn't be +1? */ 
+      /* The destinations or the mix may have changed: from their start. */
+      if ((daddr = get_fixed_target()) != INADDR_ANY)
+        co->ip.daddr = daddr;
+      if (proto == IPPROTO_T50 && !co->flows)
+        ptbl = next_module();
+    }
 
-    /* We need the address in network order now. */
-    co->ip.daddr = htonl(co->ip.daddr);
+    /* Set the destination IP address (already in network order)
+       or, using flows, the whole flow (and its protocol). */
+    if (co->flows)
+      ptbl = next_flow(co);
+    else if (daddr == INADDR_ANY)
+      co->ip.daddr = next_target();
 
     /* Calls the 'module' function and sends the packet. */
     co->ip.protocol = ptbl->protocol_id;
 
+    /* Offloads are set by the modules that can use them. */
+    if (co->offload)
+      pkt_offload = (struct packet_offload){ .segs = 1 };
+
     /* Build the packet! */
+    PROBE1(build_start, ptbl->protocol_id);
+    if (unlikely(co->latency))
+      t0 = latency_clock();
     ptbl->func(co, &size);
+    if (unlikely(co->latency))
+      t1 = latency_clock();
+    PROBE2(build_done, ptbl->protocol_id, size);
 
 #ifdef __HAVE_DEBUG__
     /* I'll use this to fine tune the alloc_packet() function, someday! */
@@ -165,46 +255,84 @@ int main(int argc, char *argv[])
               ptbl->acronym, size);
 #endif
 
+    /* Waits for the pacing clock. Time is over? */
+    if (unlikely(!pace()))
+      break;
+
     /* Try to send the packet. */
-    if (unlikely(!send_packet(packet, size, co)))
+    if (unlikely(co->latency))
+      t2 = latency_clock();
+    r = send_packet(packet, size, co);
+    if (unlikely(co->latency))
+      record_latency(ptbl, t1 - t0, latency_clock() - t2);
+
+    if (likely(r == SEND_OK))
+    {
+      PROBE2(send_ok, ptbl->protocol_id, size);
+
+      /* A GSO packet leaves as 'segs' packets, each with its own headers. */
+      uint64_t bytes = size + (pkt_offload.segs - 1) * pkt_offload.hdr_len;
+      unsigned m = module_slot(ptbl);
+
+      wstats->packets += pkt_offload.segs;
+      wstats->bytes += bytes;
+      wstats->module_packets[m] += pkt_offload.segs;
+      wstats->module_bytes[m] += bytes;
+    }
+    else if (r == SEND_DROPPED)
+      wstats->drops++;    /* The socket was full (--on-full=drop). */
+    else
+    {
+      PROBE3(send_error, ptbl->protocol_id, size, errno);
+
+      wstats->errors++;
 #ifdef __HAVE_DEBUG__
       error("Packet for protocol %s (%zu bytes long) not sent", ptbl->acronym, size);
       /* continue trying to send other packets on debug mode! */
 #else
       fatal_error("Unspecified error sending a packet");
 #endif
+    }
 
-    /* If protocol if 'T50', then get the next true protocol. */
-    if (proto == IPPROTO_T50)
-      if ((++ptbl)->func == NULL)
-        ptbl = mod_table;
+    /* If protocol if 'T50', then get the next true protocol from the mix. */
+    if (proto == IPPROTO_T50 && !co->flows)
+      ptbl = next_module();
 
     /* FIX: Just to make sure we do not decrement the threshold value if isn't necessary! */
     if (!co->flood)
       co->threshold--;
   }
 
+  /* Asynchronous sends still in flight? */
+  flush_socket();
+
   /* Show termination message only for parent process. */
   if (!IS_CHILD_PID(pid))
   {
     time_t lt;
     struct tm *tm;
 
-    if (pid > 0)
+    if (nchildren)
     {
-      if (!child_is_dead)
-      {
-        /* Wait 5 seconds for the child to end... */
-        alarm(WAIT_FOR_CHILD_TIMEOUT);
+      /* Wait 5 seconds for the children to end... */
+      alarm(WAIT_FOR_CHILD_TIMEOUT);
 #ifdef __HAVE_DEBUG__
-        fputs("\nWaiting for child process to end...\n", stderr);
-#endif        
-        if (wait(NULL) > 0)
-          child_is_dead = 1;
-        alarm(0);
-      }
+      fputs("\nWaiting for child processes to end...\n", stderr);
+#endif
+      /* NOTE: SIGALRM kills the late ones, so this loop ends. */
+      while (wait(NULL) > 0 || errno == EINTR)
+        ;
+      alarm(0);
     }
 
+    stop_stats();
+    stop_metrics();
+    stop_control();
+    stop_rx();
+    show_stats(co);
+    write_report(co);
+    stop_counters();
+
     /* Finally we close the raw socket. */
     close_socket();
 
@@ -221,6 +349,14 @@ int main(int argc, char *argv[])
            tm->tm_sec);
   }
 
+  close_flows();
+  close_replay();
+  close_targets();
+
+  /* Interrupted by Ctrl+C? */
+  if (stop_requested)
+    return 128 + SIGINT;
+
   /* Everything went well. Exit. */
   return 0;
 }
@@ -229,18 +365,24 @@ int main(int argc, char *argv[])
 /* This function handles interruptions. */
 static void signal_handler(int signal)
 {
+  unsigned i;
+
   /* NOTE: SIGALRM and SIGCHLD will happen only in parent process! */
   if (signal == SIGALRM)
   {
-    if (!IS_CHILD_PID(pid))
-      kill(pid, SIGKILL);
+    for (i = 0; i < nchildren; i++)
+      kill(children[i], SIGKILL);
     return;
   }
 
-  /* Child process terminated? */
+  /* Child process terminated? wait() takes care of it. */
   if (signal == SIGCHLD)
+    return;
+
+  /* First Ctrl+C: stop sending and show the statistics. */
+  if (signal == SIGINT && !stop_requested)
   {
-    child_is_dead = 1;
+    stop_requested = 1;
     return;
   }
 
@@ -278,21 +420,118 @@ void initialize(const struct config_options *co)
 
   /* --- Show some messages. */
   if (co->flood)
-    puts("Entering flood mode...");
+  {
+    if (co->duration > 0.0)
+      printf("Sending for %.1f seconds...\n", co->duration);
+    else
+      puts("Entering flood mode...");
+  }
   else
     printf("Sending %u packets...\n", co->threshold);
 
+  if (co->ramp)
+    printf("Rate profile: %s...\n", co->ramp);
+  else if (co->rate > 0.0)
+    printf("Rate: %.0f packets per second...\n", co->rate);
+
 #ifdef __HAVE_TURBO__
   if (co->turbo)
     puts("Turbo mode active...");
 #endif
 
-  if (co->bits)
+  if (co->iface)
+    printf("Sending through %s...\n", co->iface);
+
+  if (co->mix)
+  {
+    unsigned i, w;
+
+    fputs("Protocol mix:", stdout);
+    for (i = 0; mod_table[i].func; i++)
+      if ((w = get_mix_weight(i)) != 0)
+        printf(" %s %.1f%%", mod_table[i].acronym, 100.0 * w / get_mix_length());
+    putchar('\n');
+  }
+
+  if (co->replay)
+  {
+    printf("Replaying %u packets from '%s'", get_replay_count(), co->replay);
+    if (get_replay_skipped())
+      printf(" (%u records skipped)", get_replay_skipped());
+    puts("...");
+  }
+
+  if (co->targets)
+    printf("Using %u targets from '%s'...\n", get_number_of_targets(), co->targets);
+  else if (co->bits)
     puts("Performing stress testing...");
 
+  if (co->flows)
+  {
+    if (co->flow_sched == FLOW_SCHED_ZIPF)
+      printf("Using %u flows (Zipf, s = %.2f)...\n", co->flows, co->flow_zipf);
+    else
+      printf("Using %u flows (round robin)...\n", co->flows);
+  }
+
   puts("Hit Ctrl+C to stop...");
 }
 
+/* Number of worker processes: 'workers' (or 2, in turbo mode) per interface. */
+unsigned get_number_of_workers(const struct config_options *co, unsigned ngroups)
+{
+  unsigned n = co->workers ? co->workers : 1;
+
+#ifdef __HAVE_TURBO__
+  if (co->turbo && !co->workers)
+    n = 2;
+#endif
+
+  /* A single writer for the pcap file. */
+  if (co->backend == BACKEND_PCAP)
+    n = 1;
+
+  n *= ngroups;
+  if (n > STATS_MAX_WORKERS)
+    fatal_error("Too many workers: %u (max. %u).", n, STATS_MAX_WORKERS);
+
+  /* No point in workers without packets to send. T50 protocol
+     keeps whole cycles of the mix on each worker. */
+  if (!co->flood)
+  {
+    unsigned cycles = (unsigned)co->threshold /
+                      ((co->ip.protocol == IPPROTO_T50) ? get_mix_length() : 1);
+
+    if (cycles < n)
+      n = cycles ? cycles : 1;
+  }
+
+  return n;
+}
+
+/* Gives this worker its share of the work: the packets, the
+   destinations, the mix, the flows, the counters and the rate.
+   Workers are spread round robin on the interfaces. */
+void split_work(struct config_options *co, unsigned worker, unsigned nworkers, unsigned ngroups)
+{
+  /* The first ones get the extra packets. */
+  co->threshold = co->threshold / nworkers + (worker < co->threshold % nworkers);
+
+  split_targets(worker, nworkers);
+  if (co->ip.protocol == IPPROTO_T50)
+    split_mix(worker, nworkers);
+  if (co->flows)
+    split_flows(worker, nworkers);
+  if (co->replay)
+    split_replay(worker, nworkers);
+  split_stats(worker, nworkers);
+  split_latency(worker);
+  split_pacing(worker, nworkers);
+  split_control(worker, nworkers);
+
+  select_socket(worker % ngroups);
+}
+
 /* Auxiliary function to return the [constant] ordinary suffix string for a number. */
 const char *get_ordinal_suffix(unsigned n)
 {
@@ -333,9 +572,18 @@ modules_table_t *selectProtocol(const struct config_options *const co, int *prot
 {
   modules_table_t *ptbl;
 
+  /* Replayed packets come from the capture. */
+  if (co->replay)
+  {
+    *proto = IPPROTO_IP;
+    return get_replay_module();
+  }
+
   ptbl = mod_table;
   if ((*proto = co->ip.protocol) != IPPROTO_T50)
     ptbl += co->ip.protoname;
+  else
+    ptbl = next_module();
 
   return ptbl;
 }
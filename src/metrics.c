@@ -0,0 +1,393 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file metrics.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/un.h>
+
+/* NOTE: A scrape is one HTTP/1.0 request and one answer. No keep-alive,
+         no routes: any GET gets the metrics. */
+
+/* Requests are read up to here (only the request line matters). */
+#define METRICS_REQUEST_SIZE  2048
+
+/* Answer buffer (it grows as needed). */
+#define METRICS_BUFFER_SIZE   16384
+
+/* How often the thread checks if it must stop (ms). */
+#define METRICS_POLL_MS       200
+
+struct metrics_buffer
+{
+  char   *buf;
+  size_t len;
+  size_t size;
+};
+
+static pthread_t             metrics_thread;
+static int                   metrics_running = 0;
+static volatile sig_atomic_t metrics_stop = 0;
+static int                   metrics_fd = -1;
+static char                  metrics_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/* Pool sizes, taken at start (they don't change). */
+static uint32_t              metrics_targets;
+static unsigned              metrics_flows;
+static unsigned              metrics_mix;
+
+/* Achieved rate: counters at the last scrape. */
+static struct stats_snapshot metrics_last;
+
+static void *metrics_loop(void *);
+static void  metrics_serve(int);
+static void  metrics_print(struct metrics_buffer *, const char *, ...)
+               __attribute__((format(printf, 2, 3)));
+static void  metrics_render(struct metrics_buffer *);
+
+/**
+ * Opens the metrics endpoint and starts its thread.
+ *
+ * Used only by the parent process.
+ *
+ * @param co Pointer to T50 configuration structure (co->metrics: "PORT",
+ *           "ADDRESS:PORT" or a unix socket path, starting with '/').
+ */
+void start_metrics(const struct config_options *const __restrict__ co)
+{
+  union
+  {
+    struct sockaddr    sa;
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+  } addr;
+  socklen_t len;
+  const char *port;
+  char host[INET_ADDRSTRLEN];
+  int one = 1;
+
+  memset(&addr, 0, sizeof(addr));
+
+  if (*co->metrics == '/')
+  {
+    if (strlen(co->metrics) >= sizeof(addr.un.sun_path))
+      fatal_error("Metrics socket path '%s' is too long.", co->metrics);
+
+    addr.un.sun_family = AF_UNIX;
+    strcpy(addr.un.sun_path, co->metrics);
+    strcpy(metrics_path, co->metrics);
+    len = sizeof(addr.un);
+
+    /* A socket left behind by an earlier run. */
+    remove_stale_socket(metrics_path);
+  }
+  else
+  {
+    /* Local only, unless an address is given. */
+    addr.in.sin_family      = AF_INET;
+    addr.in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((port = strrchr(co->metrics, ':')) != NULL)
+    {
+      if ((size_t)(port - co->metrics) >= sizeof(host))
+        fatal_error("Invalid metrics address '%s'.", co->metrics);
+
+      memcpy(host, co->metrics, port - co->metrics);
+      host[port - co->metrics] = '\0';
+      port++;
+
+      if (!inet_pton(AF_INET, host, &addr.in.sin_addr))
+        fatal_error("Invalid metrics address '%s'.", co->metrics);
+    }
+    else
+      port = co->metrics;
+
+    addr.in.sin_port = htons(atoi(port));
+    if (!addr.in.sin_port || strspn(port, "0123456789") != strlen(port))
+      fatal_error("Invalid metrics port '%s'.", port);
+
+    len = sizeof(addr.in);
+  }
+
+  if ((metrics_fd = socket(addr.sa.sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+    fatal_error("Cannot create the metrics socket.");
+
+  setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  if (bind(metrics_fd, &addr.sa, len) == -1 || listen(metrics_fd, 8) == -1)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Cannot listen on '%s' for metrics: \"%s\"", co->metrics, strerror(errno));
+    #else
+    fatal_error("Cannot listen on '%s' for metrics.", co->metrics);
+    #endif
+
+  metrics_targets = get_number_of_targets();
+  metrics_flows   = co->flows;
+  metrics_mix     = get_mix_length();
+  take_stats_snapshot(&metrics_last);
+
+  if (pthread_create(&metrics_thread, NULL, metrics_loop, NULL))
+    fatal_error("Cannot create the metrics thread.");
+
+  metrics_running = 1;
+
+  if (*co->metrics == '/')
+    printf("Metrics on unix:%s.\n", metrics_path);
+  else
+    printf("Metrics on http://%s:%u/metrics.\n",
+           inet_ntop(AF_INET, &addr.in.sin_addr, host, sizeof(host)), ntohs(addr.in.sin_port));
+}
+
+/**
+ * Stops the metrics thread and closes the endpoint.
+ */
+void stop_metrics(void)
+{
+  if (metrics_running)
+  {
+    metrics_stop = 1;
+    pthread_join(metrics_thread, NULL);
+    metrics_running = 0;
+  }
+
+  if (metrics_fd != -1)
+  {
+    close(metrics_fd);
+    metrics_fd = -1;
+
+    if (*metrics_path)
+      unlink(metrics_path);
+  }
+}
+
+/* Metrics thread: answers scrapes until stop_metrics(). */
+static void *metrics_loop(void *arg)
+{
+  struct sched_param sp = { 0 };
+  struct pollfd pfd = { .fd = metrics_fd, .events = POLLIN };
+  int fd;
+
+  (void)arg;
+
+  /* NOTE: The parent is also a worker (and runs at nice -15): scrapes
+           take only CPU time nobody else wants. */
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+
+  while (!metrics_stop)
+  {
+    if (poll(&pfd, 1, METRICS_POLL_MS) <= 0)
+      continue;
+
+    if ((fd = accept4(metrics_fd, NULL, NULL, SOCK_CLOEXEC)) != -1)
+    {
+      metrics_serve(fd);
+      close(fd);
+    }
+  }
+
+  return NULL;
+}
+
+/* Reads a request and answers it. */
+static void metrics_serve(int fd)
+{
+  static const char bad[] = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n";
+  struct metrics_buffer mb = { NULL, 0, 0 };
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  char req[METRICS_REQUEST_SIZE];
+  const char *p;
+  size_t n = 0;
+  ssize_t r;
+
+  /* Up to the end of the headers (or 1 second, or a full buffer). */
+  do
+  {
+    if (poll(&pfd, 1, 1000) <= 0 || (r = recv(fd, req + n, sizeof(req) - 1 - n, 0)) <= 0)
+      return;
+    n += r;
+    req[n] = '\0';
+  } while (!strstr(req, "\r\n\r\n") && !strstr(req, "\n\n") && n < sizeof(req) - 1);
+
+  if (strncmp(req, "GET ", 4))
+  {
+    send(fd, bad, sizeof(bad) - 1, MSG_NOSIGNAL);
+    return;
+  }
+
+  metrics_render(&mb);
+  if (!mb.buf)
+    return;
+
+  n = snprintf(req, sizeof(req),
+               "HTTP/1.0 200 OK\r\n"
+               "Content-Type: text/plain; version=0.0.4\r\n"
+               "Content-Length: %zu\r\n\r\n", mb.len);
+
+  if (send(fd, req, n, MSG_NOSIGNAL | MSG_MORE) == (ssize_t)n)
+    for (p = mb.buf, n = mb.len; n > 0; p += r, n -= r)
+      if ((r = send(fd, p, n, MSG_NOSIGNAL)) <= 0)
+        break;
+
+  free(mb.buf);
+}
+
+/* Appends to the answer. If it can't grow, the buffer is gone (NULL). */
+static void metrics_print(struct metrics_buffer *mb, const char *fmt, ...)
+{
+  va_list ap;
+  size_t size;
+  char *p;
+  int n;
+
+  /* Out of memory before? */
+  if (!mb->buf && mb->size)
+    return;
+
+  for (;;)
+  {
+    if (mb->buf)
+    {
+      va_start(ap, fmt);
+      n = vsnprintf(mb->buf + mb->len, mb->size - mb->len, fmt, ap);
+      va_end(ap);
+
+      if (n < 0)
+        return;
+
+      if ((size_t)n < mb->size - mb->len)
+      {
+        mb->len += n;
+        return;
+      }
+    }
+
+    size = mb->size ? mb->size * 2 : METRICS_BUFFER_SIZE;
+    if ((p = realloc(mb->buf, size)) == NULL)
+    {
+      free(mb->buf);
+      mb->buf = NULL;
+      return;
+    }
+    mb->buf  = p;
+    mb->size = size;
+  }
+}
+
+/* The metrics, in Prometheus text format. */
+static void metrics_render(struct metrics_buffer *mb)
+{
+  static const char *rx_names[RX_CLASSES] =
+  {
+    "synack", "rst", "tcp_other", "icmp_echoreply", "icmp_unreach", "icmp_other", "udp", "other"
+  };
+  struct stats_snapshot s;
+  const struct worker_stats *w;
+  double dt, target;
+  uint32_t targets;
+  unsigned i, mix;
+
+  /* NOTE: Counters are read while the workers write them, with no locks
+           (see take_stats_snapshot()). */
+  take_stats_snapshot(&s);
+
+  dt = s.elapsed - metrics_last.elapsed;
+  target = get_target_rate(s.elapsed);
+
+  /* The destinations and the mix may have been changed (--control). */
+  targets = metrics_targets;
+  mix = metrics_mix;
+  get_control_pools(&targets, &mix);
+
+#define COUNTER(name, help) \
+  metrics_print(mb, "# HELP t50_" name " " help "\n# TYPE t50_" name " counter\n")
+#define GAUGE(name, help) \
+  metrics_print(mb, "# HELP t50_" name " " help "\n# TYPE t50_" name " gauge\n")
+#define PER_WORKER(name, field) \
+  for (i = 0; i < stats->nworkers; i++) \
+  { \
+    w = &stats->worker[i]; \
+    metrics_print(mb, "t50_" name "{worker=\"%u\"} %" PRIu64 "\n", \
+                  i, __atomic_load_n(&w->field, __ATOMIC_RELAXED)); \
+  }
+
+  GAUGE("elapsed_seconds", "Seconds since start.");
+  metrics_print(mb, "t50_elapsed_seconds %.3f\n", s.elapsed);
+  GAUGE("workers", "Sending processes.");
+  metrics_print(mb, "t50_workers %u\n", stats->nworkers);
+
+  COUNTER("packets_total", "Packets sent.");
+  PER_WORKER("packets_total", packets);
+  COUNTER("bytes_total", "Bytes sent (IP).");
+  PER_WORKER("bytes_total", bytes);
+  COUNTER("send_errors_total", "Send errors.");
+  PER_WORKER("send_errors_total", errors);
+  COUNTER("socket_full_total", "Sends that found the socket or the device queue full.");
+  PER_WORKER("socket_full_total", full);
+  COUNTER("dropped_total", "Packets dropped on a full socket (--on-full=drop).");
+  PER_WORKER("dropped_total", drops);
+  COUNTER("socket_full_seconds_total", "Time waiting or spinning on a full socket.");
+  for (i = 0; i < stats->nworkers; i++)
+    metrics_print(mb, "t50_socket_full_seconds_total{worker=\"%u\"} %.6f\n",
+                  i, __atomic_load_n(&stats->worker[i].full_ns, __ATOMIC_RELAXED) / 1e9);
+
+  COUNTER("module_packets_total", "Packets sent per module.");
+  for (i = 0; i < STATS_MAX_MODULES; i++)
+    if (s.module_packets[i])
+      metrics_print(mb, "t50_module_packets_total{module=\"%s\"} %" PRIu64 "\n",
+                    get_module_slot_name(i), s.module_packets[i]);
+  COUNTER("module_bytes_total", "Bytes sent per module (IP).");
+  for (i = 0; i < STATS_MAX_MODULES; i++)
+    if (s.module_packets[i])
+      metrics_print(mb, "t50_module_bytes_total{module=\"%s\"} %" PRIu64 "\n",
+                    get_module_slot_name(i), s.module_bytes[i]);
+
+  GAUGE("target_rate_pps", "Rate asked for (--rate, --ramp); 0 if unpaced.");
+  metrics_print(mb, "t50_target_rate_pps %.1f\n", target);
+  GAUGE("rate_pps", "Rate achieved since the previous scrape.");
+  metrics_print(mb, "t50_rate_pps %.1f\n", dt > 0.0 ? (s.packets - metrics_last.packets) / dt : 0.0);
+  GAUGE("rate_bps", "Bit rate achieved since the previous scrape (IP).");
+  metrics_print(mb, "t50_rate_bps %.1f\n", dt > 0.0 ? (s.bytes - metrics_last.bytes) * 8 / dt : 0.0);
+
+  if (s.rx_total || stats->rx_drops)
+  {
+    COUNTER("received_total", "Responses seen by the receive thread (--rx).");
+    for (i = 0; i < RX_CLASSES; i++)
+      metrics_print(mb, "t50_received_total{class=\"%s\"} %" PRIu64 "\n", rx_names[i], s.rx[i]);
+    COUNTER("receive_ring_drops_total", "Packets dropped by the receive ring.");
+    metrics_print(mb, "t50_receive_ring_drops_total %" PRIu64 "\n", stats->rx_drops);
+  }
+
+  /* Pools the packets are drawn from. */
+  GAUGE("targets", "Destination addresses (CIDR or --targets list).");
+  metrics_print(mb, "t50_targets %" PRIu32 "\n", targets);
+  GAUGE("flows", "Flow table entries (--flows).");
+  metrics_print(mb, "t50_flows %u\n", metrics_flows);
+  GAUGE("mix_length", "Schedule length of the protocol mix (--mix).");
+  metrics_print(mb, "t50_mix_length %u\n", mix);
+
+#undef COUNTER
+#undef GAUGE
+#undef PER_WORKER
+
+  metrics_last = s;
+}
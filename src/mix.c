@@ -0,0 +1,304 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file mix.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+
+/* Maximum schedule length. Mixes with a bigger (reduced) sum of weights are
+   scaled down, which keeps the ratios within 0.1%. */
+#define MIX_SCHEDULE_MAX 1024
+
+/* Precomputed schedule used on T50 mode: one table lookup per packet. */
+static modules_table_t *schedule[MIX_SCHEDULE_MAX];
+static unsigned         schedule_len = 0;
+static unsigned         schedule_pos = 0;
+static unsigned         schedule_step = 1;
+
+/* Weights per module (same index as mod_table). */
+static unsigned weights[256];
+
+static const char *parse_mix(const char *, unsigned *);
+static unsigned    weigh_mix(unsigned *);
+static unsigned    gcd(unsigned, unsigned);
+static void        mix_error(const char *, const char *) __attribute__((noreturn));
+
+/**
+ * Builds the T50 protocol schedule.
+ *
+ * The specification is a list like "tcp:70,udp:20,icmp:5,ospf:5". Weights
+ * are optional (default 1). If spec is NULL every module has the same weight,
+ * which is the same as the old round robin.
+ *
+ * The schedule is built with smooth weighted round robin, so modules are
+ * interleaved instead of sent in bursts.
+ *
+ * @param spec Mix specification (or NULL).
+ * @return Schedule length (the period, in packets, of the mix).
+ */
+unsigned config_mix(const char *spec)
+{
+  int current[256] = { 0 };
+  unsigned nmodules, i, j, total, best;
+  const char *msg;
+
+  nmodules = get_number_of_registered_modules();
+  assert(nmodules <= 256);
+
+  if ((msg = parse_mix(spec, weights)) != NULL)
+    mix_error(spec, msg);
+
+  total = weigh_mix(weights);
+
+  /* Smooth weighted round robin. */
+  for (j = 0; j < total; j++)
+  {
+    for (best = ~0U, i = 0; i < nmodules; i++)
+      if (weights[i])
+      {
+        current[i] += weights[i];
+        if (best == ~0U || current[i] > current[best])
+          best = i;
+      }
+
+    current[best] -= total;
+    schedule[j] = &mod_table[best];
+  }
+
+  schedule_len = total;
+  schedule_pos = 0;
+  schedule_step = 1;
+
+  return schedule_len;
+}
+
+/**
+ * Checks a mix specification, without changing the mix.
+ *
+ * @param spec Mix specification.
+ * @return NULL if valid, otherwise what is wrong with it.
+ */
+const char *check_mix(const char *spec)
+{
+  unsigned w[256];
+
+  return parse_mix(spec, w);
+}
+
+/**
+ * Gets the schedule length a mix specification would have, without
+ * changing the mix.
+ *
+ * @param spec Mix specification.
+ * @return Schedule length (0 if the specification is invalid).
+ */
+unsigned get_mix_spec_length(const char *spec)
+{
+  unsigned w[256];
+
+  return parse_mix(spec, w) ? 0 : weigh_mix(w);
+}
+
+/**
+ * Gets the schedule length (the period, in packets, of the mix).
+ */
+unsigned get_mix_length(void)
+{
+  return schedule_len;
+}
+
+/**
+ * Gets the weight of a module on the mix.
+ *
+ * @param idx Module index on mod_table.
+ * @return Weight (0 if the module isn't on the mix).
+ */
+unsigned get_mix_weight(unsigned idx)
+{
+  return weights[idx];
+}
+
+/**
+ * Splits the schedule between processes.
+ *
+ * Each process takes every 'nworkers'th slot, starting at 'worker', so the
+ * packets sent by all processes, together, follow the mix.
+ *
+ * @param worker Index of this process (0 .. nworkers - 1).
+ * @param nworkers Number of processes.
+ */
+void split_mix(unsigned worker, unsigned nworkers)
+{
+  assert(worker < nworkers);
+
+  schedule_pos = worker % schedule_len;
+  schedule_step = nworkers % schedule_len;
+}
+
+/**
+ * Gets the next module to use on T50 mode.
+ *
+ * @return Pointer to the modules table entry.
+ */
+modules_table_t *next_module(void)
+{
+  modules_table_t *ptbl;
+
+  ptbl = schedule[schedule_pos];
+
+  if ((schedule_pos += schedule_step) >= schedule_len)
+    schedule_pos -= schedule_len;
+
+  return ptbl;
+}
+
+/* Parses a mix specification into weights per module (NULL: all 1).
+   Returns NULL or what is wrong with it. */
+static const char *parse_mix(const char *spec, unsigned *w)
+{
+  unsigned nmodules, i;
+  const char *msg = NULL;
+  char *s, *tok, *saveptr, *p;
+
+  nmodules = get_number_of_registered_modules();
+
+  memset(w, 0, 256 * sizeof(unsigned));
+
+  if (spec == NULL)
+  {
+    for (i = 0; i < nmodules; i++)
+      w[i] = 1;
+    return NULL;
+  }
+
+  /* strtok_r() changes the string. */
+  if ((s = strdup(spec)) == NULL)
+    fatal_error("Cannot allocate memory to parse the protocol mix.");
+
+  for (tok = strtok_r(s, ",", &saveptr); tok && !msg; tok = strtok_r(NULL, ",", &saveptr))
+  {
+    unsigned long n = 1;
+
+    if ((p = strchr(tok, ':')) != NULL)
+    {
+      *p++ = '\0';
+
+      errno = 0;
+      n = strtoul(p, &p, 10);
+      if (errno || *p || !n || n > UINT16_MAX)
+      {
+        msg = "weights must be between 1 and 65535";
+        break;
+      }
+    }
+
+    /* NOTE: it doesn't matter if protocol names are upper
+             or lower case. */
+    for (i = 0; i < nmodules; i++)
+      if (!strcasecmp(mod_table[i].acronym, tok))
+        break;
+
+    if (i == nmodules)
+      msg = "unknown protocol";
+    else if (w[i])
+      msg = "protocol given twice";
+    else
+      w[i] = n;
+  }
+
+  free(s);
+
+  if (!msg)
+  {
+    for (i = 0; i < nmodules && !w[i]; i++)
+      ;
+    if (i == nmodules)
+      msg = "no protocols";
+  }
+
+  return msg;
+}
+
+/* Euclid's algorithm. gcd(0, n) is n. */
+/* Reduces the weights to the smallest equivalent ones, scaled down to
+   fit the schedule. Returns the schedule length (their sum). */
+static unsigned weigh_mix(unsigned *w)
+{
+  unsigned nmodules, i, total, g, best;
+
+  nmodules = get_number_of_registered_modules();
+
+  for (g = i = 0; i < nmodules; i++)
+    g = gcd(g, w[i]);
+
+  for (total = i = 0; i < nmodules; i++)
+  {
+    w[i] /= g;
+    total += w[i];
+  }
+
+  /* Too long? Scale down, keeping every protocol on the mix. */
+  if (total > MIX_SCHEDULE_MAX)
+  {
+    unsigned scaled = 0;
+
+    for (i = 0; i < nmodules; i++)
+      if (w[i])
+      {
+        w[i] = ((uint64_t)w[i] * MIX_SCHEDULE_MAX + total / 2) / total;
+        if (!w[i])
+          w[i] = 1;
+        scaled += w[i];
+      }
+
+    /* Rounding may overflow the schedule. Take it from the heaviest ones. */
+    while (scaled > MIX_SCHEDULE_MAX)
+    {
+      for (best = 0, i = 1; i < nmodules; i++)
+        if (w[i] > w[best])
+          best = i;
+
+      w[best]--;
+      scaled--;
+    }
+
+    total = scaled;
+  }
+
+  return total;
+}
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+  unsigned t;
+
+  while (b)
+  {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+static void mix_error(const char *spec, const char *msg)
+{
+  fatal_error("Invalid protocol mix '%s': %s.", spec, msg);
+}
@@ -160,6 +160,7 @@ void dccp(const struct config_options *const __restrict__ co, size_t *size)
    *       |     |       |0|                                               |
    *       +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
    */
+  dccp->dccph_reserved = FIELD_MUST_BE_ZERO;
   dccp->dccph_x        = (co->dccp.ext != 0);
   dccp->dccph_seq      = htons(__RND(co->dccp.sequence_01));
   dccp->dccph_seq2     = co->dccp.ext ? 0 : __RND(co->dccp.sequence_02);
@@ -228,6 +229,7 @@ void dccp(const struct config_options *const __restrict__ co, size_t *size)
       dccp_rst->dccph_reset_ack.dccph_ack_nr_high = htons(__RND(co->dccp.acknowledge_01));
       dccp_rst->dccph_reset_ack.dccph_ack_nr_low  = htonl(__RND(co->dccp.acknowledge_02));
       dccp_rst->dccph_reset_code                  = __RND(co->dccp.rst_code);
+      memset(dccp_rst->dccph_reset_data, 0, sizeof(dccp_rst->dccph_reset_data));
 
       buffer_ptr = dccp_rst + 1;
       break;
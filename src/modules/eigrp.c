@@ -283,6 +283,7 @@ void eigrp(const struct config_options *const __restrict__ co, size_t *size)
                            FIELD_MUST_BE_ZERO : htons(0x0004);
       *buffer.byte_ptr++ = prefix;
       *buffer.inaddr_ptr++ = EIGRP_DADDR_BUILD(dest, prefix);  // Is this correct?
+      memset(buffer.ptr, 0, EIGRP_DADDR_LENGTH(prefix));        /* FIX: Not left as is. */
       buffer.ptr += EIGRP_DADDR_LENGTH(prefix);
     }
 
@@ -410,6 +411,11 @@ void eigrp(const struct config_options *const __restrict__ co, size_t *size)
     }
   }
 
+  /* FIX: The room left by the workaround above (and by shorter TLVs) is
+          zeroed: the buffer holds the last packet. */
+  if (buffer.ptr < (void *)((unsigned char *)packet + *size))
+    memset(buffer.ptr, 0, (unsigned char *)packet + *size - buffer.byte_ptr);
+
   /* Computing the checksum. */
   eigrp->check    = co->bogus_csum ?
                     RANDOM() : cksum(eigrp, buffer.ptr - (void *)eigrp);
@@ -133,7 +133,9 @@ struct iphdr *gre_encapsulation(void *buffer,
   gre_ip->saddr    = co->gre.saddr ? co->gre.saddr : ip->saddr;
   gre_ip->daddr    = co->gre.daddr ? co->gre.daddr : ip->daddr;
 
-  /* Computing the checksum. */
+  /* Computing the checksum.
+     FIX: The field must be zero first: the buffer holds the last packet. */
+  gre_ip->check    = 0;
   gre_ip->check    = co->bogus_csum ? RANDOM() :
                      cksum(gre_ip, sizeof(struct iphdr));
 
@@ -61,14 +61,14 @@ struct iphdr *ip_header(void *buffer,
   ip->id       = htons(__RND(co->ip.id));
   ip->ttl      = co->ip.ttl;
   ip->protocol = co->encapsulated ? IPPROTO_GRE : co->ip.protocol;
-  ip->saddr    = htonl(INADDR_RND(co->ip.saddr));
+  ip->saddr    = INADDR_RND(co->ip.saddr);  /* FIX: resolv() gives it in network order. */
   ip->daddr    = co->ip.daddr;    // FIXME: Is this already BIG ENDIAN?
   ip->check    = 0;               // NOTE: it will be calculated by the kernel!
 
-  // FIXME: In case this code will be ported to other OSses,
-  //        we should calculate the checksum ourselves AFTER
-  //        the entire package is ready.
-  //        This can be done in main()'s main loop, before calling send_packet().
+  /* ...except with Ethernet framing: the kernel won't touch the packet.
+     NOTE: The header is complete, so it's safe to calculate it here. */
+  if (co->backend == BACKEND_PACKET)
+    ip->check  = cksum(ip, sizeof(struct iphdr));
 
   return ip;
 }
@@ -99,6 +99,7 @@ void ipsec(const struct config_options *const __restrict__ co, size_t *size)
                      (sizeof(struct ip_auth_hdr) / 4) + 1;   /* FIX: The previous line was:
                                                  (sizeof(struct ip_auth_hdr) / 4) + (ip_ah_icv / ip_ah_icv); */
 
+  ip_auth->reserved = FIELD_MUST_BE_ZERO;
   ip_auth->spi     = htonl(__RND(co->ipsec.ah_spi));
   ip_auth->seq_no  = htonl(__RND(co->ipsec.ah_sequence));
 
@@ -302,7 +302,7 @@ void ospf(const struct config_options *const __restrict__ co, size_t *size)
         /* Computing the checksum. */
         ospf_lsa->check      =  co->bogus_csum ?
                                 RANDOM() :
-                                cksum(ospf_lsa, OSPF_TLEN_LSUPDATE + LSA_TLEN_ROUTER);
+                                cksum(ospf_lsa, LSA_TLEN_ROUTER);
       }
       else
         if (co->ospf.lsa_type == LSA_TYPE_NETWORK)
@@ -330,7 +330,7 @@ void ospf(const struct config_options *const __restrict__ co, size_t *size)
           /* Computing the checksum. */
           ospf_lsa->check      =  co->bogus_csum  ?
                                   RANDOM() :
-                                  cksum(ospf_lsa, OSPF_TLEN_LSUPDATE + LSA_TLEN_NETWORK);
+                                  cksum(ospf_lsa, LSA_TLEN_NETWORK);
         }
         else
           if (co->ospf.lsa_type == LSA_TYPE_SUMMARY_IP ||
@@ -361,7 +361,7 @@ void ospf(const struct config_options *const __restrict__ co, size_t *size)
             /* Computing the checksum. */
             ospf_lsa->check =  co->bogus_csum ?
                                RANDOM() :
-                               cksum(ospf_lsa, OSPF_TLEN_LSUPDATE + LSA_TLEN_SUMMARY);
+                               cksum(ospf_lsa, LSA_TLEN_SUMMARY);
           }
           else
             if (co->ospf.lsa_type == LSA_TYPE_ASBR ||
@@ -402,7 +402,7 @@ void ospf(const struct config_options *const __restrict__ co, size_t *size)
               /* Computing the checksum. */
               ospf_lsa->check      =  co->bogus_csum ?
                                       RANDOM() :
-                                      cksum(ospf_lsa, OSPF_TLEN_LSUPDATE + LSA_TLEN_ASBR);
+                                      cksum(ospf_lsa, LSA_TLEN_ASBR);
             }
             else
               if (co->ospf.lsa_type == LSA_TYPE_MULTICAST)
@@ -430,7 +430,7 @@ void ospf(const struct config_options *const __restrict__ co, size_t *size)
                 /* Computing the checksum. */
                 ospf_lsa->check      =  co->bogus_csum ?
                                         RANDOM() :
-                                        cksum(ospf_lsa, OSPF_TLEN_LSUPDATE + LSA_TLEN_MULTICAST);
+                                        cksum(ospf_lsa, LSA_TLEN_MULTICAST);
                 /* Building a generic OSPF LSA Header. */
               }
               else
@@ -443,7 +443,7 @@ void ospf(const struct config_options *const __restrict__ co, size_t *size)
                 /* Computing the checksum. */
                 ospf_lsa->check      =  co->bogus_csum ?
                                         RANDOM() :
-                                        cksum(ospf_lsa, OSPF_TLEN_LSUPDATE + LSA_TLEN_GENERIC(0));
+                                        cksum(ospf_lsa, LSA_TLEN_GENERIC(0));
               }
 
       break;
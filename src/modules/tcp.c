@@ -41,6 +41,7 @@ void tcp(const struct config_options *const __restrict__ co, size_t *size)
          tcpolen,     /* TCP options size. */
          tcpopt,      /* TCP options total size. */
          length,
+         payload,     /* payload size. */
          counter;
 
   memptr_t buffer;
@@ -59,15 +60,22 @@ void tcp(const struct config_options *const __restrict__ co, size_t *size)
   greoptlen = gre_opt_len(co);
   tcpolen = tcp_options_len(co->tcp.options, co->tcp.md5, co->tcp.auth);
   tcpopt = tcpolen + TCPOLEN_PADDING(tcpolen);
+  payload = L4_PAYLOAD(co);
 
   *size = sizeof(struct iphdr)  +
           sizeof(struct tcphdr) +
-          sizeof(struct psdhdr) +
           tcpopt                +
+          payload               +
           greoptlen;
 
-  /* Try to reallocate packet, if necessary */
-  alloc_packet(*size);
+  /* Try to reallocate packet, if necessary.
+     NOTE: Room for the pseudo header (and a pad byte) after the packet. */
+  alloc_packet(*size + sizeof(struct psdhdr) + 1);
+
+  /* NOTE: Without payload, the pseudo header is sent as well, as it
+           always was. With payload, packets have their exact size. */
+  if (!payload)
+    *size += sizeof(struct psdhdr);
 
   /* IP Header structure making a pointer to Packet. */
   ip = ip_header(packet, *size, co);
@@ -75,7 +83,8 @@ void tcp(const struct config_options *const __restrict__ co, size_t *size)
   gre_ip = gre_encapsulation(packet, co,
                              sizeof(struct iphdr)  +
                              sizeof(struct tcphdr) +
-                             tcpopt);
+                             tcpopt                +
+                             payload);
 
   /*
    * The RFC 793 has defined a 4-bit field in the TCP header which encodes the size
@@ -95,7 +104,7 @@ void tcp(const struct config_options *const __restrict__ co, size_t *size)
   tcp->doff    = co->tcp.doff ? co->tcp.doff : ((sizeof(struct tcphdr) + tcpopt) / 4);
   tcp->fin     = (co->tcp.fin != 0);
   tcp->syn     = (co->tcp.syn != 0);
-  tcp->seq     = co->tcp.syn ? htonl(__RND(co->tcp.sequence)) : 0;
+  tcp->seq     = (co->tcp.syn || payload) ? htonl(__RND(co->tcp.sequence)) : 0;
   tcp->rst     = (co->tcp.rst != 0);
   tcp->psh     = (co->tcp.psh != 0);
   tcp->ack     = (co->tcp.ack != 0);
@@ -430,7 +439,11 @@ void tcp(const struct config_options *const __restrict__ co, size_t *size)
     *buffer.byte_ptr++ = co->tcp.nop;
 
   /* Needed here 'cause we'll need to initialize pseudo->len. */
-  length = sizeof(struct tcphdr) + tcpolen;
+  length = sizeof(struct tcphdr) + tcpolen + payload;
+
+  /* Payload (zeroes). The pseudo header must start on an even offset. */
+  memset(buffer.ptr, 0, payload + (length & 1));
+  buffer.byte_ptr += payload + (length & 1);
 
   /* Fill PSEUDO Header structure. */
   pseudo           = buffer.ptr;
@@ -450,10 +463,17 @@ void tcp(const struct config_options *const __restrict__ co, size_t *size)
   pseudo->protocol = co->ip.protocol;
   pseudo->len      = htons(length);
 
-  length += sizeof(struct psdhdr);
-
-  /* Computing the checksum. */
-  tcp->check   = co->bogus_csum ? RANDOM() : cksum(tcp, length);
+  /* Computing the checksum (or leaving it to the kernel). */
+  if (payload && L4_OFFLOAD(co))
+  {
+    tcp->check = ~cksum(pseudo, sizeof(struct psdhdr));
+    set_offload(co, tcp, sizeof(struct tcphdr) + tcpolen, offsetof(struct tcphdr, check));
+  }
+  else
+  {
+    length += (length & 1) + sizeof(struct psdhdr);
+    tcp->check   = co->bogus_csum ? RANDOM() : cksum(tcp, length);
+  }
 
   gre_checksum(packet, co, *size);
 }
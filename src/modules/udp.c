@@ -32,7 +32,9 @@
  */
 void udp(const struct config_options *const __restrict__ co, size_t *size)
 {
-  size_t greoptlen;   /* GRE options size. */
+  size_t greoptlen,   /* GRE options size. */
+         payload,     /* payload size. */
+         length;
 
   struct iphdr *ip;
   struct iphdr *gre_ip;
@@ -42,30 +44,43 @@ void udp(const struct config_options *const __restrict__ co, size_t *size)
   assert(co != NULL);
 
   greoptlen = gre_opt_len(co);
+  payload = L4_PAYLOAD(co);
   *size = sizeof(struct iphdr)  +
           sizeof(struct udphdr) +
-          sizeof(struct psdhdr) +
+          payload               +
           greoptlen;
 
-  /* Try to reallocate packet, if necessary */
-  alloc_packet(*size);
+  /* Try to reallocate packet, if necessary.
+     NOTE: Room for the pseudo header (and a pad byte) after the packet. */
+  alloc_packet(*size + sizeof(struct psdhdr) + 1);
+
+  /* NOTE: Without payload, the pseudo header is sent as well, as it
+           always was. With payload, packets have their exact size. */
+  if (!payload)
+    *size += sizeof(struct psdhdr);
 
   /* Fill IP header. */
   ip = ip_header(packet, *size, co);
 
   gre_ip = gre_encapsulation(packet, co,
                              sizeof(struct iphdr) +
-                             sizeof(struct udphdr));
+                             sizeof(struct udphdr) +
+                             payload);
 
   /* UDP Header structure making a pointer to  IP Header structure. */
   udp         = (struct udphdr *)((unsigned char *)(ip + 1) + greoptlen);
   udp->source = htons(IPPORT_RND(co->source));
   udp->dest   = htons(IPPORT_RND(co->dest));
-  udp->len    = htons(sizeof(struct udphdr));
+  udp->len    = htons(sizeof(struct udphdr) + payload);
   udp->check  = 0;    /* needed 'cause of cksum(), below! */
 
+  /* Payload (zeroes). The pseudo header must start on an even offset. */
+  length = sizeof(struct udphdr) + payload;
+  memset(udp + 1, 0, payload + (length & 1));
+  length += length & 1;
+
   /* Fill PSEUDO Header structure. */
-  pseudo      = (struct psdhdr *)(udp + 1);
+  pseudo      = (struct psdhdr *)((unsigned char *)udp + length);
 
   if (co->encapsulated)
   {
@@ -80,11 +95,17 @@ void udp(const struct config_options *const __restrict__ co, size_t *size)
 
   pseudo->zero     = 0;
   pseudo->protocol = co->ip.protocol;
-  pseudo->len      = htons(sizeof(struct udphdr));
+  pseudo->len      = udp->len;
 
-  /* Computing the checksum. */
-  udp->check  = co->bogus_csum ? RANDOM() :
-                cksum(udp, (void *)(pseudo + 1) - (void *)udp);
+  /* Computing the checksum (or leaving it to the kernel). */
+  if (payload && L4_OFFLOAD(co))
+  {
+    udp->check = ~cksum(pseudo, sizeof(struct psdhdr));
+    set_offload(co, udp, sizeof(struct udphdr), offsetof(struct udphdr, check));
+  }
+  else
+    udp->check  = co->bogus_csum ? RANDOM() :
+                  cksum(udp, (void *)(pseudo + 1) - (void *)udp);
 
   gre_checksum(packet, co, *size);
 }
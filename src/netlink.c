@@ -0,0 +1,325 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file netlink.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+
+/* NOTE: No libmnl. A dump request and its replies are simple enough. */
+
+/* Reply buffer: big enough for any batch of a dump reply. */
+#define NL_BUFFER_SIZE  32768
+
+struct qdisc_kind
+{
+  int    ifindex;
+  char   *kind;
+  size_t size;
+};
+
+/* A qdisc of a given kind, anywhere on the interface. */
+struct qdisc_match
+{
+  int        ifindex;
+  const char *kind;
+  int        found;
+  int        clockid;   /* etf only. */
+};
+
+static int find_root_qdisc(const struct nlmsghdr *, void *);
+static int find_qdisc(const struct nlmsghdr *, void *);
+static void get_route(in_addr_t, int *, in_addr_t *);
+
+/**
+ * Dumps a rtnetlink table (links, qdiscs, ...).
+ *
+ * The callback is called for each object on the reply, until it
+ * returns FALSE or the dump is over.
+ *
+ * @param type Request (RTM_GETLINK, RTM_GETQDISC, ...).
+ * @param hdrlen Length of the request's family header (struct ifinfomsg,
+ *               struct tcmsg, ...), sent zeroed (everything).
+ * @param cb Callback.
+ * @param arg Callback argument.
+ * @return TRUE (success) or FALSE (netlink error).
+ */
+int rtnl_dump(uint16_t type,
+              size_t hdrlen,
+              int (*cb)(const struct nlmsghdr *, void *),
+              void *arg)
+{
+  struct
+  {
+    struct nlmsghdr nlh;
+    uint8_t         hdr[32];    /* the largest rtnetlink family header. */
+  } req;
+  struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+  struct nlmsghdr *nlh;
+  char *buf;
+  ssize_t n;
+  int s, done = FALSE, ok = FALSE;
+
+  assert(hdrlen <= sizeof(req.hdr));
+
+  if ((s = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) == -1)
+    return FALSE;
+
+  if ((buf = malloc(NL_BUFFER_SIZE)) == NULL)
+  {
+    close(s);
+    return FALSE;
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.nlh.nlmsg_len   = NLMSG_LENGTH(hdrlen);
+  req.nlh.nlmsg_type  = type;
+  req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nlh.nlmsg_seq   = 1;
+
+  if (sendto(s, &req, req.nlh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) == -1)
+    goto out;
+
+  while (!done)
+  {
+    do {
+      n = recv(s, buf, NL_BUFFER_SIZE, 0);
+    } while (n == -1 && errno == EINTR);
+
+    if (n <= 0)
+      goto out;
+
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)n); nlh = NLMSG_NEXT(nlh, n))
+    {
+      if (nlh->nlmsg_type == NLMSG_DONE)
+      {
+        done = ok = TRUE;
+        break;
+      }
+
+      if (nlh->nlmsg_type == NLMSG_ERROR)
+        goto out;
+
+      /* NOTE: Replies are RTM_NEW*, two below the RTM_GET* requests.
+               Once the caller has found what it wanted, the rest of
+               the dump is just drained. */
+      if (nlh->nlmsg_type == type - 2 && cb && !cb(nlh, arg))
+        cb = NULL;
+    }
+  }
+
+out:
+  free(buf);
+  close(s);
+
+  return ok;
+}
+
+/**
+ * Gets an attribute from a rtnetlink object.
+ *
+ * @param nlh The object.
+ * @param hdrlen Length of its family header.
+ * @param type Attribute type.
+ * @return The attribute or NULL (not found).
+ */
+const struct rtattr *rtnl_attr(const struct nlmsghdr *nlh, size_t hdrlen, unsigned type)
+{
+  const struct rtattr *rta;
+  int len;
+
+  rta = (const struct rtattr *)((const char *)NLMSG_DATA(nlh) + NLMSG_ALIGN(hdrlen));
+  len = nlh->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(hdrlen));
+
+  for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    if (rta->rta_type == type)
+      return rta;
+
+  return NULL;
+}
+
+/**
+ * Gets the name of the root qdisc of an interface.
+ *
+ * @param ifindex Interface index.
+ * @param kind Buffer for the name (ex: "pfifo_fast", "fq", "noqueue").
+ * @param size Buffer size.
+ * @return TRUE (found) or FALSE.
+ */
+int get_qdisc_kind(int ifindex, char *kind, size_t size)
+{
+  struct qdisc_kind q = { ifindex, kind, size };
+
+  *kind = '\0';
+
+  return rtnl_dump(RTM_GETQDISC, sizeof(struct tcmsg), find_root_qdisc, &q) && *kind;
+}
+
+/* rtnl_dump() callback: the root qdisc of q->ifindex. */
+static int find_root_qdisc(const struct nlmsghdr *nlh, void *arg)
+{
+  struct qdisc_kind *q = arg;
+  const struct tcmsg *tcm = NLMSG_DATA(nlh);
+  const struct rtattr *rta;
+
+  if (tcm->tcm_ifindex != q->ifindex || tcm->tcm_parent != TC_H_ROOT ||
+      (rta = rtnl_attr(nlh, sizeof(*tcm), TCA_KIND)) == NULL)
+    return TRUE;
+
+  snprintf(q->kind, q->size, "%.*s", (int)RTA_PAYLOAD(rta), (const char *)RTA_DATA(rta));
+
+  return FALSE;
+}
+
+/**
+ * Looks for a qdisc of a given kind on an interface (root or not).
+ *
+ * @param ifindex Interface index.
+ * @param kind Qdisc kind (ex: "fq").
+ * @return TRUE (found) or FALSE.
+ */
+int has_qdisc(int ifindex, const char *kind)
+{
+  struct qdisc_match m = { ifindex, kind, FALSE, -1 };
+
+  return rtnl_dump(RTM_GETQDISC, sizeof(struct tcmsg), find_qdisc, &m) && m.found;
+}
+
+/**
+ * Gets the clock of the etf qdisc of an interface (usually a child of
+ * mqprio, one per TX queue).
+ *
+ * @param ifindex Interface index.
+ * @return Clock id (ex: CLOCK_TAI) or -1 (no etf qdisc).
+ */
+int get_etf_clockid(int ifindex)
+{
+  struct qdisc_match m = { ifindex, "etf", FALSE, -1 };
+
+  return (rtnl_dump(RTM_GETQDISC, sizeof(struct tcmsg), find_qdisc, &m) && m.found) ?
+           m.clockid : -1;
+}
+
+/**
+ * Gets the output interface of the route to an address.
+ *
+ * @param daddr IPv4 address (network order).
+ * @return Interface index or 0 (no route).
+ */
+int get_route_iface(in_addr_t daddr)
+{
+  int ifindex = 0;
+
+  get_route(daddr, &ifindex, NULL);
+  return ifindex;
+}
+
+/**
+ * Gets the source address of the route to an address: the address of
+ * ours the kernel would send from.
+ *
+ * @param daddr IPv4 address (network order).
+ * @return IPv4 address (network order) or INADDR_ANY (no route).
+ */
+in_addr_t get_route_source(in_addr_t daddr)
+{
+  in_addr_t saddr = INADDR_ANY;
+
+  get_route(daddr, NULL, &saddr);
+  return saddr;
+}
+
+/* Asks the kernel for the route to 'daddr': its output interface and
+   its source address (either may be NULL). */
+static void get_route(in_addr_t daddr, int *ifindex, in_addr_t *saddr)
+{
+  struct
+  {
+    struct nlmsghdr nlh;
+    struct rtmsg    rtm;
+    char            attrs[64];
+  } req;
+  struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+  const struct rtattr *attr;
+  struct rtattr *rta;
+  struct nlmsghdr *nlh;
+  char buf[4096];
+  ssize_t n;
+  int s;
+
+  if ((s = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) == -1)
+    return;
+
+  memset(&req, 0, sizeof(req));
+  req.nlh.nlmsg_len     = NLMSG_LENGTH(sizeof(struct rtmsg));
+  req.nlh.nlmsg_type    = RTM_GETROUTE;
+  req.nlh.nlmsg_flags   = NLM_F_REQUEST;
+  req.nlh.nlmsg_seq     = 1;
+  req.rtm.rtm_family    = AF_INET;
+  req.rtm.rtm_dst_len   = 32;
+
+  rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nlh.nlmsg_len));
+  rta->rta_type = RTA_DST;
+  rta->rta_len  = RTA_LENGTH(sizeof(daddr));
+  memcpy(RTA_DATA(rta), &daddr, sizeof(daddr));
+  req.nlh.nlmsg_len = NLMSG_ALIGN(req.nlh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+  /* The answer is the route (or an error: no route). */
+  if (sendto(s, &req, req.nlh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) != -1 &&
+      (n = recv(s, buf, sizeof(buf), 0)) > 0)
+  {
+    nlh = (struct nlmsghdr *)buf;
+    if (NLMSG_OK(nlh, (size_t)n) && nlh->nlmsg_type == RTM_NEWROUTE)
+    {
+      if (ifindex && (attr = rtnl_attr(nlh, sizeof(struct rtmsg), RTA_OIF)) != NULL)
+        memcpy(ifindex, RTA_DATA(attr), sizeof(*ifindex));
+      if (saddr && (attr = rtnl_attr(nlh, sizeof(struct rtmsg), RTA_PREFSRC)) != NULL)
+        memcpy(saddr, RTA_DATA(attr), sizeof(*saddr));
+    }
+  }
+
+  close(s);
+}
+
+/* rtnl_dump() callback: a qdisc of m->kind on m->ifindex. */
+static int find_qdisc(const struct nlmsghdr *nlh, void *arg)
+{
+  struct qdisc_match *m = arg;
+  const struct tcmsg *tcm = NLMSG_DATA(nlh);
+  const struct rtattr *rta, *opt;
+  int len;
+
+  if (tcm->tcm_ifindex != m->ifindex ||
+      (rta = rtnl_attr(nlh, sizeof(*tcm), TCA_KIND)) == NULL ||
+      strncmp(RTA_DATA(rta), m->kind, RTA_PAYLOAD(rta)))
+    return TRUE;
+
+  m->found = TRUE;
+
+  /* etf: the clock is on its parameters (nested on TCA_OPTIONS). */
+  if ((rta = rtnl_attr(nlh, sizeof(*tcm), TCA_OPTIONS)) != NULL)
+    for (opt = RTA_DATA(rta), len = RTA_PAYLOAD(rta); RTA_OK(opt, len); opt = RTA_NEXT(opt, len))
+      if (!strcmp(m->kind, "etf") && opt->rta_type == TCA_ETF_PARMS &&
+          RTA_PAYLOAD(opt) >= sizeof(struct tc_etf_qopt))
+        m->clockid = ((const struct tc_etf_qopt *)RTA_DATA(opt))->clockid;
+
+  return FALSE;
+}
@@ -0,0 +1,483 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file pacing.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <math.h>
+
+/* Gaps longer than this are slept (nanosleep); shorter ones are spun. */
+#define PACING_SPIN_NS     200000ULL
+
+/* Longest nap: the rate may change meanwhile (ramps). */
+#define PACING_MAX_NAP_NS  10000000ULL
+
+/* A worker which falls behind doesn't burst more than this to catch up. */
+#define PACING_MAX_LAG     0.01
+
+/* Kernel pacing (--txtime): how far ahead of its transmit time a packet
+   may be handed to the qdisc. */
+#define PACING_TXTIME_AHEAD_NS  1000000ULL
+
+/* Without pacing, the clock is read only once every this many packets. */
+#define PACING_CHECK_MASK  255
+
+/* Rate profile. */
+enum
+{
+  PROFILE_NONE = 0,     /* unpaced.                              */
+  PROFILE_CONSTANT,     /* --rate.                               */
+  PROFILE_LINEAR,       /* from 'r0' to 'r1' in 'length' seconds. */
+  PROFILE_STEP,         /* 'r0', 'r0 + inc', ... 'r1', each 'dwell' seconds. */
+  PROFILE_SINE          /* between 'r0' and 'r1', period 'length'. */
+};
+
+static struct
+{
+  int      profile;
+  double   r0, r1;      /* rates (pps, all workers).             */
+  double   inc;         /* step increment.                       */
+  double   dwell;       /* step duration (seconds).              */
+  double   length;      /* ramp length or sine period (seconds). */
+  double   step_len;    /* steps for logging (linear and sine).  */
+
+  uint64_t start;       /* ns, CLOCK_MONOTONIC.                  */
+  uint64_t end;         /* ns (0 if there is no duration).       */
+  unsigned nworkers;
+
+  /* Per worker state. */
+  uint64_t last;        /* last time credit was added (ns).      */
+  double   credit;      /* packets this worker may send now.     */
+  unsigned count;
+
+  /* Kernel pacing (--txtime). */
+  int      txtime;
+  uint64_t next;        /* transmit time of the next packet (ns). */
+  uint64_t tx;          /* transmit time of the current packet.   */
+} pc;
+
+static uint64_t pacing_clock(void);
+static int      pace_txtime(void);
+static double   profile_rate(double);
+static void     pacing_error(const char *, const char *) __attribute__((noreturn));
+
+/**
+ * Parses a rate: number of packets per second, with an optional
+ * 'k', 'M' or 'G' suffix (ex: 10k, 2.5M).
+ *
+ * @param s String to parse.
+ * @return Rate (pps) or -1.0 if invalid.
+ */
+double parse_rate(const char *s)
+{
+  char *p;
+  double r;
+
+  errno = 0;
+  r = strtod(s, &p);
+  if (errno || p == s || r < 0.0)
+    return -1.0;
+
+  switch (*p)
+  {
+  case 'k': case 'K': r *= 1e3; p++; break;
+  case 'm': case 'M': r *= 1e6; p++; break;
+  case 'g': case 'G': r *= 1e9; p++; break;
+  }
+
+  return *p ? -1.0 : r;
+}
+
+/**
+ * Parses a time: seconds, with an optional 'ms', 's', 'm' or 'h'
+ * suffix (ex: 500ms, 60s, 5m).
+ *
+ * @param s String to parse.
+ * @return Time (seconds) or -1.0 if invalid.
+ */
+double parse_time(const char *s)
+{
+  char *p;
+  double t;
+
+  errno = 0;
+  t = strtod(s, &p);
+  if (errno || p == s || t < 0.0)
+    return -1.0;
+
+  if (!strcmp(p, "ms"))
+    return t / 1e3;
+  if (!*p || !strcmp(p, "s"))
+    return t;
+  if (!strcmp(p, "m"))
+    return t * 60.0;
+  if (!strcmp(p, "h"))
+    return t * 3600.0;
+
+  return -1.0;
+}
+
+/**
+ * Sets up the pacing profile.
+ *
+ * The ramp specification is one of:
+ *
+ *   linear:FROM:TO:TIME       from FROM to TO pps in TIME, then TO.
+ *   step:FROM:TO:INC:DWELL    FROM, FROM+INC, ... TO, each for DWELL.
+ *   sine:MIN:MAX:PERIOD       sine wave between MIN and MAX, starting at MIN.
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @return Length of the ramp in seconds (0 if there is no natural end).
+ */
+double config_pacing(const struct config_options *const __restrict__ co)
+{
+  char *s, *f[7], *saveptr;
+  unsigned n;
+
+  memset(&pc, 0, sizeof(pc));
+  pc.nworkers = 1;
+  pc.txtime = co->txtime;
+  pc.step_len = co->stats_interval ? co->stats_interval : 1.0;
+
+  if (!co->ramp)
+  {
+    if (co->rate > 0.0)
+    {
+      pc.profile = PROFILE_CONSTANT;
+      pc.r0 = pc.r1 = co->rate;
+    }
+    return 0.0;
+  }
+
+  /* strtok_r() changes the string. */
+  if ((s = strdup(co->ramp)) == NULL)
+    fatal_error("Cannot allocate memory to parse the ramp.");
+
+  for (n = 0, f[0] = strtok_r(s, ":", &saveptr); f[n] && n < 6; f[++n] = strtok_r(NULL, ":", &saveptr))
+    ;
+
+  if (n == 4 && !strcasecmp(f[0], "linear"))
+  {
+    pc.profile = PROFILE_LINEAR;
+    pc.length = parse_time(f[3]);
+  }
+  else if (n == 5 && !strcasecmp(f[0], "step"))
+  {
+    pc.profile = PROFILE_STEP;
+    if ((pc.inc = parse_rate(f[3])) <= 0.0)
+      pacing_error(co->ramp, "invalid increment");
+    pc.dwell = pc.step_len = parse_time(f[4]);
+  }
+  else if (n == 4 && !strcasecmp(f[0], "sine"))
+  {
+    pc.profile = PROFILE_SINE;
+    pc.length = parse_time(f[3]);
+  }
+  else
+    pacing_error(co->ramp, "unknown profile or wrong number of fields");
+
+  pc.r0 = parse_rate(f[1]);
+  pc.r1 = parse_rate(f[2]);
+
+  free(s);
+
+  if (pc.r0 < 0.0 || pc.r1 < 0.0)
+    pacing_error(co->ramp, "invalid rate");
+
+  if (pc.length < 0.0 || pc.dwell < 0.0 ||
+      (pc.profile != PROFILE_STEP && pc.length == 0.0) ||
+      (pc.profile == PROFILE_STEP && pc.dwell == 0.0))
+    pacing_error(co->ramp, "invalid time");
+
+  switch (pc.profile)
+  {
+  case PROFILE_LINEAR:
+    return pc.length;
+
+  case PROFILE_STEP:
+    /* Steps go down if TO is smaller than FROM. */
+    if (pc.r1 < pc.r0)
+      pc.inc = -pc.inc;
+    pc.length = (floor((pc.r1 - pc.r0) / pc.inc + 1e-9) + 1) * pc.dwell;
+    return pc.length;
+  }
+
+  return 0.0;
+}
+
+/**
+ * Starts the pacing clock. Must be called after config_stats() and
+ * before fork(): every worker and the statistics share the same
+ * time base.
+ *
+ * @param duration Run duration in seconds (0 means no limit).
+ */
+void start_pacing(double duration)
+{
+  pc.start = stats->start.tv_sec * 1000000000ULL + stats->start.tv_nsec;
+  pc.end = duration > 0.0 ? pc.start + (uint64_t)(duration * 1e9) : 0;
+  pc.last = pc.start;
+  pc.credit = 1.0;      /* The first packet goes right away. */
+  pc.next = pc.start;
+}
+
+/**
+ * Splits the rate between processes.
+ *
+ * @param worker Index of this process (0 .. nworkers - 1).
+ * @param nworkers Number of processes.
+ */
+void split_pacing(unsigned worker, unsigned nworkers)
+{
+  assert(worker < nworkers);
+
+  pc.nworkers = nworkers;
+
+  /* Workers don't send at the same instant. */
+  pc.credit = 1.0 - (double)worker / nworkers;
+  if (profile_rate(0.0) > 0.0)
+    pc.next = pc.start + worker * 1e9 / profile_rate(0.0);
+}
+
+/**
+ * Waits until the next packet is due.
+ *
+ * Each worker earns credit (packets) at its share of the target rate,
+ * as given by the profile at that moment, and spends one per packet.
+ *
+ * @return FALSE if the run is over (--duration), TRUE otherwise.
+ */
+int pace(void)
+{
+  uint64_t now, gap;
+  double rate;
+
+  if (pc.profile == PROFILE_NONE)
+  {
+    /* Only the duration matters. Avoid reading the clock every packet. */
+    if (!pc.end || (++pc.count & PACING_CHECK_MASK))
+      return TRUE;
+    return pacing_clock() < pc.end;
+  }
+
+  if (pc.txtime)
+    return pace_txtime();
+
+  for (;;)
+  {
+    now = pacing_clock();
+    if (pc.end && now >= pc.end)
+      return FALSE;
+
+    /* This worker's share of the rate, right now. */
+    rate = profile_rate((now - pc.start) / 1e9) / pc.nworkers;
+
+    pc.credit += rate * (now - pc.last) / 1e9;
+    pc.last = now;
+
+    /* Behind schedule? Catch up, but don't burst. */
+    if (pc.credit > 1.0 + rate * PACING_MAX_LAG)
+      pc.credit = 1.0 + rate * PACING_MAX_LAG;
+
+    if (pc.credit >= 1.0)
+    {
+      pc.credit -= 1.0;
+      return TRUE;
+    }
+
+    /* Time until the next packet is due (at the current rate). */
+    gap = (rate > 0.0) ? (1.0 - pc.credit) / rate * 1e9 : PACING_MAX_NAP_NS;
+
+    /* Long gaps are slept (leaving some margin), short ones are spun. */
+    if (gap > PACING_SPIN_NS)
+    {
+      struct timespec ts;
+
+      if (gap > PACING_MAX_NAP_NS)
+        gap = PACING_MAX_NAP_NS;
+      else
+        gap -= PACING_SPIN_NS / 2;
+
+      ts.tv_sec  = 0;
+      ts.tv_nsec = gap;
+
+      /* NOTE: Interrupted by a signal? Let the main loop decide. */
+      if (nanosleep(&ts, NULL) == -1)
+        return TRUE;
+    }
+  }
+}
+
+/**
+ * Changes the target rate while running (--control): from now on, a
+ * constant rate instead of the profile (--rate, --ramp).
+ *
+ * @param rate Rate in pps (all workers); 0 means unpaced.
+ */
+void set_pacing_rate(double rate)
+{
+  uint64_t now = pacing_clock();
+
+  pc.profile = (rate > 0.0) ? PROFILE_CONSTANT : PROFILE_NONE;
+  pc.r0 = pc.r1 = rate;
+
+  /* No credit earned at the old rate: no burst. */
+  pc.last = now;
+  if (pc.credit > 1.0)
+    pc.credit = 1.0;
+  if (pc.next < now)
+    pc.next = now;
+}
+
+/**
+ * Checks if the run is over (--duration), without pacing a packet.
+ *
+ * @return TRUE if the time is over, FALSE otherwise.
+ */
+int pacing_expired(void)
+{
+  return pc.end && pacing_clock() >= pc.end;
+}
+
+/**
+ * Gets the transmit time of the packet just paced (--txtime).
+ *
+ * @return Time in ns (CLOCK_MONOTONIC).
+ */
+uint64_t get_txtime(void)
+{
+  return pc.tx;
+}
+
+/**
+ * Gets the target rate (all workers) of the profile.
+ *
+ * @param t Seconds since start.
+ * @return Rate in pps (0 if unpaced).
+ */
+double get_target_rate(double t)
+{
+  return profile_rate(t);
+}
+
+/**
+ * Gets the profile step. Steps are the ladder steps or, for
+ * linear and sine profiles, slices of 'stats-interval' seconds.
+ *
+ * @param t Seconds since start.
+ * @return Step number, -1 if there is no ramp.
+ */
+int get_pacing_step(double t)
+{
+  double s;
+
+  if (pc.profile < PROFILE_LINEAR)
+    return -1;
+
+  s = floor(t / pc.step_len);
+
+  /* The ladder's last step lasts until the end. */
+  if (pc.profile == PROFILE_STEP)
+    s = fmin(s, pc.length / pc.dwell - 1.0);
+
+  return s;
+}
+
+/* Kernel pacing: instead of waiting for each packet, gives it a transmit
+   time on the schedule and lets the qdisc (fq or etf) hold it until then.
+   The worker runs ahead of the schedule, by up to PACING_TXTIME_AHEAD_NS,
+   and sleeps when it gets there: no spinning, and packets can be batched. */
+static int pace_txtime(void)
+{
+  uint64_t now;
+  double rate;
+
+  for (;;)
+  {
+    if (pc.end && pc.next >= pc.end)
+      return FALSE;
+
+    now = pacing_clock();
+
+    /* Behind schedule? No packets in the past: start over from now. */
+    if (pc.next + PACING_MAX_LAG * 1e9 < now)
+      pc.next = now;
+
+    if (pc.next <= now + PACING_TXTIME_AHEAD_NS)
+      break;
+
+    {
+      uint64_t gap = pc.next - now - PACING_TXTIME_AHEAD_NS / 2;
+      struct timespec ts = { 0, gap > PACING_MAX_NAP_NS ? PACING_MAX_NAP_NS : gap };
+
+      /* NOTE: Interrupted by a signal? Let the main loop decide
+               (the qdisc holds the packet anyway). */
+      if (nanosleep(&ts, NULL) == -1)
+        break;
+    }
+  }
+
+  pc.tx = pc.next;
+
+  /* This worker's share of the rate, at the packet's time. */
+  rate = profile_rate((pc.next - pc.start) / 1e9) / pc.nworkers;
+  pc.next += (rate > 0.0) ? 1e9 / rate : PACING_MAX_NAP_NS;
+
+  return TRUE;
+}
+
+/* Target rate at time 't' (seconds since start). */
+static double profile_rate(double t)
+{
+  double r;
+
+  switch (pc.profile)
+  {
+  case PROFILE_CONSTANT:
+    return pc.r0;
+
+  case PROFILE_LINEAR:
+    if (t >= pc.length)
+      return pc.r1;
+    return pc.r0 + (pc.r1 - pc.r0) * t / pc.length;
+
+  case PROFILE_STEP:
+    r = pc.r0 + pc.inc * floor(t / pc.dwell);
+    return (pc.inc > 0.0) ? fmin(r, pc.r1) : fmax(r, pc.r1);
+
+  case PROFILE_SINE:
+    return pc.r0 + (pc.r1 - pc.r0) * (1.0 - cos(2.0 * M_PI * t / pc.length)) / 2.0;
+  }
+
+  return 0.0;
+}
+
+/* Monotonic clock in nanoseconds. */
+static uint64_t pacing_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pacing_error(const char *spec, const char *msg)
+{
+  fatal_error("Invalid ramp '%s': %s.", spec, msg);
+}
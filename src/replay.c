@@ -0,0 +1,457 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file replay.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* pcap file format (not pcapng). */
+#define PCAP_MAGIC          0xa1b2c3d4U
+#define PCAP_MAGIC_NSEC     0xa1b23c4dU
+
+/* Link types we know how to skip. */
+#define PCAP_DLT_EN10MB     1
+#define PCAP_DLT_RAW_BSD    12
+#define PCAP_DLT_RAW_OBSD   14
+#define PCAP_DLT_RAW        101
+#define PCAP_DLT_LINUX_SLL  113
+
+struct pcap_file_hdr
+{
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int32_t  thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t linktype;
+};
+
+struct pcap_rec_hdr
+{
+  uint32_t ts_sec;
+  uint32_t ts_frac;
+  uint32_t caplen;
+  uint32_t len;
+};
+
+/* Index entries: offset of the IP header on the file (48 bits) and
+   the length of the IP packet (16 bits). */
+#define REPLAY_OFFSET(e)  ((e) >> 16)
+#define REPLAY_LENGTH(e)  ((e) & 0xffff)
+
+static struct
+{
+  uint8_t  *map;
+  size_t   map_size;
+  uint64_t *index;
+  uint32_t count;
+  uint32_t skipped;       /* not IPv4, truncated or malformed. */
+
+  uint32_t pos;           /* next packet.                      */
+  uint32_t step;          /* number of workers.                */
+  unsigned rewrite;       /* REWRITE_* fields.                 */
+} rp;
+
+/* pcap output (--backend pcap). */
+#define PCAP_OUT_BUFFER     (1 << 20)
+
+static FILE     *pcap_out = NULL;
+static uint64_t  pcap_out_count;
+
+static void replay_packet(const struct config_options *const __restrict__, size_t *);
+static void rewrite_packet(struct iphdr *, size_t, const struct config_options *const __restrict__);
+static int  get_l2_length(uint32_t, const uint8_t *, uint32_t);
+
+static modules_table_t replay_module =
+  { IPPROTO_IP, "REPLAY", "Packets from a pcap file", replay_packet, NULL };
+
+/**
+ * Maps a pcap file and indexes its IPv4 packets.
+ *
+ * The file is indexed only once. Anything which isn't a whole IPv4
+ * packet (other protocols, packets cut by the snap length) is skipped.
+ *
+ * @param filename pcap file.
+ * @param rewrite Fields to rewrite on each packet (REWRITE_*).
+ * @return Number of packets.
+ */
+uint32_t load_replay(const char *filename, unsigned rewrite)
+{
+  const struct pcap_file_hdr *fh;
+  const struct pcap_rec_hdr *rh;
+  struct stat st;
+  size_t off, cap;
+  uint32_t linktype;
+  int fd, swapped, l2;
+
+#define PCAP32(x) (swapped ? __builtin_bswap32(x) : (x))
+
+  memset(&rp, 0, sizeof(rp));
+  rp.step = 1;
+  rp.rewrite = rewrite;
+
+  if ((fd = open(filename, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+    fatal_error("Cannot open the capture file '%s'.", filename);
+
+  if ((size_t)st.st_size < sizeof(struct pcap_file_hdr))
+    fatal_error("'%s' is not a pcap file.", filename);
+
+  rp.map_size = st.st_size;
+  if ((rp.map = mmap(NULL, rp.map_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Cannot map the capture file '%s': \"%s\"", filename, strerror(errno));
+    #else
+    fatal_error("Cannot map the capture file '%s'.", filename);
+    #endif
+  close(fd);
+
+  /* The index is built in one sequential pass. */
+  madvise(rp.map, rp.map_size, MADV_SEQUENTIAL);
+
+  fh = (const struct pcap_file_hdr *)rp.map;
+  if (fh->magic == PCAP_MAGIC || fh->magic == PCAP_MAGIC_NSEC)
+    swapped = FALSE;
+  else if (fh->magic == __builtin_bswap32(PCAP_MAGIC) || fh->magic == __builtin_bswap32(PCAP_MAGIC_NSEC))
+    swapped = TRUE;
+  else
+    fatal_error("'%s' is not a pcap file (pcapng isn't supported).", filename);
+
+  linktype = PCAP32(fh->linktype) & 0xffff;
+  if (linktype != PCAP_DLT_EN10MB && linktype != PCAP_DLT_RAW && linktype != PCAP_DLT_RAW_BSD &&
+      linktype != PCAP_DLT_RAW_OBSD && linktype != PCAP_DLT_LINUX_SLL)
+    fatal_error("Link type %u of '%s' isn't supported (Ethernet, raw IP or Linux cooked only).",
+                linktype, filename);
+
+  /* First pass: counts the records, to allocate the index at once. */
+  for (off = sizeof(*fh); off + sizeof(*rh) <= rp.map_size; off += sizeof(*rh) + cap)
+  {
+    rh = (const struct pcap_rec_hdr *)(rp.map + off);
+    cap = PCAP32(rh->caplen);
+    rp.count++;
+  }
+
+  if ((rp.index = malloc(rp.count * sizeof(uint64_t) + 1)) == NULL)
+    fatal_error("Cannot allocate memory for the capture index.");
+
+  /* Second pass: indexes the whole IPv4 packets. */
+  rp.count = 0;
+  for (off = sizeof(*fh); off + sizeof(*rh) <= rp.map_size; off += sizeof(*rh) + cap)
+  {
+    const struct iphdr *ip;
+    uint32_t len;
+
+    rh = (const struct pcap_rec_hdr *)(rp.map + off);
+    cap = PCAP32(rh->caplen);
+
+    /* Last record cut short? */
+    if (off + sizeof(*rh) + cap > rp.map_size)
+    {
+      rp.skipped++;
+      break;
+    }
+
+    if ((l2 = get_l2_length(linktype, (const uint8_t *)(rh + 1), cap)) < 0 ||
+        cap - l2 < sizeof(struct iphdr))
+    {
+      rp.skipped++;
+      continue;
+    }
+
+    ip = (const struct iphdr *)((const uint8_t *)(rh + 1) + l2);
+    len = ntohs(ip->tot_len);
+    if (ip->version != 4 || ip->ihl < 5 || len < ip->ihl * 4U || len > cap - l2)
+    {
+      rp.skipped++;
+      continue;
+    }
+
+    rp.index[rp.count++] = (uint64_t)((const uint8_t *)ip - rp.map) << 16 | len;
+  }
+
+#undef PCAP32
+
+  if (!rp.count)
+    fatal_error("No IPv4 packets on '%s'.", filename);
+
+  /* From now on, packets are read in index order. */
+  madvise(rp.map, rp.map_size, MADV_WILLNEED);
+
+  return rp.count;
+}
+
+/**
+ * Gets the number of packets on the capture (indexed).
+ */
+uint32_t get_replay_count(void)
+{
+  return rp.count;
+}
+
+/**
+ * Gets the number of packets skipped on the capture.
+ */
+uint32_t get_replay_skipped(void)
+{
+  return rp.skipped;
+}
+
+/**
+ * Gets the module entry which replays the capture.
+ */
+modules_table_t *get_replay_module(void)
+{
+  return &replay_module;
+}
+
+/**
+ * Splits the capture between processes.
+ *
+ * Each process takes every 'nworkers'th packet, starting at 'worker'.
+ *
+ * @param worker Index of this process (0 .. nworkers - 1).
+ * @param nworkers Number of processes.
+ */
+void split_replay(unsigned worker, unsigned nworkers)
+{
+  assert(worker < nworkers);
+
+  rp.pos = worker % rp.count;
+  rp.step = nworkers;
+}
+
+/**
+ * Releases the capture.
+ */
+void close_replay(void)
+{
+  if (rp.map)
+    munmap(rp.map, rp.map_size);
+  free(rp.index);
+
+  memset(&rp, 0, sizeof(rp));
+}
+
+/**
+ * Creates a pcap file (raw IPv4 packets) for the pcap backend.
+ *
+ * @param filename pcap file ("-" is stdout).
+ */
+void open_pcap_output(const char *filename)
+{
+  struct pcap_file_hdr fh = { PCAP_MAGIC_NSEC, 2, 4, 0, 0, 65535, PCAP_DLT_RAW };
+
+  if (!strcmp(filename, "-"))
+    pcap_out = stdout;
+  else if ((pcap_out = fopen(filename, "w")) == NULL)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Cannot create '%s': \"%s\"", filename, strerror(errno));
+    #else
+    fatal_error("Cannot create '%s'.", filename);
+    #endif
+
+  /* NOTE: Packets are written in big chunks; stdout is unbuffered later. */
+  setvbuf(pcap_out, NULL, _IOFBF, PCAP_OUT_BUFFER);
+
+  if (fwrite(&fh, sizeof(fh), 1, pcap_out) != 1)
+    fatal_error("Cannot write '%s'.", filename);
+
+  pcap_out_count = 0;
+}
+
+/**
+ * Writes a packet to the pcap file.
+ *
+ * In deterministic mode (--seed), packets are 1 us apart from the epoch,
+ * so the whole file repeats.
+ *
+ * @param buffer IP packet.
+ * @param size Its size.
+ * @return TRUE (success) or FALSE (write error).
+ */
+int write_pcap(const void *buffer, size_t size)
+{
+  struct pcap_rec_hdr rh;
+  struct timespec ts;
+
+  if (has_fixed_seed())
+  {
+    ts.tv_sec  = pcap_out_count / 1000000;
+    ts.tv_nsec = pcap_out_count % 1000000 * 1000;
+  }
+  else
+    clock_gettime(CLOCK_REALTIME, &ts);
+  pcap_out_count++;
+
+  rh.ts_sec  = ts.tv_sec;
+  rh.ts_frac = ts.tv_nsec;
+  rh.caplen  = rh.len = size;
+
+  return fwrite(&rh, sizeof(rh), 1, pcap_out) == 1 &&
+         fwrite(buffer, size, 1, pcap_out) == 1;
+}
+
+/**
+ * Flushes and closes the pcap file.
+ */
+void close_pcap_output(void)
+{
+  if (pcap_out)
+  {
+    if (pcap_out == stdout)
+      fflush(pcap_out);
+    else
+      fclose(pcap_out);
+    pcap_out = NULL;
+  }
+}
+
+/* The replay "module": copies the next packet to the packet buffer
+   and rewrites it, as needed. */
+static void replay_packet(const struct config_options *const __restrict__ co, size_t *size)
+{
+  uint64_t e;
+
+  e = rp.index[rp.pos];
+  if ((rp.pos += rp.step) >= rp.count)
+    rp.pos %= rp.count;
+
+  *size = REPLAY_LENGTH(e);
+  alloc_packet(*size);
+  memcpy(packet, rp.map + REPLAY_OFFSET(e), *size);
+
+  if (rp.rewrite)
+    rewrite_packet(packet, *size, co);
+}
+
+/* Rewrites addresses, ports and TTL, fixing up the checksums (RFC 1624).
+   NOTE: Only the first fragment has the transport header. */
+static void rewrite_packet(struct iphdr *ip,
+                           size_t size,
+                           const struct config_options *const __restrict__ co)
+{
+  uint8_t *l4 = (uint8_t *)ip + ip->ihl * 4;
+  size_t l4len = size - ip->ihl * 4;
+  uint16_t *sum = NULL;   /* transport checksum (covers the pseudo header). */
+  uint16_t *ports = NULL;
+  uint16_t *w, old;
+  in_addr_t addr;
+
+  if (!(ntohs(ip->frag_off) & 0x1fff))
+    switch (ip->protocol)
+    {
+    case IPPROTO_TCP:
+      if (l4len >= sizeof(struct tcphdr))
+      {
+        sum = &((struct tcphdr *)l4)->check;
+        ports = (uint16_t *)l4;
+      }
+      break;
+
+    case IPPROTO_UDP:
+      if (l4len >= sizeof(struct udphdr))
+      {
+        /* NOTE: Zero means "no checksum". */
+        if (((struct udphdr *)l4)->check)
+          sum = &((struct udphdr *)l4)->check;
+        ports = (uint16_t *)l4;
+      }
+      break;
+    }
+
+  if (rp.rewrite & REWRITE_DADDR)
+  {
+    addr = co->ip.daddr;
+    cksum_update32(&ip->check, ip->daddr, addr);
+    if (sum)
+      cksum_update32(sum, ip->daddr, addr);
+    ip->daddr = addr;
+  }
+
+  if (rp.rewrite & REWRITE_SADDR)
+  {
+    addr = INADDR_RND(co->ip.saddr);
+    cksum_update32(&ip->check, ip->saddr, addr);
+    if (sum)
+      cksum_update32(sum, ip->saddr, addr);
+    ip->saddr = addr;
+  }
+
+  if (ports)
+  {
+    if (rp.rewrite & REWRITE_SPORT)
+    {
+      old = ports[0];
+      ports[0] = htons(IPPORT_RND(co->source));
+      if (sum)
+        cksum_update16(sum, old, ports[0]);
+    }
+
+    if (rp.rewrite & REWRITE_DPORT)
+    {
+      old = ports[1];
+      ports[1] = htons(IPPORT_RND(co->dest));
+      if (sum)
+        cksum_update16(sum, old, ports[1]);
+    }
+  }
+
+  if (rp.rewrite & REWRITE_TTL)
+  {
+    /* TTL shares its 16 bits word with the protocol. */
+    w = (uint16_t *)&ip->ttl;
+    old = *w;
+    ip->ttl = co->ip.ttl;
+    cksum_update16(&ip->check, old, *w);
+  }
+
+  /* UDP: a computed zero is sent as all ones. */
+  if (sum && ip->protocol == IPPROTO_UDP && !*sum)
+    *sum = 0xffff;
+}
+
+/* Length of the link layer header of a record, -1 if it isn't IPv4. */
+static int get_l2_length(uint32_t linktype, const uint8_t *p, uint32_t cap)
+{
+  uint32_t len;
+  uint16_t type;
+
+  switch (linktype)
+  {
+  case PCAP_DLT_EN10MB:
+    /* Skips VLAN tags (802.1Q and 802.1ad). */
+    for (len = 2 * ETH_ALEN; len + 2 <= cap; len += 4)
+    {
+      type = p[len] << 8 | p[len + 1];
+      if (type != ETH_P_8021Q && type != ETH_P_8021AD)
+        return (type == ETH_P_IP) ? (int)len + 2 : -1;
+    }
+    return -1;
+
+  case PCAP_DLT_LINUX_SLL:
+    if (cap < 16 || (p[14] << 8 | p[15]) != ETH_P_IP)
+      return -1;
+    return 16;
+  }
+
+  /* Raw IP. */
+  return 0;
+}
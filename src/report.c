@@ -0,0 +1,301 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file report.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+
+/* NOTE: Reports are for scripts comparing runs: JSON at the end
+         (--report) and a CSV line per statistics interval (--csv). */
+
+/* The configuration as resolved at start (the main loop changes
+   some of it: threshold, protocol, ...). */
+static struct config_options report_co;
+static char                **report_argv;
+static struct timespec       report_start;   /* CLOCK_REALTIME. */
+static FILE                 *report_csv = NULL;
+
+static void report_string(FILE *, const char *);
+static void report_time(FILE *, const struct timespec *);
+static void report_config(FILE *);
+
+/**
+ * Takes note of the configuration and the start time, and opens the
+ * CSV file (--csv).
+ *
+ * Used only by the parent process, before start_stats().
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @param argv Command line.
+ */
+void start_report(const struct config_options *const __restrict__ co, char **argv)
+{
+  report_co   = *co;
+  report_argv = argv;
+  clock_gettime(CLOCK_REALTIME, &report_start);
+
+  if (co->csv)
+  {
+    if ((report_csv = fopen(co->csv, "w")) == NULL)
+      #ifdef __HAVE_DEBUG__
+      fatal_error("Cannot create '%s': \"%s\"", co->csv, strerror(errno));
+      #else
+      fatal_error("Cannot create '%s'.", co->csv);
+      #endif
+
+    fputs("elapsed,packets,bytes,pps,bps,target_pps,errors,full,dropped,full_seconds,received\n",
+          report_csv);
+    fflush(report_csv);
+  }
+}
+
+/**
+ * Writes a CSV line for a statistics interval.
+ *
+ * Called by the statistics thread.
+ *
+ * @param prev Counters at the start of the interval.
+ * @param cur Counters at its end.
+ */
+void report_interval(const struct stats_snapshot *prev, const struct stats_snapshot *cur)
+{
+  double t;
+
+  if (!report_csv || (t = cur->elapsed - prev->elapsed) <= 0.0)
+    return;
+
+  fprintf(report_csv, "%.3f,%" PRIu64 ",%" PRIu64 ",%.1f,%.1f,%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f,%" PRIu64 "\n",
+          cur->elapsed,
+          cur->packets - prev->packets,
+          cur->bytes - prev->bytes,
+          (cur->packets - prev->packets) / t,
+          (cur->bytes - prev->bytes) * 8 / t,
+          get_target_rate(cur->elapsed),
+          cur->errors - prev->errors,
+          cur->full - prev->full,
+          cur->drops - prev->drops,
+          (cur->full_ns - prev->full_ns) / 1e9,
+          cur->rx_total - prev->rx_total);
+
+  /* A run may be cut short: each line is there as soon as it's done. */
+  fflush(report_csv);
+}
+
+/**
+ * Writes the report of the whole run (--report) and closes the CSV file.
+ *
+ * Used only by the parent process, after the workers are done (and
+ * stop_stats()).
+ *
+ * @param co Pointer to T50 configuration structure.
+ */
+void write_report(const struct config_options *const __restrict__ co)
+{
+  struct stats_snapshot s;
+  struct rusage self, children;
+  struct timespec stop;
+  double t, peak_pps, peak_bps;
+  unsigned m, first;
+  FILE *f;
+
+  if (report_csv)
+  {
+    fclose(report_csv);
+    report_csv = NULL;
+  }
+
+  if (!co->report)
+    return;
+
+  clock_gettime(CLOCK_REALTIME, &stop);
+  take_stats_snapshot(&s);
+  get_peak_rates(&peak_pps, &peak_bps);
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  t = s.elapsed > 0.0 ? s.elapsed : 1e-9;
+
+  if ((f = fopen(co->report, "w")) == NULL)
+  {
+    /* The run is over: no reason to lose the rest. */
+    error("Cannot create '%s'.", co->report);
+    return;
+  }
+
+  fprintf(f, "{\n  \"version\": ");
+  report_string(f, VERSION);
+
+  fprintf(f, ",\n  \"command_line\": [");
+  for (m = 0; report_argv[m]; m++)
+  {
+    fputs(m ? ", " : "", f);
+    report_string(f, report_argv[m]);
+  }
+  fputs("],\n  \"config\": ", f);
+  report_config(f);
+
+  fputs(",\n  \"start\": ", f);
+  report_time(f, &report_start);
+  fputs(",\n  \"stop\": ", f);
+  report_time(f, &stop);
+
+  fprintf(f, ",\n  \"elapsed\": %.6f,\n"
+             "  \"workers\": %u,\n"
+             "  \"cpu_seconds\": { \"user\": %.3f, \"system\": %.3f },\n",
+          s.elapsed, stats->nworkers,
+          self.ru_utime.tv_sec + children.ru_utime.tv_sec +
+            (self.ru_utime.tv_usec + children.ru_utime.tv_usec) / 1e6,
+          self.ru_stime.tv_sec + children.ru_stime.tv_sec +
+            (self.ru_stime.tv_usec + children.ru_stime.tv_usec) / 1e6);
+
+  fprintf(f, "  \"packets\": %" PRIu64 ",\n"
+             "  \"bytes\": %" PRIu64 ",\n"
+             "  \"pps\": { \"average\": %.1f, \"peak\": %.1f },\n"
+             "  \"bps\": { \"average\": %.1f, \"peak\": %.1f },\n",
+          s.packets, s.bytes, s.packets / t, peak_pps, s.bytes * 8 / t, peak_bps);
+
+  fprintf(f, "  \"errors\": { \"send\": %" PRIu64 ", \"socket_full\": %" PRIu64
+             ", \"dropped\": %" PRIu64 ", \"full_seconds\": %.6f },\n",
+          s.errors, s.full, s.drops, s.full_ns / 1e9);
+
+  fputs("  \"modules\": {", f);
+  for (m = 0, first = TRUE; m < STATS_MAX_MODULES; m++)
+    if (s.module_packets[m])
+    {
+      fprintf(f, "%s\n    ", first ? "" : ",");
+      report_string(f, get_module_slot_name(m));
+      fprintf(f, ": { \"packets\": %" PRIu64 ", \"bytes\": %" PRIu64 " }",
+              s.module_packets[m], s.module_bytes[m]);
+      first = FALSE;
+    }
+  fputs(first ? "}" : "\n  }", f);
+
+  if (co->rx)
+    fprintf(f, ",\n  \"received\": { \"total\": %" PRIu64 ", \"synack\": %" PRIu64
+               ", \"rst\": %" PRIu64 ", \"tcp_other\": %" PRIu64 ", \"icmp_echoreply\": %" PRIu64
+               ", \"icmp_unreach\": %" PRIu64 ", \"icmp_other\": %" PRIu64 ", \"udp\": %" PRIu64
+               ", \"other\": %" PRIu64 ", \"ring_drops\": %" PRIu64 " }",
+            s.rx_total, s.rx[RX_SYNACK], s.rx[RX_RST], s.rx[RX_TCP_OTHER],
+            s.rx[RX_ICMP_ECHOREPLY], s.rx[RX_ICMP_UNREACH], s.rx[RX_ICMP_OTHER],
+            s.rx[RX_UDP], s.rx[RX_OTHER], stats->rx_drops);
+
+  fputs("\n}\n", f);
+
+  if (fclose(f))
+    error("Cannot write '%s'.", co->report);
+}
+
+/* A JSON string (NULL is null). */
+static void report_string(FILE *f, const char *s)
+{
+  if (!s)
+  {
+    fputs("null", f);
+    return;
+  }
+
+  fputc('"', f);
+  for (; *s; s++)
+    if (*s == '"' || *s == '\\')
+      fprintf(f, "\\%c", *s);
+    else if ((unsigned char)*s < ' ')
+      fprintf(f, "\\u%04x", *s);
+    else
+      fputc(*s, f);
+  fputc('"', f);
+}
+
+/* A time, as ISO 8601 (local time, with its offset). */
+static void report_time(FILE *f, const struct timespec *ts)
+{
+  char buf[64], zone[8];
+  struct tm tm;
+
+  localtime_r(&ts->tv_sec, &tm);
+  strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+  strftime(zone, sizeof(zone), "%z", &tm);
+  fprintf(f, "\"%s.%03ld%s\"", buf, ts->tv_nsec / 1000000, zone);
+}
+
+/* The general options, as resolved (defaults and implied values in). */
+static void report_config(FILE *f)
+{
+  static const char *orders[] = { "random", "sequential", "permutation" };
+  static const char *on_full[] = { "wait", "spin", "drop" };
+  static const char *backends[] = { "raw", "packet", "null", "pcap" };
+  const struct config_options *co = &report_co;
+  char addr[INET_ADDRSTRLEN];
+  struct in_addr in = { co->ip.daddr };
+
+  fputs("{\n    \"protocol\": ", f);
+  if (co->replay)
+    report_string(f, "REPLAY");
+  else if (co->ip.protocol == IPPROTO_T50)
+    report_string(f, "T50");
+  else
+    report_string(f, mod_table[co->ip.protoname].acronym);
+
+  fputs(",\n    \"target\": ", f);
+  if (co->ip.daddr)
+  {
+    fprintf(f, "\"%s/%" PRIu32 "\"", inet_ntop(AF_INET, &in, addr, sizeof(addr)), co->bits);
+  }
+  else
+    fputs("null", f);
+  fputs(",\n    \"targets\": ", f);
+  report_string(f, co->targets);
+  fputs(",\n    \"target_order\": ", f);
+  report_string(f, orders[co->target_order]);
+  fputs(",\n    \"mix\": ", f);
+  report_string(f, co->mix);
+  fprintf(f, ",\n    \"flows\": %" PRIu32 ",\n    \"flow_sched\": ", co->flows);
+  report_string(f, co->flow_sched == FLOW_SCHED_ZIPF ? "zipf" : "rr");
+  fprintf(f, ",\n    \"flow_zipf\": %g", co->flow_zipf);
+
+  fprintf(f, ",\n    \"flood\": %s,\n    \"threshold\": %d", co->flood ? "true" : "false", co->threshold);
+  fprintf(f, ",\n    \"duration\": %g,\n    \"rate\": %g,\n    \"ramp\": ", co->duration, co->rate);
+  report_string(f, co->ramp);
+
+  fputs(",\n    \"iface\": ", f);
+  report_string(f, co->iface);
+  fprintf(f, ",\n    \"workers\": %u,\n    \"backend\": \"%s\",\n    \"dst_mac\": ",
+          co->workers, backends[co->backend]);
+  report_string(f, co->dst_mac);
+  fputs(",\n    \"vlan\": ", f);
+  report_string(f, co->vlan);
+  fputs(",\n    \"replay\": ", f);
+  report_string(f, co->replay);
+  fprintf(f, ",\n    \"rewrite\": %u", co->rewrite);
+
+  fprintf(f, ",\n    \"io_uring\": %s,\n    \"uring_depth\": %u,\n    \"uring_batch\": %u",
+          co->io_uring ? "true" : "false", co->uring_depth, co->uring_batch);
+  fprintf(f, ",\n    \"on_full\": \"%s\"", on_full[co->on_full]);
+  fprintf(f, ",\n    \"payload\": %u,\n    \"offload\": %s,\n    \"gso\": %u",
+          co->payload, co->offload ? "true" : "false", co->gso);
+  fprintf(f, ",\n    \"tx_queues\": %s,\n    \"txtime\": %s",
+          co->tx_queues ? "true" : "false", co->txtime ? "true" : "false");
+  fprintf(f, ",\n    \"encapsulated\": %s,\n    \"bogus_csum\": %s",
+          co->encapsulated ? "true" : "false", co->bogus_csum ? "true" : "false");
+  fprintf(f, ",\n    \"rx\": %s,\n    \"stats_interval\": %u,\n    \"seed\": ",
+          co->rx ? "true" : "false", co->stats_interval);
+  if (co->seeded)
+    fprintf(f, "%" PRIu64 "\n  }", co->seed);
+  else
+    fputs("null\n  }", f);
+}
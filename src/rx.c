@@ -0,0 +1,253 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file rx.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+/* RX ring geometry (TPACKET_V3): 16 blocks of 1 MiB. */
+#define RX_BLOCK_SIZE   (1U << 20)
+#define RX_BLOCK_NR     16
+#define RX_FRAME_SIZE   2048
+#define RX_BLOCK_TMO    100     /* ms. Partially filled blocks are retired after this. */
+
+/* Late responses are still counted for this long (seconds) after the last packet is sent. */
+#define RX_LINGER       1
+
+/* Only the headers are needed to classify a response. */
+#define RX_SNAPLEN      128
+
+static socket_t              rx_fd = -1;
+static uint8_t              *rx_ring = NULL;
+static pthread_t             rx_thread;
+static volatile sig_atomic_t rx_stop = 0;
+
+static void *rx_loop(void *);
+static void  rx_classify(const uint8_t *, unsigned);
+
+/**
+ * Creates the receive ring and starts the receive thread.
+ *
+ * The ring gets IPv4 packets coming to our source address or, if the
+ * source address is random, to our address on the route to the first
+ * destination. Outgoing packets are filtered out by the kernel.
+ *
+ * Used only by the parent process.
+ *
+ * @param co Pointer to T50 configuration structure.
+ */
+void start_rx(const struct config_options *const __restrict__ co)
+{
+  struct tpacket_req3 req =
+  {
+    .tp_block_size = RX_BLOCK_SIZE,
+    .tp_block_nr = RX_BLOCK_NR,
+    .tp_frame_size = RX_FRAME_SIZE,
+    .tp_frame_nr = (RX_BLOCK_SIZE / RX_FRAME_SIZE) * RX_BLOCK_NR,
+    .tp_retire_blk_tov = RX_BLOCK_TMO
+  };
+  struct sockaddr_ll sll = { .sll_family = AF_PACKET, .sll_protocol = htons(ETH_P_IP) };
+  int version = TPACKET_V3;
+
+  /* Classic BPF. Loads are relative to the network header (SKF_NET_OFF),
+     so it works with any link layer. */
+  struct sock_filter code[] =
+  {
+    /* 0 */ BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+    /* 1 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 4, 0),
+    /* 2 */ BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, SKF_NET_OFF + 16),     /* daddr */
+    /* 3 */ BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0),                     /* mask  */
+    /* 4 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),               /* net   */
+    /* 5 */ BPF_STMT(BPF_RET | BPF_K, RX_SNAPLEN),
+    /* 6 */ BPF_STMT(BPF_RET | BPF_K, 0)
+  };
+  struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+  in_addr_t addr = co->ip.saddr;
+
+  /* Our source address. Random, the address the kernel would send from. */
+  if (addr == INADDR_ANY)
+    addr = get_route_source(get_first_target());
+
+  if (addr != INADDR_ANY)
+  {
+    code[3].k = 0xffffffffU;
+    code[4].k = ntohl(addr);
+  }
+  else
+    error("No route to the destinations: every IPv4 packet received is counted as a response.");
+
+  if ((rx_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP))) == -1)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error opening receive socket: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Error opening receive socket");
+    #endif
+
+  /* NOTE: The filter must be there before any packet is queued. */
+  if (setsockopt(rx_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1 ||
+      setsockopt(rx_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1 ||
+      setsockopt(rx_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error setting up the receive ring: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Error setting up the receive ring");
+    #endif
+
+  if ((rx_ring = mmap(NULL, RX_BLOCK_SIZE * RX_BLOCK_NR, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, rx_fd, 0)) == MAP_FAILED)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error mapping the receive ring: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Error mapping the receive ring");
+    #endif
+
+  /* ifindex 0 means "every interface". */
+  if (co->rx_iface && !(sll.sll_ifindex = if_nametoindex(co->rx_iface)))
+    fatal_error("Unknown interface '%s'.", co->rx_iface);
+
+  if (bind(rx_fd, (struct sockaddr *)&sll, sizeof(sll)) == -1)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error binding the receive socket: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Error binding the receive socket");
+    #endif
+
+  if (pthread_create(&rx_thread, NULL, rx_loop, NULL))
+    fatal_error("Cannot create the receive thread.");
+}
+
+/**
+ * Stops the receive thread and releases the ring.
+ */
+void stop_rx(void)
+{
+  struct tpacket_stats_v3 st;
+  socklen_t len = sizeof(st);
+
+  if (rx_fd == -1)
+    return;
+
+  sleep(RX_LINGER);
+
+  rx_stop = 1;
+  pthread_join(rx_thread, NULL);
+
+  if (!getsockopt(rx_fd, SOL_PACKET, PACKET_STATISTICS, &st, &len))
+    stats->rx_drops += st.tp_drops;
+
+  munmap(rx_ring, RX_BLOCK_SIZE * RX_BLOCK_NR);
+  close(rx_fd);
+  rx_fd = -1;
+}
+
+/* The receive thread: walks the ring, block by block. */
+static void *rx_loop(void *arg)
+{
+  struct pollfd pfd = { .fd = rx_fd, .events = POLLIN | POLLERR };
+  struct tpacket_block_desc *bd;
+  struct tpacket3_hdr *ph;
+  unsigned blk = 0, i;
+
+  (void)arg;
+
+  while (!rx_stop)
+  {
+    bd = (struct tpacket_block_desc *)(rx_ring + blk * RX_BLOCK_SIZE);
+
+    if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+    {
+      poll(&pfd, 1, RX_BLOCK_TMO);
+      continue;
+    }
+
+    ph = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < bd->hdr.bh1.num_pkts; i++)
+    {
+      rx_classify((uint8_t *)ph + ph->tp_net, ph->tp_snaplen - (ph->tp_net - ph->tp_mac));
+      ph = (struct tpacket3_hdr *)((uint8_t *)ph + ph->tp_next_offset);
+    }
+
+    /* Gives the block back to the kernel. */
+    __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+    if (++blk == RX_BLOCK_NR)
+      blk = 0;
+  }
+
+  return NULL;
+}
+
+/* Classifies a response. 'len' is the captured length from the IP header on. */
+static void rx_classify(const uint8_t *p, unsigned len)
+{
+  const struct iphdr *ip = (const struct iphdr *)p;
+  const uint8_t *l4;
+  unsigned cls;
+
+  if (len < sizeof(struct iphdr) || len < ip->ihl * 4U + 8)
+  {
+    stats->rx[RX_OTHER]++;
+    return;
+  }
+
+  l4 = p + ip->ihl * 4;
+
+  switch (ip->protocol)
+  {
+  case IPPROTO_TCP:
+    {
+      const struct tcphdr *tcp = (const struct tcphdr *)l4;
+
+      /* The flags are beyond the first 8 bytes. */
+      if (len < ip->ihl * 4U + 14)
+        cls = RX_TCP_OTHER;
+      else if (tcp->rst)
+        cls = RX_RST;
+      else if (tcp->syn && tcp->ack)
+        cls = RX_SYNACK;
+      else
+        cls = RX_TCP_OTHER;
+    }
+    break;
+
+  case IPPROTO_ICMP:
+    switch (((const struct icmphdr *)l4)->type)
+    {
+    case ICMP_ECHOREPLY:    cls = RX_ICMP_ECHOREPLY; break;
+    case ICMP_DEST_UNREACH: cls = RX_ICMP_UNREACH; break;
+    default:                cls = RX_ICMP_OTHER;
+    }
+    break;
+
+  case IPPROTO_UDP:
+    cls = RX_UDP;
+    break;
+
+  default:
+    cls = RX_OTHER;
+  }
+
+  /* NOTE: Only this thread writes these counters. */
+  stats->rx[cls]++;
+}
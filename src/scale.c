@@ -0,0 +1,299 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file scale.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* NOTE: Each step forks its own workers (the parent only watches), all
+         of them starting at the same instant and sending for the same
+         time, as fast as they can. The CPU time of the workers comes
+         from getrusage(): the system time is the time in the kernel,
+         mostly the send system calls. */
+
+/* Workers start this long after the fork of the first one (ns). */
+#define SCALE_START_NS    50000000ULL
+
+/* The clock is read once every 64 packets. */
+#define SCALE_CHECK_MASK  63
+
+static const struct
+{
+  const char *name;
+  int        backend;
+  int        io_uring;
+} backends[] =
+{
+  { "null",   BACKEND_NULL,   FALSE },
+  { "pcap",   BACKEND_PCAP,   FALSE },    /* to /dev/null. */
+  { "raw",    BACKEND_RAW,    FALSE },
+  { "uring",  BACKEND_RAW,    TRUE  },    /* raw, through io_uring. */
+  { "packet", BACKEND_PACKET, FALSE }     /* --iface only. */
+};
+
+static int  scale_step(struct config_options * const __restrict__, const char *, unsigned, unsigned, double *);
+static void scale_worker(struct config_options * const __restrict__, unsigned, unsigned, unsigned,
+                         const struct timespec *, double) __attribute__((noreturn));
+
+/**
+ * Runs the worker scaling benchmark: the selected module (or the T50
+ * mix) with 1, 2, 4 ... N workers, on each backend.
+ *
+ * @param co Pointer to T50 configuration structure (co->scale: N;
+ *           co->duration: time of each step).
+ * @return EXIT_SUCCESS or EXIT_FAILURE.
+ */
+int run_scale(struct config_options * const __restrict__ co)
+{
+  unsigned b, n, ngroups;
+  long cpus;
+  double pps1;
+  int failed = FALSE;
+
+  if (!config_targets(co))
+    return EXIT_FAILURE;
+
+  if (co->ip.protocol == IPPROTO_T50 && !get_mix_length())
+    config_mix(co->mix);
+
+  alloc_packet(INITIAL_PACKET_SIZE);
+
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  printf(PACKAGE " " VERSION " scaling benchmark: %s, %.1f s per step, up to %u workers on %ld CPUs.\n\n"
+         "%-7s %7s %12s %12s %10s %11s %6s %8s %7s\n",
+         co->ip.protocol == IPPROTO_T50 ? "T50 mix" : mod_table[co->ip.protoname].acronym,
+         co->duration, co->scale, cpus,
+         "backend", "workers", "packets/s", "pps/worker", "efficiency", "CPU ns/pkt", "sys %",
+         "EAGAIN %", "wait %");
+
+  for (b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+  {
+    if (backends[b].backend == BACKEND_PACKET && !co->iface)
+      continue;
+
+    if (getuid() && !IS_OFFLINE_BACKEND(backends[b].backend))
+    {
+      printf("%-7s (skipped: root needed)\n", backends[b].name);
+      continue;
+    }
+
+    co->backend = backends[b].backend;
+    co->io_uring = backends[b].io_uring;
+    co->pcap = "/dev/null";
+    if (co->io_uring)
+    {
+      if (!co->uring_depth)
+        co->uring_depth = URING_DEFAULT_DEPTH;
+      if (!co->uring_batch)
+        co->uring_batch = URING_DEFAULT_BATCH;
+    }
+
+    ngroups = create_socket(co);
+    config_stats(ngroups);
+
+    /* 1, 2, 4 ... and N. */
+    for (pps1 = 0.0, n = 1; ; n = (n * 2 < co->scale) ? n * 2 : co->scale)
+    {
+      if (!scale_step(co, backends[b].name, n, ngroups, &pps1))
+      {
+        printf("%-7s %7u (failed: a worker didn't finish)\n", backends[b].name, n);
+        failed = TRUE;
+        break;
+      }
+
+      if (n == co->scale)
+        break;
+    }
+
+    munmap(stats, sizeof(struct t50_stats));
+    close_socket();
+  }
+
+  close_targets();
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Runs a step: 'n' workers on the backend 'name'. 'pps1' is the rate of a single worker
+   (set on the first step). Returns FALSE if a worker failed. */
+static int scale_step(struct config_options * const __restrict__ co,
+                      const char *name,
+                      unsigned n,
+                      unsigned ngroups,
+                      double *pps1)
+{
+  struct timespec start;
+  struct rusage r0, r1;
+  pid_t pids[STATS_MAX_WORKERS];
+  uint64_t packets = 0, full = 0, full_ns = 0, drops = 0, errors = 0;
+  double pps, cpu, sys;
+  unsigned w, started;
+  int status, ok = TRUE;
+
+  memset(stats->worker, 0, sizeof(stats->worker));
+  stats->nworkers = n;
+
+  getrusage(RUSAGE_CHILDREN, &r0);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  start.tv_nsec += SCALE_START_NS;
+  if (start.tv_nsec >= 1000000000L)
+  {
+    start.tv_sec++;
+    start.tv_nsec -= 1000000000L;
+  }
+
+  fflush(stdout);
+
+  for (started = 0; started < n; started++)
+  {
+    if ((pids[started] = fork()) == -1)
+    {
+      ok = FALSE;
+      break;
+    }
+
+    if (IS_CHILD_PID(pids[started]))
+      scale_worker(co, started, n, ngroups, &start, co->duration);
+  }
+
+  for (w = 0; w < started; w++)
+    if (waitpid(pids[w], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+      ok = FALSE;
+
+  if (!ok)
+    return FALSE;
+
+  getrusage(RUSAGE_CHILDREN, &r1);
+
+  for (w = 0; w < n; w++)
+  {
+    packets += stats->worker[w].packets;
+    full    += stats->worker[w].full;
+    full_ns += stats->worker[w].full_ns;
+    drops   += stats->worker[w].drops;
+    errors  += stats->worker[w].errors;
+  }
+
+  cpu = (r1.ru_utime.tv_sec - r0.ru_utime.tv_sec) + (r1.ru_utime.tv_usec - r0.ru_utime.tv_usec) / 1e6;
+  sys = (r1.ru_stime.tv_sec - r0.ru_stime.tv_sec) + (r1.ru_stime.tv_usec - r0.ru_stime.tv_usec) / 1e6;
+  cpu += sys;
+
+  pps = packets / co->duration;
+  if (n == 1)
+    *pps1 = pps;
+
+  printf("%-7s %7u %12.0f %12.0f %9.1f%% %11.1f %6.1f %8.3f %7.1f\n",
+         name, n, pps, pps / n,
+         *pps1 > 0.0 ? 100.0 * pps / (n * *pps1) : 0.0,
+         packets ? cpu * 1e9 / packets : 0.0,
+         cpu > 0.0 ? 100.0 * sys / cpu : 0.0,
+         packets + drops ? 100.0 * full / (packets + drops) : 0.0,
+         100.0 * full_ns / (n * co->duration * 1e9));
+
+  if (errors)
+    printf("%-7s %7s (%" PRIu64 " packets not sent: errors)\n", "", "", errors);
+
+  return TRUE;
+}
+
+/* A worker: sends as fast as it can, from 'start' for 'duration'
+   seconds, and exits. */
+static void scale_worker(struct config_options * const __restrict__ co,
+                         unsigned worker,
+                         unsigned nworkers,
+                         unsigned ngroups,
+                         const struct timespec *start,
+                         double duration)
+{
+  modules_table_t *ptbl;
+  struct timespec now;
+  uint64_t end;
+  unsigned count = 0;
+  in_addr_t daddr;
+  size_t size;
+  int proto, r;
+
+  if (nworkers > 1)
+  {
+    split_targets(worker, nworkers);
+    if (co->ip.protocol == IPPROTO_T50)
+      split_mix(worker, nworkers);
+  }
+  split_stats(worker, nworkers);
+  select_socket(worker % ngroups);
+
+  if (co->seeded)
+    SRANDOM_SEED(co->seed + worker * 0x9e3779b97f4a7c15ULL);
+  else
+    SRANDOM();
+
+  ptbl = mod_table;
+  if ((proto = co->ip.protocol) != IPPROTO_T50)
+    ptbl += co->ip.protoname;
+  else
+    ptbl = next_module();
+
+  if ((daddr = get_fixed_target()) != INADDR_ANY)
+    co->ip.daddr = daddr;
+
+  end = start->tv_sec * 1000000000ULL + start->tv_nsec + (uint64_t)(duration * 1e9);
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, start, NULL) == EINTR)
+    ;
+
+  for (;;)
+  {
+    if (daddr == INADDR_ANY)
+      co->ip.daddr = next_target();
+    co->ip.protocol = ptbl->protocol_id;
+
+    ptbl->func(co, &size);
+
+    if ((r = send_packet(packet, size, co)) == SEND_OK)
+    {
+      wstats->packets++;
+      wstats->bytes += size;
+    }
+    else if (r == SEND_DROPPED)
+      wstats->drops++;
+    else
+      wstats->errors++;
+
+    if (proto == IPPROTO_T50)
+      ptbl = next_module();
+
+    /* Time is over? */
+    if (!(++count & SCALE_CHECK_MASK))
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (now.tv_sec * 1000000000ULL + now.tv_nsec >= end)
+        break;
+    }
+  }
+
+  flush_socket();
+
+  _exit(EXIT_SUCCESS);
+}
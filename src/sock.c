@@ -21,26 +21,373 @@
 
 #include <common.h>
 #include <poll.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/if_packet.h>
+#include <linux/virtio_net.h>
+#include <linux/net_tstamp.h>
 
-/* Maximum number of tries to send the packet. */
-#define MAX_SENDTO_RETRYS  10
+/* NOTE: Older headers don't have UDP segmentation (Linux 6.2). */
+#ifndef VIRTIO_NET_HDR_GSO_UDP_L4
+  #define VIRTIO_NET_HDR_GSO_UDP_L4 5
+#endif
 
-/* Polling timeout is 1 second. */
-#define TIMEOUT 1000
+/* Send buffer wanted (SO_SNDBUF). */
+#define SNDBUF_MAX   10485760
+
+/* --on-full=wait: poll() timeout (ms) adapts between these. */
+#define WAIT_MIN_MS  1
+#define WAIT_MAX_MS  1000
+
+/* --on-full=wait: naps (us) while the device queue is full (ENOBUFS). */
+#define WAIT_MIN_US  50
+#define WAIT_MAX_US  1000
+
+/* --on-full=spin: longest backoff (CPU relax instructions). */
+#define SPIN_MAX     1024
+
+/* The socket buffer or the device queue is full. */
+#define IS_SEND_FULL(e)  ((e) == EAGAIN || (e) == EWOULDBLOCK || (e) == ENOBUFS)
+
+#if defined(__i386__) || defined(__x86_64__)
+  #define cpu_relax() __builtin_ia32_pause()
+#else
+  #define cpu_relax() __asm__ __volatile__ ("" : : : "memory")
+#endif
 
 /* Initialized for error condition, just in case! */
-static socket_t fd = -1;
+static socket_t fd = -1;    /* Socket used by this process. */
+
+/* One socket per interface (or a single one, routed by the kernel). */
+static struct iface
+{
+  socket_t           fd;
+  char               *name;     /* NULL if not bound to an interface. */
+  int                ifindex;
+
+  /* BACKEND_PACKET: the frame header and the link layer address. */
+  uint8_t            l2hdr[L2_MAX_HEADER];
+  size_t             l2len;
+  struct sockaddr_ll sll;
+
+  /* --txtime: the clock of the qdisc, and its offset from ours. */
+  clockid_t          txclock;
+  int64_t            txoffset;
+} ifaces[STATS_MAX_GROUPS];
+static unsigned nifaces = 0;
+static struct iface *cur = ifaces;  /* Interface used by this process. */
+
+static int backend = BACKEND_RAW;
+static int use_uring = FALSE;   /* Asynchronous sends (io_uring). */
+static int on_full = ON_FULL_WAIT;
+static int wait_ms = WAIT_MIN_MS;
+static long wait_us = WAIT_MIN_US;
+static int vnet = FALSE;        /* virtio header on each frame (--offload). */
+static int txtime = FALSE;      /* kernel pacing (SO_TXTIME). */
+static int connected = FALSE;   /* Raw sockets connect()ed to a fixed destination. */
+
+static socket_t open_socket(const struct iface *, int);
+static int      tune_sndbuf(socket_t, int *);
+static void     tune_socket(socket_t, const struct iface *, int);
+static unsigned get_tx_queues(const char *);
+static int      get_xps_map(const char *, unsigned, cpu_set_t *);
+static void     set_vnet_header(struct virtio_net_hdr *);
+static void     config_txtime(struct iface *);
+static int      wait_for_io(int);
+static int      socket_send(int, const struct msghdr *);
+static int      socket_full(int, const struct msghdr *) __attribute__((noinline, cold));
+
+/**
+ * Creates the sending sockets.
+ *
+ * Without --iface, a single raw socket is created and the kernel routes
+ * each packet by its destination. Otherwise there is one raw socket
+ * bound (SO_BINDTODEVICE) to each interface on the list.
+ *
+ * The packet backend (--backend packet) uses AF_PACKET sockets instead:
+ * the frames are sent straight to the interface, with a fixed Ethernet
+ * header (see config_l2()), skipping routing and neighbour lookups.
+ *
+ * If there is a single destination (hostid == 0), raw sockets are
+ * connect()ed to it, so each packet is sent without an address.
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @return Number of interfaces (worker groups).
+ */
+unsigned create_socket(const struct config_options *const __restrict__ co)
+{
+  char *s, *tok, *saveptr;
+
+  backend = co->backend;
+  on_full = co->on_full;
+  vnet = co->offload;
+  txtime = co->txtime;
+
+  if ((use_uring = co->io_uring))
+    config_uring(co->uring_depth, co->uring_batch);
+
+  /* NOTE: The packet backend has its link layer destination fixed already. */
+  connected = (backend == BACKEND_RAW && get_fixed_target() != INADDR_ANY);
+
+  /* No socket: packets are discarded or written to a file. */
+  if (IS_OFFLINE_BACKEND(backend))
+  {
+    if (backend == BACKEND_PCAP)
+      open_pcap_output(co->pcap);
+    return nifaces = 1;
+  }
+
+  if (!co->iface)
+  {
+    ifaces[0].fd = fd = open_socket(&ifaces[0], TRUE);
+    return nifaces = 1;
+  }
+
+  /* strtok_r() changes the string. */
+  if ((s = strdup(co->iface)) == NULL)
+    fatal_error("Cannot allocate memory to parse the interfaces list.");
+
+  for (tok = strtok_r(s, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr))
+  {
+    if (nifaces == STATS_MAX_GROUPS)
+      fatal_error("Too many interfaces (max. %u).", STATS_MAX_GROUPS);
+
+    if (!(ifaces[nifaces].ifindex = if_nametoindex(tok)))
+      fatal_error("Unknown interface '%s'.", tok);
+
+    ifaces[nifaces].name = tok;   /* NOTE: 's' is never freed. */
+
+    if (backend == BACKEND_PACKET)
+    {
+      ifaces[nifaces].l2len = config_l2(co, tok, ifaces[nifaces].l2hdr);
+
+      ifaces[nifaces].sll.sll_family   = AF_PACKET;
+      ifaces[nifaces].sll.sll_ifindex  = ifaces[nifaces].ifindex;
+      ifaces[nifaces].sll.sll_protocol = *(uint16_t *)(ifaces[nifaces].l2hdr + 2 * ETH_ALEN);
+      ifaces[nifaces].sll.sll_halen    = ETH_ALEN;
+      memcpy(ifaces[nifaces].sll.sll_addr, ifaces[nifaces].l2hdr, ETH_ALEN);
+    }
+
+    if (txtime)
+      config_txtime(&ifaces[nifaces]);
+
+    ifaces[nifaces].fd = open_socket(&ifaces[nifaces], TRUE);
+    nifaces++;
+  }
+
+  if (!nifaces)
+    fatal_error("Empty interfaces list.");
+
+  fd = ifaces[0].fd;
+
+  return nifaces;
+}
+
+/**
+ * Selects the socket (interface) used by this process.
+ *
+ * @param group Interface index on --iface list.
+ */
+void select_socket(unsigned group)
+{
+  assert(group < nifaces);
+
+  cur = &ifaces[group];
+  fd = cur->fd;
+}
+
+/**
+ * Puts the destination on each packet again, after the destinations
+ * changed (--control): this worker gets a socket of its own, not
+ * connect()ed.
+ *
+ * NOTE: connect() also fixed the source address the kernel routes from
+ *       (127.0.0.1 can't go anywhere else), so the old socket can't be
+ *       used. It can't be disconnected either: it is shared by the
+ *       workers, which take the change one by one.
+ */
+void unconnect_socket(void)
+{
+  if (!connected)
+    return;
+
+  connected = FALSE;
+
+  /* Sends queued on the old socket (--io-uring) go first. */
+  flush_socket();
+
+  close(cur->fd);
+  cur->fd = fd = open_socket(cur, FALSE);
+}
 
-static int wait_for_io(int);
-static int socket_send(int, struct sockaddr_in *, void *, size_t);
+/**
+ * Gets the name of an interface on --iface list.
+ *
+ * @param group Interface index on --iface list.
+ * @return Interface name or NULL (not bound to an interface).
+ */
+const char *get_iface_name(unsigned group)
+{
+  return group < nifaces ? ifaces[group].name : NULL;
+}
+
+/**
+ * Gets the index of an interface on --iface list.
+ *
+ * @param group Interface index on --iface list.
+ * @return Interface index or 0 (not bound to an interface).
+ */
+int get_iface_index(unsigned group)
+{
+  return group < nifaces ? ifaces[group].ifindex : 0;
+}
 
 /**
- * Creates and configure a raw socket.
+ * Gives this worker its own packet socket, on its own TX queue.
+ *
+ * Packet sockets send through the TX queue the kernel maps to the sending
+ * CPU by the XPS map (/sys/class/net/IFACE/queues/tx-N/xps_cpus). So each
+ * worker is pinned to a CPU of a distinct queue: the worker 'rank' of the
+ * interface gets queue 'rank % queues', and the CPUs of a queue are taken
+ * in turn. Each queue has its own lock; workers no longer contend for a
+ * single one.
+ *
+ * If no allowed CPU maps to the queue, the worker takes an allowed CPU
+ * anyway and its queue is the one of that CPU.
+ *
+ * NOTE: Without XPS the queue is up to the driver (often the CPU modulo
+ *       the number of queues, but not always): the workers are spread
+ *       over the CPUs the same way, and their queue is unknown (-1).
+ *
+ * @param rank Index of this worker among the workers of its interface.
  */
-void create_socket(void)
+void bind_tx_queue(unsigned rank)
+{
+  cpu_set_t allowed, map, *maps;
+  unsigned nqueues, q, i, k, n;
+  int cpu = -1, ncpus, xps = FALSE;
+
+  assert(cur->name != NULL);
+
+  nqueues = get_tx_queues(cur->name);
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1 ||
+      (maps = calloc(nqueues, sizeof(cpu_set_t))) == NULL)
+    fatal_error("Cannot get the CPUs for the TX queues of '%s'.", cur->name);
+
+  /* CPUs of each queue. */
+  for (q = 0; q < nqueues; q++)
+    xps |= get_xps_map(cur->name, q, &maps[q]);
+
+  ncpus = CPU_COUNT(&allowed);
+
+  if (!xps)
+    for (i = 0; i < CPU_SETSIZE; i++)
+      if (CPU_ISSET(i, &allowed))
+        CPU_SET(i, &maps[i % nqueues]);
+
+  /* The k-th allowed CPU of the queue. */
+  q = rank % nqueues;
+  CPU_AND(&map, &maps[q], &allowed);
+  if ((n = CPU_COUNT(&map)) != 0)
+    for (k = (rank / nqueues) % n, i = 0; i < CPU_SETSIZE; i++)
+      if (CPU_ISSET(i, &map) && !k--)
+      {
+        cpu = i;
+        break;
+      }
+
+  /* No CPU for this queue: any allowed CPU, and its queue. */
+  if (cpu == -1 && ncpus)
+  {
+    for (k = rank % ncpus, i = 0; i < CPU_SETSIZE; i++)
+      if (CPU_ISSET(i, &allowed) && !k--)
+      {
+        cpu = i;
+        break;
+      }
+
+    for (q = 0; q < nqueues && !CPU_ISSET(cpu, &maps[q]); q++)
+      ;
+  }
+
+  free(maps);
+
+  if (cpu != -1)
+  {
+    CPU_ZERO(&map);
+    CPU_SET(cpu, &map);
+    if (sched_setaffinity(0, sizeof(map), &map) == -1)
+      fatal_error("Cannot pin the worker to CPU %d.", cpu);
+  }
+
+  /* A socket of its own. */
+  close(cur->fd);
+  cur->fd = fd = open_socket(cur, FALSE);
+
+  wstats->txq = (xps && q < nqueues) ? (int)q : -1;
+  wstats->cpu = cpu;
+}
+
+/* Number of TX queues of an interface. */
+static unsigned get_tx_queues(const char *iface)
+{
+  char path[64];
+  DIR *d;
+  struct dirent *e;
+  unsigned n = 0;
+
+  snprintf(path, sizeof(path), "/sys/class/net/%s/queues", iface);
+  if ((d = opendir(path)) != NULL)
+  {
+    while ((e = readdir(d)) != NULL)
+      n += !strncmp(e->d_name, "tx-", 3);
+    closedir(d);
+  }
+
+  return n ? n : 1;
+}
+
+/* XPS map of a TX queue (a hex mask, 32 bits per comma separated word). */
+static int get_xps_map(const char *iface, unsigned queue, cpu_set_t *set)
+{
+  char path[80], mask[CPU_SETSIZE / 4 + CPU_SETSIZE / 32 + 2];
+  FILE *f;
+  size_t len;
+  unsigned cpu = 0, digit, b;
+
+  CPU_ZERO(set);
+
+  snprintf(path, sizeof(path), "/sys/class/net/%s/queues/tx-%u/xps_cpus", iface, queue);
+  if ((f = fopen(path, "r")) == NULL)
+    return FALSE;
+
+  if (!fgets(mask, sizeof(mask), f))
+    *mask = '\0';
+  fclose(f);
+
+  /* From the least significant digit. */
+  for (len = strcspn(mask, "\n"); len--; )
+  {
+    if (mask[len] == ',')
+      continue;
+
+    digit = (mask[len] <= '9') ? mask[len] - '0' : (mask[len] | 0x20) - 'a' + 10;
+    for (b = 0; b < 4; b++, cpu++)
+      if ((digit >> b & 1) && cpu < CPU_SETSIZE)
+        CPU_SET(cpu, set);
+  }
+
+  return CPU_COUNT(set) != 0;
+}
+
+/* Creates and configure a raw socket, bound to the interface (if any),
+   or a packet socket (BACKEND_PACKET). The setup is shown if 'report'. */
+static socket_t open_socket(const struct iface *ifc, int report)
 {
-  socklen_t len;
-  unsigned i, n = 1;  /* FIXME: if I indended, someday, to port
+  socket_t fd;
+  unsigned n = 1;  /* FIXME: if I indended, someday, to port
                                 this code to Solaris, I must use
                                 char to n and set to '1'. 
 
@@ -51,7 +398,9 @@ void create_socket(void)
      NOTE: Protocol must be IPPROTO_RAW on Linux.
            On FreeBSD, if we use 0 IPPROTO_RAW is assumed by default,
            but on linux will cause an error. */
-  if ((fd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) == -1)
+  /* NOTE: Packet sockets with protocol 0 receive nothing. That's what we want. */
+  if ((fd = (backend == BACKEND_PACKET) ? socket(AF_PACKET, SOCK_RAW, 0) :
+                                          socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) == -1)
   {
     #ifdef __HAVE_DEBUG__
     fatal_error("Error opening raw socket: \"%s\"", strerror(errno));
@@ -70,7 +419,8 @@ void create_socket(void)
     #endif
   }
 
-  if (fcntl(fd, F_SETFL, flag | O_NONBLOCK) == -1)
+  /* NOTE: io_uring waits for room in the socket by itself, if it's blocking. */
+  if (!use_uring && fcntl(fd, F_SETFL, flag | O_NONBLOCK) == -1)
   {
     #ifdef __HAVE_DEBUG__
     fatal_error("Error setting socket to non-blocking mode: \"%s\"", strerror(errno));
@@ -82,7 +432,7 @@ void create_socket(void)
   /* Setting IP_HDRINCL. */
   /* NOTE: We will provide the IP header, but enabling this option, on linux,
            still makes the kernel calculates the checksum and total_length. */
-  if ( setsockopt(fd, IPPROTO_IP, IP_HDRINCL, &n, sizeof(n)) == -1 )
+  if ( backend == BACKEND_RAW && setsockopt(fd, IPPROTO_IP, IP_HDRINCL, &n, sizeof(n)) == -1 )
   {
     #ifdef __HAVE_DEBUG__
     fatal_error("Error setting socket options: \"%s\"", strerror(errno));
@@ -91,42 +441,36 @@ void create_socket(void)
     #endif
   }
 
-  /* Taken from libdnet by Dug Song. */
-#ifdef SO_SNDBUF
-  /* Getting SO_SNDBUF. */
-  len = sizeof(n);
-
-  if ( getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &n, &len) == -1 )
+  /* Each packet will carry its transmit time, for the qdisc. */
+  if (txtime)
   {
-    #ifdef __HAVE_DEBUG__
-    fatal_error("Error getting socket buffer: \"%s\"", strerror(errno));
-    #else
-    fatal_error("Error getting socket buffer");
-    #endif
-  }
+    struct sock_txtime st = { .clockid = ifc->txclock, .flags = 0 };
 
-  /* Setting the maximum SO_SNDBUF in bytes.
-   * 128      =  1 Kib
-   * 10485760 = 80 Mib */
-  for (i = n + 128; i < 10485760; i += 128)
-  {
-    /* Setting SO_SNDBUF. */
-    if ( setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &i, sizeof(unsigned int)) == -1 )
+    if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &st, sizeof(st)) == -1)
     {
-      if (errno == ENOBUFS)
-        break;
-
       #ifdef __HAVE_DEBUG__
-      fatal_error("Error setting socket buffer: \"%s\"", strerror(errno));
+      fatal_error("Error enabling SO_TXTIME: \"%s\"", strerror(errno));
       #else
-      fatal_error("Error setting socket buffer");
+      fatal_error("Error enabling SO_TXTIME");
       #endif
     }
   }
-#endif /* SO_SNDBUF */
+
+  /* Every frame will carry a virtio header: offloaded checksums and GSO. */
+  if (vnet && setsockopt(fd, SOL_PACKET, PACKET_VNET_HDR, &n, sizeof(n)) == -1)
+  {
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error enabling checksum offload (PACKET_VNET_HDR): \"%s\"", strerror(errno));
+    #else
+    fatal_error("Error enabling checksum offload (PACKET_VNET_HDR)");
+    #endif
+  }
+
+  /* Send buffer, qdisc bypass. */
+  tune_socket(fd, ifc, report);
 
 #ifdef SO_BROADCAST
-  if ( setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &n, sizeof(n)) == -1 )
+  if ( backend == BACKEND_RAW && setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &n, sizeof(n)) == -1 )
   {
     #ifdef __HAVE_DEBUG__
     fatal_error("error setting socket broadcast flag: \"%s\"", strerror(errno));
@@ -147,6 +491,182 @@ void create_socket(void)
     #endif
   }
 #endif /* SO_PRIORITY */
+
+  /* Packets leave through this interface, whatever the routing table says.
+     NOTE: Packet sockets name the interface on each sendmsg(). */
+  if (backend == BACKEND_RAW && ifc->name &&
+      setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, ifc->name, strlen(ifc->name) + 1) == -1)
+  {
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error binding socket to interface '%s': \"%s\"", ifc->name, strerror(errno));
+    #else
+    fatal_error("Error binding socket to interface '%s'", ifc->name);
+    #endif
+  }
+
+  /* Fixed destination: the address goes once, here, instead of on each packet. */
+  if (connected)
+  {
+    struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = get_fixed_target() };
+
+    if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1)
+    {
+      #ifdef __HAVE_DEBUG__
+      fatal_error("Error connecting socket: \"%s\"", strerror(errno));
+      #else
+      fatal_error("Error connecting socket");
+      #endif
+    }
+  }
+
+  return fd;
+}
+
+/* The virtio header of a frame (PACKET_VNET_HDR): where the checksum goes
+   and, for GSO packets, how to segment them. Offsets are from the start of
+   the frame. NOTE: Fields are in host byte order. */
+static void set_vnet_header(struct virtio_net_hdr *vh)
+{
+  memset(vh, 0, sizeof(*vh));
+
+  if (!pkt_offload.csum_start)
+    return;
+
+  vh->flags       = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+  vh->csum_start  = cur->l2len + pkt_offload.csum_start;
+  vh->csum_offset = pkt_offload.csum_offset;
+
+  if (pkt_offload.segs > 1)
+  {
+    vh->gso_type = (pkt_offload.protocol == IPPROTO_TCP) ?
+                     VIRTIO_NET_HDR_GSO_TCPV4 : VIRTIO_NET_HDR_GSO_UDP_L4;
+    vh->gso_size = pkt_offload.gso_size;
+    vh->hdr_len  = cur->l2len + pkt_offload.hdr_len;
+  }
+}
+
+/* Kernel pacing needs a qdisc which holds packets until their transmit
+   time: etf (its own clock, usually CLOCK_TAI) or fq (CLOCK_MONOTONIC).
+   If there is neither, the operator installs one: the qdiscs aren't
+   ours to replace (a root mq, with a child per TX queue, would be gone
+   for good). */
+static void config_txtime(struct iface *ifc)
+{
+  struct timespec mono, other;
+  int clockid;
+  const char *kind = "etf";
+
+  if ((clockid = get_etf_clockid(ifc->ifindex)) == -1)
+  {
+    kind = "fq";
+    clockid = CLOCK_MONOTONIC;
+
+    if (!has_qdisc(ifc->ifindex, "fq"))
+      fatal_error("--txtime needs an fq or etf qdisc on '%s'. Install one with:\n"
+                  "  tc qdisc replace dev %s root fq", ifc->name, ifc->name);
+  }
+
+  ifc->txclock = clockid;
+  ifc->txoffset = 0;
+
+  /* Our schedule is on CLOCK_MONOTONIC. */
+  if (clockid != CLOCK_MONOTONIC)
+  {
+    if (clock_gettime(clockid, &other) == -1)
+      fatal_error("The clock of the etf qdisc on '%s' is not supported.", ifc->name);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    ifc->txoffset = (other.tv_sec - mono.tv_sec) * 1000000000LL + other.tv_nsec - mono.tv_nsec;
+  }
+
+  printf("Kernel pacing on %s: %s qdisc, clock %s.\n", ifc->name, kind,
+         clockid == CLOCK_MONOTONIC ? "MONOTONIC" :
+         clockid == CLOCK_TAI ? "TAI" :
+         clockid == CLOCK_REALTIME ? "REALTIME" : "other");
+}
+
+/* Tunes a new socket and tells how it's set up: send buffer size and,
+   on an interface, its TX queue length and qdisc. This runs once per
+   interface, before the workers are created. */
+static void tune_socket(socket_t fd, const struct iface *ifc, int report)
+{
+  struct ifreq ifr;
+  char qdisc[IFNAMSIZ];
+  int forced, bypass = FALSE, n = 1;
+  unsigned sndbuf;
+
+  sndbuf = tune_sndbuf(fd, &forced);
+
+#ifdef PACKET_QDISC_BYPASS
+  /* Frames go straight to the driver: no qdisc, no qdisc lock.
+     NOTE: Not fatal. Older kernels don't have it.
+     NOTE: Kernel pacing needs the qdisc. */
+  if (backend == BACKEND_PACKET && !txtime)
+    bypass = setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &n, sizeof(n)) == 0;
+#endif
+
+  if (!report)
+    return;
+
+  if (!ifc->name)
+  {
+    printf("Send buffer: %u bytes%s.\n", sndbuf, forced ? " (forced)" : "");
+    return;
+  }
+
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifc->name, IFNAMSIZ - 1);
+  if (ioctl(fd, SIOCGIFTXQLEN, &ifr) == -1)
+    ifr.ifr_qlen = -1;
+
+  if (!get_qdisc_kind(ifc->ifindex, qdisc, sizeof(qdisc)))
+    strcpy(qdisc, "unknown");
+
+  printf("Socket on %s: send buffer %u bytes%s, txqueuelen %d, qdisc %s%s.\n",
+         ifc->name, sndbuf, forced ? " (forced)" : "", ifr.ifr_qlen, qdisc,
+         bypass ? " (bypassed)" : "");
+}
+
+/* Grows the send buffer up to SNDBUF_MAX. With CAP_NET_ADMIN, SO_SNDBUFFORCE
+   ignores net.core.wmem_max. Otherwise, Linux caps SO_SNDBUF at wmem_max by
+   itself (no error): a single setsockopt() gets the largest one allowed.
+   NOTE: This used to be a setsockopt() every 128 bytes: tens of thousands
+         of system calls per socket. */
+static int tune_sndbuf(socket_t fd, int *forced)
+{
+  socklen_t len = sizeof(int);
+  int n = SNDBUF_MAX;
+
+  *forced = FALSE;
+
+#ifdef SO_SNDBUFFORCE
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &n, sizeof(n)) == 0)
+    *forced = TRUE;
+  else
+#endif
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &n, sizeof(n)) == -1)
+  {
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error setting socket buffer: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Error setting socket buffer");
+    #endif
+  }
+
+  /* What we've got (Linux doubles it, for bookkeeping overhead). */
+  if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &n, &len) == -1)
+    n = 0;
+
+  return n;
+}
+
+/**
+ * Waits for the packets still in flight (asynchronous sends).
+ */
+void flush_socket(void)
+{
+  if (use_uring)
+    uring_flush();
 }
 
 /**
@@ -154,14 +674,26 @@ void create_socket(void)
  */
 void close_socket(void)
 {
-  /* Close only if the descriptor is valid. */
-  if (fd > 0)
+  unsigned i;
+
+  close_uring();
+  close_pcap_output();
+
+  for (i = 0; i < nifaces; i++)
   {
-    close(fd);
+    /* Close only if the descriptor is valid. */
+    if (ifaces[i].fd > 0)
+    {
+      close(ifaces[i].fd);
 
-    /* Added to avoid multiple socket closing. */
-    fd = -1;
+      /* Added to avoid multiple socket closing. */
+      ifaces[i].fd = -1;
+    }
   }
+
+  /* create_socket() may be called again (benchmarks). */
+  nifaces = 0;
+  fd = -1;
 }
 
 /**
@@ -170,80 +702,219 @@ void close_socket(void)
  * @param buffer Pointer to the packet buffer.
  * @param size Size of the buffer.
  * @param co Pointer to configurations for T50.
- * @return TRUE (success) or FALSE (error).
+ * @return SEND_OK, SEND_DROPPED (the socket was full, --on-full=drop)
+ *         or SEND_ERROR.
  */
 int send_packet(const void *const buffer,
                 size_t size,
                 const struct config_options *const __restrict__ co)
 {
-  struct sockaddr_in sin =
+  struct sockaddr_in sin;
+  struct virtio_net_hdr vh;
+  struct iovec iov[3];
+  struct msghdr msg = { .msg_iov = iov };
+  union
   {
-    .sin_family = AF_INET,
-    .sin_port = htons(IPPORT_RND(co->dest)),
-    /* FIX: s_addr member was missing! */
-    .sin_addr.s_addr = co->ip.daddr    /* Already in network byte order! */
-  };
+    uint8_t        buf[CMSG_SPACE(sizeof(uint64_t))];
+    struct cmsghdr align;
+  } control;
 
   assert(buffer != NULL);
   assert(size > 0);
   assert(co != NULL);
 
+  /* Nothing to send: the packet is just built (and written). */
+  if (unlikely(IS_OFFLINE_BACKEND(backend)))
+    return (backend == BACKEND_NULL || write_pcap(buffer, size)) ? SEND_OK : SEND_ERROR;
+
+  if (backend == BACKEND_PACKET)
+  {
+    /* The frame: Ethernet header (and tags), then the IP packet. */
+    iov[0].iov_base = cur->l2hdr;
+    iov[0].iov_len  = cur->l2len;
+    iov[1].iov_base = (void *)buffer;
+    iov[1].iov_len  = size;
+    msg.msg_iovlen  = 2;
+    msg.msg_name    = &cur->sll;
+    msg.msg_namelen = sizeof(struct sockaddr_ll);
+
+    /* ... preceded by the virtio header, if asked for. */
+    if (vnet)
+    {
+      set_vnet_header(&vh);
+      memmove(iov + 1, iov, 2 * sizeof(struct iovec));
+      iov[0].iov_base = &vh;
+      iov[0].iov_len  = sizeof(vh);
+      msg.msg_iovlen  = 3;
+    }
+  }
+  else
+  {
+    iov[0].iov_base = (void *)buffer;
+    iov[0].iov_len  = size;
+    msg.msg_iovlen  = 1;
+
+    /* NOTE: Raw sockets ignore the port. */
+    if (!connected)
+    {
+      sin.sin_family = AF_INET;
+      sin.sin_port = 0;
+      /* FIX: s_addr member was missing! */
+      /* NOTE: Taken from the packet: replayed packets keep their own. */
+      sin.sin_addr.s_addr = ((const struct iphdr *)buffer)->daddr;   /* Already in network byte order! */
+
+      msg.msg_name    = &sin;
+      msg.msg_namelen = sizeof(sin);
+    }
+  }
+
+  /* Transmit time, on the qdisc's clock. */
+  if (txtime)
+  {
+    struct cmsghdr *cmsg;
+    uint64_t t = get_txtime() + cur->txoffset;
+
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg               = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = SOL_SOCKET;
+    cmsg->cmsg_type    = SCM_TXTIME;
+    cmsg->cmsg_len     = CMSG_LEN(sizeof(uint64_t));
+    memcpy(CMSG_DATA(cmsg), &t, sizeof(t));
+  }
+
+  /* Asynchronous send? The packet is copied, so it's done with.
+     NOTE: GSO packets are sent synchronously: they're big, and a failed
+           one would be hard to take back from the statistics. */
+  if (use_uring && likely(size + cur->l2len + sizeof(vh) <= URING_MAX_PACKET) &&
+      pkt_offload.segs == 1)
+    return uring_send(fd, &msg, size);
+
   /* Use socket_send(), below. */
   /* NOTE: Assume socket_send will not fail. */
-  if (unlikely(socket_send(fd, &sin, (void *)buffer, size) == -1))
+  if (unlikely(socket_send(fd, &msg) == -1))
   {
     if (errno == EPERM)
       fatal_error("Error sending packet (Permission!). Please check your firewall rules (iptables?).");
 
-    return FALSE;
+    /* Dropped (--on-full=drop), or the wait for room was cut short. */
+    if (IS_SEND_FULL(errno))
+      return SEND_DROPPED;
+
+    return SEND_ERROR;
   }
 
-  return TRUE;
+  return SEND_OK;
 }
 
 /*** I realize that EINTR probably never happens, since the signals
      are marked as SA_RESTART, but I want to be sure! */
 
 /* NOTE: Code inspired on Apache httpd source. */
-static int wait_for_io(int fd)
+static int socket_send(int fd, const struct msghdr *msg)
 {
   int r;
-  struct pollfd pfd = { .fd = fd, .events = POLLOUT };
 
-  /* NOTE: Assume poll will not fail. */
-  do {
-    r = poll(&pfd, 1, TIMEOUT);
+  /* Tries to send the packet until it's signal interrupted. */
+  /* NOTE: Assume sendmsg will not fail. */
+  do { 
+    r = sendmsg(fd, msg, MSG_NOSIGNAL);
   } while (unlikely(r == -1 && errno == EINTR));
 
+  /* Socket (or device queue) full? Out of the fast path. */
+  if (unlikely(r == -1 && IS_SEND_FULL(errno)))
+    r = socket_full(fd, msg);
+
   return r;
 }
 
-/* NOTE: Code inspired on Apache httpd source. */
-static int socket_send(int fd, struct sockaddr_in *saddr, void *buffer, size_t size)
+/* The socket buffer (EAGAIN) or the device queue (ENOBUFS) is full:
+   waits, spins or drops the packet, as told by --on-full. A stop (Ctrl+C)
+   or the end of --duration drops it too, however long the wait. */
+static int socket_full(int fd, const struct msghdr *msg)
 {
-  int r;
+  struct timespec t0, t1;
+  unsigned spins = 1, i;
+  int r = -1;
 
-  /* Tries to send the packet until it's signal interrupted. */
-  /* NOTE: Assume sendto will not fail. */
-  do { 
-    r = sendto(fd, buffer, size, MSG_NOSIGNAL, saddr, sizeof(struct sockaddr_in));
-  } while (unlikely(r == -1 && errno == EINTR));
+  /* The IP packet is always the last piece of the message. */
+  PROBE3(send_full,
+         ((const struct iphdr *)msg->msg_iov[msg->msg_iovlen - 1].iov_base)->protocol,
+         msg->msg_iov[msg->msg_iovlen - 1].iov_len, errno);
+
+  wstats->full++;
 
-  /* If it wasn't interrupted, tries to send the packet again. */
-  /* NOTE: Assume previous sendto will not fail. */
-  while (unlikely(r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+  /* Dropped: the caller counts it. */
+  if (on_full == ON_FULL_DROP)
+    return -1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  do
   {
-    do {
-      if ((r = wait_for_io(fd)) == -1)
-        goto socket_send_exit;
-    } while (unlikely(!r));
+    /* NOTE: errno is still the one of the full send. */
+    if (stop_requested || pacing_expired())
+      break;
+
+    if (on_full == ON_FULL_SPIN)
+    {
+      /* Busy polling, with bounded exponential backoff. */
+      for (i = 0; i < spins; i++)
+        cpu_relax();
+      if (spins < SPIN_MAX)
+        spins <<= 1;
+    }
+    else if (errno == ENOBUFS)
+    {
+      /* NOTE: poll() doesn't tell when the device queue has room. */
+      struct timespec ts = { 0, wait_us * 1000 };
+
+      nanosleep(&ts, NULL);
+      if ((wait_us <<= 1) > WAIT_MAX_US)
+        wait_us = WAIT_MAX_US;
+    }
+    else if (wait_for_io(fd) == -1)
+      break;
 
-    /* ... and tries to send again. */
     do {
-      r = sendto(fd, buffer, size, MSG_NOSIGNAL, saddr, sizeof(struct sockaddr_in));
+      r = sendmsg(fd, msg, MSG_NOSIGNAL);
     } while (unlikely(r == -1 && errno == EINTR));
+  } while (r == -1 && IS_SEND_FULL(errno));
+
+  /* The queue has room again: the next wait starts short. */
+  if (r != -1)
+    wait_us = WAIT_MIN_US;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  wstats->full_ns += (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+
+  return r;
+}
+
+/* Waits until the socket is writable. The timeout adapts: it grows while
+   polls time out and shrinks back when the socket drains in time. */
+static int wait_for_io(int fd)
+{
+  int r;
+  struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+  /* NOTE: Assume poll will not fail. */
+  do {
+    r = poll(&pfd, 1, wait_ms);
+  } while (unlikely(r == -1 && errno == EINTR));
+
+  if (!r)
+  {
+    PROBE2(io_stall, fd, wait_ms);
+
+    if ((wait_ms <<= 1) > WAIT_MAX_MS)
+      wait_ms = WAIT_MAX_MS;
+  }
+  else
+  {
+    if ((wait_ms >>= 1) < WAIT_MIN_MS)
+      wait_ms = WAIT_MIN_MS;
   }
 
-socket_send_exit:
   return r;
 }
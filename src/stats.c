@@ -0,0 +1,485 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file stats.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <math.h>
+
+struct t50_stats    *stats = NULL;
+struct worker_stats *wstats = NULL;
+
+static pthread_t             stats_thread;
+static int                   stats_thread_running = 0;
+static volatile sig_atomic_t stats_stop = 0;
+static unsigned              stats_interval = 0;
+static int                   stats_rx = 0;
+static int                   stats_ramp = 0;
+static int                   stats_latency = 0;
+static int                   stats_counters = 0;
+static int                   stats_ifstats = 0;
+static int                   stats_peak = 0;
+
+/* Peak rates, on 1 second windows (--report). */
+static double                peak_pps = 0.0;
+static double                peak_bps = 0.0;
+
+static void *stats_loop(void *);
+static void  show_interval(const struct stats_snapshot *, const struct stats_snapshot *);
+static void  show_step(int, const struct stats_snapshot *, const struct stats_snapshot *);
+static void  show_queues(unsigned, double);
+static void  track_peak(struct stats_snapshot *, const struct stats_snapshot *, double);
+
+/**
+ * Allocates the statistics shared by all processes.
+ *
+ * Must be called before fork().
+ *
+ * @param ngroups Number of worker groups (interfaces).
+ */
+void config_stats(unsigned ngroups)
+{
+  stats = mmap(NULL, sizeof(struct t50_stats), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (stats == MAP_FAILED)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Cannot allocate shared statistics: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Cannot allocate shared statistics");
+    #endif
+
+  stats->nworkers = 1;
+  stats->ngroups = ngroups;
+  wstats = &stats->worker[0];
+
+  /* The run starts now (the pacing clock uses this too). */
+  clock_gettime(CLOCK_MONOTONIC, &stats->start);
+}
+
+/**
+ * Selects the counters used by this process.
+ *
+ * @param worker Index of this process (0 .. nworkers - 1).
+ * @param nworkers Number of processes.
+ */
+void split_stats(unsigned worker, unsigned nworkers)
+{
+  assert(worker < nworkers && nworkers <= STATS_MAX_WORKERS);
+
+  stats->nworkers = nworkers;
+  wstats = &stats->worker[worker];
+}
+
+/**
+ * Starts the thread which shows the statistics periodically and
+ * at each step of a ramp, if needed.
+ *
+ * Used only by the parent process.
+ *
+ * @param co Pointer to T50 configuration structure.
+ */
+void start_stats(const struct config_options *const __restrict__ co)
+{
+  stats_rx = co->rx;
+  stats_latency = co->latency;
+  stats_counters = co->counters;
+  stats_ifstats = co->if_stats;
+  stats_interval = co->stats_interval;
+  stats_ramp = (get_pacing_step(0.0) >= 0);
+  stats_peak = (co->report != NULL);
+
+  if (stats_interval || stats_ramp || stats_peak)
+  {
+    if (pthread_create(&stats_thread, NULL, stats_loop, NULL))
+      fatal_error("Cannot create the statistics thread.");
+
+    stats_thread_running = 1;
+  }
+}
+
+/**
+ * Marks the end of the run and stops the statistics thread (if any).
+ */
+void stop_stats(void)
+{
+  clock_gettime(CLOCK_MONOTONIC, &stats->stop);
+
+  if (stats_thread_running)
+  {
+    stats_stop = 1;
+    pthread_join(stats_thread, NULL);
+    stats_thread_running = 0;
+  }
+}
+
+/**
+ * Sums up the counters of every worker.
+ *
+ * NOTE: Counters are read while workers write them. Aligned 64 bits
+ *       reads aren't torn on the platforms we care about, and a
+ *       snapshot a few packets old is good enough.
+ *
+ * @param snap Pointer to the snapshot.
+ */
+void take_stats_snapshot(struct stats_snapshot *snap)
+{
+  struct timespec now;
+  uint64_t packets, bytes, errors;
+  unsigned i, g, m;
+
+  memset(snap, 0, sizeof(*snap));
+
+  if (stats->stop.tv_sec)
+    now = stats->stop;
+  else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  snap->elapsed = (now.tv_sec - stats->start.tv_sec) +
+                  (now.tv_nsec - stats->start.tv_nsec) / 1e9;
+
+  for (i = 0; i < stats->nworkers; i++)
+  {
+    packets = __atomic_load_n(&stats->worker[i].packets, __ATOMIC_RELAXED);
+    bytes   = __atomic_load_n(&stats->worker[i].bytes, __ATOMIC_RELAXED);
+    errors  = __atomic_load_n(&stats->worker[i].errors, __ATOMIC_RELAXED);
+
+    snap->packets += packets;
+    snap->bytes   += bytes;
+    snap->errors  += errors;
+    snap->full    += __atomic_load_n(&stats->worker[i].full, __ATOMIC_RELAXED);
+    snap->full_ns += __atomic_load_n(&stats->worker[i].full_ns, __ATOMIC_RELAXED);
+    snap->drops   += __atomic_load_n(&stats->worker[i].drops, __ATOMIC_RELAXED);
+
+    g = i % stats->ngroups;
+    snap->group_packets[g] += packets;
+    snap->group_bytes[g]   += bytes;
+    snap->group_errors[g]  += errors;
+
+    for (m = 0; m < STATS_MAX_MODULES; m++)
+    {
+      snap->module_packets[m] += __atomic_load_n(&stats->worker[i].module_packets[m], __ATOMIC_RELAXED);
+      snap->module_bytes[m]   += __atomic_load_n(&stats->worker[i].module_bytes[m], __ATOMIC_RELAXED);
+    }
+  }
+
+  for (i = 0; i < RX_CLASSES; i++)
+    snap->rx_total += snap->rx[i] = __atomic_load_n(&stats->rx[i], __ATOMIC_RELAXED);
+}
+
+/**
+ * Gets the peak rates of the run, on 1 second windows (--report).
+ *
+ * Runs shorter than a window have no peak: it's the average.
+ *
+ * Used only by the parent process, after stop_stats().
+ *
+ * @param pps Peak rate (packets per second).
+ * @param bps Peak rate (bits per second).
+ */
+void get_peak_rates(double *pps, double *bps)
+{
+  struct stats_snapshot s;
+
+  take_stats_snapshot(&s);
+
+  if (s.elapsed > 0.0 && s.elapsed < 1.0)
+  {
+    *pps = s.packets / s.elapsed;
+    *bps = s.bytes * 8 / s.elapsed;
+  }
+  else
+  {
+    *pps = peak_pps;
+    *bps = peak_bps;
+  }
+}
+
+/**
+ * Gets the name of a module counters slot.
+ *
+ * @param m Slot (see module_slot()).
+ * @return Module acronym, or "REPLAY" for the last slot.
+ */
+const char *get_module_slot_name(unsigned m)
+{
+  if (m < STATS_MAX_MODULES - 1 && m < get_number_of_registered_modules())
+    return mod_table[m].acronym;
+
+  return "REPLAY";
+}
+
+/**
+ * Shows the statistics of the whole run.
+ *
+ * Used only by the parent process, after the workers are done.
+ *
+ * @param co Pointer to T50 configuration structure.
+ */
+void show_stats(const struct config_options *const __restrict__ co)
+{
+  struct stats_snapshot s;
+  double t;
+  unsigned g;
+
+  take_stats_snapshot(&s);
+  t = s.elapsed > 0.0 ? s.elapsed : 1e-9;
+
+  printf("\nSent %" PRIu64 " packets (%" PRIu64 " bytes) in %.3f s: %.0f pps, %.2f Mbps",
+         s.packets, s.bytes, s.elapsed, s.packets / t, s.bytes * 8 / t / 1e6);
+  if (s.errors)
+    printf(", %" PRIu64 " errors", s.errors);
+  puts(".");
+
+  /* Backpressure (--on-full). */
+  if (s.full)
+  {
+    printf("Socket full %" PRIu64 " times: ", s.full);
+    /* NOTE: io_uring sends always drop. */
+    if (s.drops)
+      printf("%" PRIu64 " packets dropped (%.2f%%).\n", s.drops,
+             100.0 * s.drops / (s.packets + s.drops));
+    else
+      printf("%s for %.3f s.\n", co->on_full == ON_FULL_SPIN ? "spun" : "waited",
+             s.full_ns / 1e9);
+  }
+
+  /* Per interface, if bound to interfaces. */
+  if (co->iface)
+    for (g = 0; g < stats->ngroups; g++)
+    {
+      printf("  %-12s %" PRIu64 " packets (%" PRIu64 " bytes): %.0f pps, %.2f Mbps",
+             get_iface_name(g), s.group_packets[g], s.group_bytes[g],
+             s.group_packets[g] / t, s.group_bytes[g] * 8 / t / 1e6);
+      if (s.group_errors[g])
+        printf(", %" PRIu64 " errors", s.group_errors[g]);
+      puts(".");
+
+      if (co->tx_queues)
+        show_queues(g, t);
+    }
+
+  if (co->rx)
+  {
+    printf("Received %" PRIu64 " responses (%.1f%%): "
+           "SYN-ACK %" PRIu64 ", RST %" PRIu64 ", TCP other %" PRIu64 ", "
+           "ICMP echo reply %" PRIu64 ", ICMP unreachable %" PRIu64 ", ICMP other %" PRIu64 ", "
+           "UDP %" PRIu64 ", other %" PRIu64 ".\n",
+           s.rx_total, s.packets ? 100.0 * s.rx_total / s.packets : 0.0,
+           s.rx[RX_SYNACK], s.rx[RX_RST], s.rx[RX_TCP_OTHER],
+           s.rx[RX_ICMP_ECHOREPLY], s.rx[RX_ICMP_UNREACH], s.rx[RX_ICMP_OTHER],
+           s.rx[RX_UDP], s.rx[RX_OTHER]);
+
+    if (stats->rx_drops)
+      printf("Receive ring dropped %" PRIu64 " packets.\n", stats->rx_drops);
+  }
+
+  if (co->latency)
+    show_latency(FALSE);
+
+  if (co->counters)
+    show_counters(FALSE);
+
+  if (co->if_stats)
+    show_ifstats(NULL, &s);
+}
+
+/* Per TX queue counters of a group (--tx-queues), with the CPUs
+   of its workers. */
+static void show_queues(unsigned g, double t)
+{
+  uint64_t packets, bytes;
+  unsigned i, j;
+  int q, done[STATS_MAX_WORKERS] = { 0 };
+
+  for (i = g; i < stats->nworkers; i += stats->ngroups)
+  {
+    if (done[i])
+      continue;
+
+    q = stats->worker[i].txq;
+    packets = bytes = 0;
+
+    if (q >= 0)
+      printf("    tx-%-10d", q);
+    else
+      printf("    %-12s ", "unknown");
+
+    /* Every worker on this queue. */
+    for (j = i; j < stats->nworkers; j += stats->ngroups)
+      if (!done[j] && stats->worker[j].txq == q)
+      {
+        packets += stats->worker[j].packets;
+        bytes += stats->worker[j].bytes;
+        done[j] = TRUE;
+      }
+
+    printf("%" PRIu64 " packets (%" PRIu64 " bytes): %.0f pps, %.2f Mbps, CPU",
+           packets, bytes, packets / t, bytes * 8 / t / 1e6);
+
+    for (j = i; j < stats->nworkers; j += stats->ngroups)
+      if (stats->worker[j].txq == q)
+        printf("%s%d", j == i ? " " : ",", stats->worker[j].cpu);
+    puts(".");
+  }
+}
+
+/* The statistics thread: shows what happened on the last interval
+   and on each step of the ramp, and keeps the peak rates. */
+static void *stats_loop(void *arg)
+{
+  struct stats_snapshot prev, cur, step_start, window;
+  struct timespec nap = { 0, 100000000 };   /* 100 ms */
+  double next;
+  int step;
+
+  (void)arg;
+
+  take_stats_snapshot(&prev);
+  step_start = window = prev;
+  step = get_pacing_step(prev.elapsed);
+  next = stats_interval;
+
+  while (!stats_stop)
+  {
+    /* Sleeps in small steps, so stop_stats() doesn't wait too long. */
+    nanosleep(&nap, NULL);
+
+    take_stats_snapshot(&cur);
+
+    if (stats_peak)
+      track_peak(&window, &cur, 1.0);
+
+    if (stats_ramp && get_pacing_step(cur.elapsed) != step)
+    {
+      show_step(step, &step_start, &cur);
+      step_start = cur;
+      step = get_pacing_step(cur.elapsed);
+    }
+
+    if (stats_interval && cur.elapsed >= next)
+    {
+      PROBE3(stats_tick, cur.packets, cur.bytes, cur.errors);
+
+      show_interval(&prev, &cur);
+      report_interval(&prev, &cur);
+      if (stats_latency)
+        show_latency(TRUE);
+      if (stats_counters)
+        show_counters(TRUE);
+      if (stats_ifstats)
+        show_ifstats(&prev, &cur);
+      prev = cur;
+      next += stats_interval;
+    }
+  }
+
+  take_stats_snapshot(&cur);
+
+  /* The last (partial) step. */
+  if (stats_ramp)
+    show_step(step, &step_start, &cur);
+
+  /* The last window, if long enough to mean something. */
+  if (stats_peak)
+    track_peak(&window, &cur, 0.5);
+
+  return NULL;
+}
+
+/* Closes a peak rate window, if it's 'len' seconds long. */
+static void track_peak(struct stats_snapshot *window, const struct stats_snapshot *cur, double len)
+{
+  double t = cur->elapsed - window->elapsed;
+
+  if (t >= len)
+  {
+    peak_pps = fmax(peak_pps, (cur->packets - window->packets) / t);
+    peak_bps = fmax(peak_bps, (cur->bytes - window->bytes) * 8 / t);
+    *window = *cur;
+  }
+}
+
+/* Shows the target and achieved rates of a ramp step. */
+static void show_step(int step, const struct stats_snapshot *start, const struct stats_snapshot *end)
+{
+  double t, target, achieved;
+  int i;
+
+  if ((t = end->elapsed - start->elapsed) <= 0.0)
+    return;
+
+  /* The target may change along the step (linear and sine ramps). */
+  for (target = 0.0, i = 0; i < 16; i++)
+    target += get_target_rate(start->elapsed + t * (i + 0.5) / 16);
+  target /= 16;
+
+  achieved = (end->packets - start->packets) / t;
+
+  printf("[step %4d] %8.1fs - %8.1fs: target %.0f pps, achieved %.0f pps (%.1f%%), %" PRIu64 " errors\n",
+         step, start->elapsed, end->elapsed, target, achieved,
+         target > 0.0 ? 100.0 * achieved / target : 0.0,
+         end->errors - start->errors);
+}
+
+static void show_interval(const struct stats_snapshot *prev, const struct stats_snapshot *cur)
+{
+  double t;
+  uint64_t packets, rx;
+  unsigned g;
+
+  t = cur->elapsed - prev->elapsed;
+  if (t <= 0.0)
+    return;
+
+  packets = cur->packets - prev->packets;
+  rx = cur->rx_total - prev->rx_total;
+
+  printf("[%8.1fs] tx %" PRIu64 " pkts, %.0f pps, %.2f Mbps, %" PRIu64 " errors",
+         cur->elapsed, packets, packets / t,
+         (cur->bytes - prev->bytes) * 8 / t / 1e6,
+         cur->errors - prev->errors);
+
+  if (cur->full != prev->full)
+    printf(", full %" PRIu64 " (%" PRIu64 " dropped, %.3f s waiting)",
+           cur->full - prev->full, cur->drops - prev->drops,
+           (cur->full_ns - prev->full_ns) / 1e9);
+
+  if (stats_rx)
+    printf(" | rx %" PRIu64 " (%.1f%%): syn-ack %" PRIu64 ", rst %" PRIu64
+           ", echo-reply %" PRIu64 ", unreach %" PRIu64,
+           rx, packets ? 100.0 * rx / packets : 0.0,
+           cur->rx[RX_SYNACK] - prev->rx[RX_SYNACK],
+           cur->rx[RX_RST] - prev->rx[RX_RST],
+           cur->rx[RX_ICMP_ECHOREPLY] - prev->rx[RX_ICMP_ECHOREPLY],
+           cur->rx[RX_ICMP_UNREACH] - prev->rx[RX_ICMP_UNREACH]);
+
+  putchar('\n');
+
+  /* Per interface, if bound to interfaces. */
+  if (get_iface_name(0))
+    for (g = 0; g < stats->ngroups; g++)
+      printf("[%8.1fs]   %-12s %" PRIu64 " pkts, %.0f pps, %.2f Mbps, %" PRIu64 " errors\n",
+             cur->elapsed, get_iface_name(g),
+             cur->group_packets[g] - prev->group_packets[g],
+             (cur->group_packets[g] - prev->group_packets[g]) / t,
+             (cur->group_bytes[g] - prev->group_bytes[g]) * 8 / t / 1e6,
+             cur->group_errors[g] - prev->group_errors[g]);
+}
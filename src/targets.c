@@ -0,0 +1,576 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file targets.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <ctype.h>
+
+/* Binary target list file layout:
+
+      offset  size  field
+      0       4     magic ("T50L")
+      4       4     version (TARGETS_FILE_VERSION)
+      8       8     count (number of addresses)
+      16      4*n   addresses (uint32_t, host order, sorted ascending)
+
+   All fields are in host byte order. The file is mapped as is, so
+   loading it costs the same no matter how many addresses it holds. */
+#define TARGETS_FILE_MAGIC    "T50L"
+#define TARGETS_FILE_VERSION  1
+
+struct targets_file_hdr
+{
+  char     magic[4];
+  uint32_t version;
+  uint64_t count;
+};
+
+/* Text files smaller than this are parsed by this process only. */
+#define TARGETS_PARALLEL_MIN  (1U << 20)
+
+/* Maximum number of parser processes used on text files. */
+#define TARGETS_MAX_PARSERS   16
+
+/* Smallest possible line: "1.2.3.4\n". Used to size the output slices. */
+#define TARGETS_MIN_LINE      8
+
+/* The destinations iterator. Each process has its own copy after fork(). */
+static struct
+{
+  uint32_t *addrs;        /* target list (NULL if using CIDR).  */
+  uint32_t  first;        /* first CIDR address (host order).   */
+  uint32_t  count;        /* number of destinations.            */
+  int       order;        /* TARGET_ORDER_xxx.                  */
+
+  uint32_t  pos;          /* sequential/permutation position.   */
+  uint32_t  step;         /* # of workers sharing the sequence. */
+
+  /* Permutation: full period LCG modulo (mask + 1), cycle walking
+     over indexes greater or equal to count. */
+  uint32_t  mask;
+  uint32_t  a, c;
+} tgt;
+
+/* Target list as loaded by load_targets(). */
+static uint32_t *list_addrs = NULL;
+static size_t    list_count = 0;
+static void     *list_map = NULL;   /* Binary file mapping (if any). */
+static size_t    list_map_size = 0;
+
+static int    set_targets(const struct config_options *const __restrict__, const uint32_t *);
+static int    parse_targets_chunk(const char *, const char *, uint32_t *, size_t *);
+static size_t parse_targets_parallel(const char *, size_t, uint32_t **);
+static void   sort_targets(uint32_t *, size_t);
+
+/**
+ * Loads a target list file (text or binary).
+ *
+ * Text files have one IPv4 address per line. Empty lines and anything
+ * following a '#' are ignored. The resulting list is sorted and duplicates
+ * are removed.
+ *
+ * @param filename Path to the target list.
+ * @return Number of addresses loaded. Fatal error if none.
+ */
+size_t load_targets(const char *filename)
+{
+  struct stat st;
+  void *p;
+  int fd;
+
+  assert(filename != NULL);
+
+  if ((fd = open(filename, O_RDONLY)) == -1)
+    fatal_error("Cannot open target list '%s': %s.", filename, strerror(errno));
+
+  if (fstat(fd, &st) == -1)
+    fatal_error("Cannot get target list '%s' size: %s.", filename, strerror(errno));
+
+  if (st.st_size == 0)
+    fatal_error("Target list '%s' is empty.", filename);
+
+  if ((p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    fatal_error("Cannot map target list '%s': %s.", filename, strerror(errno));
+
+  close(fd);
+
+  if ((size_t)st.st_size >= sizeof(struct targets_file_hdr) &&
+      !memcmp(p, TARGETS_FILE_MAGIC, 4))
+  {
+    const struct targets_file_hdr *hdr = p;
+
+    if (hdr->version != TARGETS_FILE_VERSION ||
+        hdr->count > UINT32_MAX ||
+        (size_t)st.st_size != sizeof(*hdr) + hdr->count * sizeof(uint32_t))
+      fatal_error("Target list '%s' is corrupted or has an unknown version.", filename);
+
+    /* Keep the file mapped: the addresses are used right from the page cache. */
+    list_map = p;
+    list_map_size = st.st_size;
+    list_addrs = (uint32_t *)(hdr + 1);
+    list_count = hdr->count;
+  }
+  else
+  {
+    list_count = parse_targets_parallel(p, st.st_size, &list_addrs);
+    munmap(p, st.st_size);
+  }
+
+  if (list_count == 0)
+    fatal_error("No addresses found on target list '%s'.", filename);
+
+  return list_count;
+}
+
+/**
+ * Saves the loaded target list in binary form.
+ *
+ * @param filename Path to the new binary file.
+ */
+void save_targets(const char *filename)
+{
+  struct targets_file_hdr hdr = { .version = TARGETS_FILE_VERSION };
+  FILE *f;
+
+  assert(filename != NULL);
+  assert(list_addrs != NULL);
+
+  memcpy(hdr.magic, TARGETS_FILE_MAGIC, 4);
+  hdr.count = list_count;
+
+  if ((f = fopen(filename, "wb")) == NULL)
+    fatal_error("Cannot create '%s': %s.", filename, strerror(errno));
+
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+      fwrite(list_addrs, sizeof(uint32_t), list_count, f) != list_count ||
+      fclose(f))
+    fatal_error("Error writing '%s'.", filename);
+}
+
+/**
+ * Prepares the destination addresses iterator.
+ *
+ * Must be called before forking, so all processes share the same
+ * permutation parameters.
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @return TRUE on success, FALSE otherwise.
+ */
+int config_targets(const struct config_options *const __restrict__ co)
+{
+  uint32_t seed[3];
+
+  /* NOTE: The PRNG isn't seeded yet (and will be seeded per process),
+           so get the permutation parameters straight from the kernel
+           (or from --seed). */
+  if (!get_seed_bytes(seed, sizeof(seed)))
+    fatal_error("Cannot get random permutation parameters.");
+
+  return set_targets(co, seed);
+}
+
+/**
+ * Changes the destinations while running (--control): the CIDR block
+ * on the configuration, from its start.
+ *
+ * Every worker must use the same seed, so they share the permutation.
+ *
+ * @param co Pointer to T50 configuration structure.
+ * @param seed Permutation parameters (3 random words).
+ * @param worker Index of this process (0 .. nworkers - 1).
+ * @param nworkers Number of processes.
+ * @return TRUE on success, FALSE otherwise.
+ */
+int change_targets(const struct config_options *const __restrict__ co,
+                   const uint32_t *seed,
+                   unsigned worker,
+                   unsigned nworkers)
+{
+  /* A list isn't a CIDR block. */
+  assert(!list_addrs);
+
+  if (!set_targets(co, seed))
+    return FALSE;
+
+  if (nworkers > 1)
+    split_targets(worker, nworkers);
+
+  return TRUE;
+}
+
+/**
+ * Splits the destination sequence between processes.
+ *
+ * Each process takes every 'nworkers'th destination, starting at 'worker'.
+ * Meaningless on random order.
+ *
+ * @param worker Index of this process (0 .. nworkers - 1).
+ * @param nworkers Number of processes.
+ */
+void split_targets(unsigned worker, unsigned nworkers)
+{
+  unsigned i;
+
+  assert(worker < nworkers);
+
+  tgt.step = nworkers;
+
+  if (tgt.order == TARGET_ORDER_PERMUTATION)
+  {
+    /* Skip 'worker' positions of the common permutation. */
+    while (tgt.pos >= tgt.count)
+      tgt.pos = (tgt.a * tgt.pos + tgt.c) & tgt.mask;
+
+    for (i = 0; i < worker; i++)
+      do
+        tgt.pos = (tgt.a * tgt.pos + tgt.c) & tgt.mask;
+      while (tgt.pos >= tgt.count);
+  }
+  else
+    tgt.pos = worker % tgt.count;
+}
+
+/**
+ * Gets the next destination address.
+ *
+ * @return IPv4 address in network order.
+ */
+in_addr_t next_target(void)
+{
+  uint32_t idx;
+  unsigned i;
+
+  switch (tgt.order)
+  {
+  case TARGET_ORDER_SEQUENTIAL:
+    idx = tgt.pos;
+    if ((tgt.pos += tgt.step) >= tgt.count)
+      tgt.pos %= tgt.count;
+    break;
+
+  case TARGET_ORDER_PERMUTATION:
+    /* Cycle walking: at most half of the LCG outputs are out of range. */
+    while ((idx = tgt.pos) >= tgt.count)
+      tgt.pos = (tgt.a * tgt.pos + tgt.c) & tgt.mask;
+
+    i = tgt.step;
+    do
+    {
+      do
+        tgt.pos = (tgt.a * tgt.pos + tgt.c) & tgt.mask;
+      while (tgt.pos >= tgt.count);
+    } while (--i);
+    break;
+
+  default:  /* TARGET_ORDER_RANDOM */
+    /* NOTE: The previous code did not account for 'hostid == 0'! */
+    idx = (tgt.count > 1) ? RANDOM() % tgt.count : 0;
+  }
+
+  /* We need the address in network order now. */
+  return htonl(tgt.addrs ? tgt.addrs[idx] : tgt.first + idx);
+}
+
+/**
+ * Gets the number of destinations being iterated.
+ */
+uint32_t get_number_of_targets(void)
+{
+  return tgt.count;
+}
+
+/**
+ * Gets the destination, if there is only one (hostid == 0 or a single
+ * address on the list). Senders use it to skip per packet address work.
+ *
+ * @return IPv4 address in network order, or INADDR_ANY if there are many.
+ */
+in_addr_t get_fixed_target(void)
+{
+  if (tgt.count != 1)
+    return INADDR_ANY;
+
+  return htonl(tgt.addrs ? tgt.addrs[0] : tgt.first);
+}
+
+/**
+ * Gets the first destination (of the list, or of the CIDR block).
+ *
+ * @return IPv4 address in network order.
+ */
+in_addr_t get_first_target(void)
+{
+  return htonl(tgt.addrs ? tgt.addrs[0] : tgt.first);
+}
+
+/**
+ * Releases the target list.
+ */
+void close_targets(void)
+{
+  if (list_map)
+    munmap(list_map, list_map_size);
+  else
+    free(list_addrs);
+
+  list_map = NULL;
+  list_addrs = tgt.addrs = NULL;
+  list_count = 0;
+}
+
+/* Sets up the iterator: the list, or the CIDR block on the configuration,
+   in the configured order. */
+static int set_targets(const struct config_options *const __restrict__ co, const uint32_t *seed)
+{
+  struct cidr *cidr_ptr;
+
+  if (list_addrs)
+  {
+    tgt.addrs = list_addrs;
+    tgt.count = list_count;
+  }
+  else
+  {
+    /* Calculates CIDR for destination address. */
+    if (!(cidr_ptr = config_cidr(co)))
+      return FALSE;
+
+    tgt.first = cidr_ptr->__1st_addr;
+    tgt.count = cidr_ptr->hostid ? cidr_ptr->hostid : 1;  /* hostid == 0 means: use the address as is! */
+  }
+
+  tgt.order = co->target_order;
+  tgt.step = 1;
+
+  /* Smallest power of 2 greater or equal to count, minus 1. */
+  tgt.mask = tgt.count - 1;
+  tgt.mask |= tgt.mask >> 1;
+  tgt.mask |= tgt.mask >> 2;
+  tgt.mask |= tgt.mask >> 4;
+  tgt.mask |= tgt.mask >> 8;
+  tgt.mask |= tgt.mask >> 16;
+
+  /* Hull-Dobell: 'c' odd and 'a - 1' multiple of 4 gives full period modulo 2^k. */
+  tgt.a = (seed[0] & ~3U) | 1;
+  tgt.c = seed[1] | 1;
+  tgt.pos = (tgt.order == TARGET_ORDER_PERMUTATION) ? seed[2] & tgt.mask : 0;
+
+  return TRUE;
+}
+
+/* Parses lines between 'p' and 'end', storing addresses (host order) at 'out'.
+   Returns FALSE if an invalid line is found. */
+static int parse_targets_chunk(const char *p, const char *end, uint32_t *out, size_t *count)
+{
+  char buffer[INET_ADDRSTRLEN];
+  const char *s, *e;
+  struct in_addr in;
+  size_t n = 0, len;
+
+  while (p < end)
+  {
+    /* Find the end of this line. */
+    if ((e = memchr(p, '\n', end - p)) == NULL)
+      e = end;
+
+    /* Strip comments and surrounding spaces. */
+    if ((s = memchr(p, '#', e - p)) == NULL)
+      s = e;
+
+    while (p < s && isspace((unsigned char)*p))
+      p++;
+    while (s > p && isspace((unsigned char)s[-1]))
+      s--;
+
+    if ((len = s - p) != 0)
+    {
+      if (len >= sizeof(buffer))
+        return FALSE;
+
+      memcpy(buffer, p, len);
+      buffer[len] = '\0';
+
+      if (inet_pton(AF_INET, buffer, &in) != 1)
+      {
+        error("Invalid address '%s' on target list.", buffer);
+        return FALSE;
+      }
+
+      out[n++] = ntohl(in.s_addr);
+    }
+
+    p = e + 1;
+  }
+
+  *count = n;
+  return TRUE;
+}
+
+/* Parses a text target list. Big files are split, on line boundaries,
+   between forked parser processes writing on shared memory.
+   Returns the number of (unique) addresses stored on a new buffer. */
+static size_t parse_targets_parallel(const char *text, size_t size, uint32_t **addrs)
+{
+  const char *chunk_start[TARGETS_MAX_PARSERS + 1];
+  size_t slice[TARGETS_MAX_PARSERS], capacity, count, i, j;
+  ssize_t *counts;
+  uint32_t *out, *result;
+  pid_t pids[TARGETS_MAX_PARSERS];
+  long nparsers;
+  void *shm;
+
+  nparsers = 1;
+  if (size >= TARGETS_PARALLEL_MIN)
+  {
+    if ((nparsers = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+      nparsers = 1;
+    if (nparsers > TARGETS_MAX_PARSERS)
+      nparsers = TARGETS_MAX_PARSERS;
+  }
+
+  /* Split the text in (almost) equal chunks, ending on new lines. */
+  chunk_start[0] = text;
+  for (i = 1; i < (size_t)nparsers; i++)
+  {
+    const char *p = text + (size * i) / nparsers, *nl;
+
+    if (p < chunk_start[i - 1])
+      p = chunk_start[i - 1];
+
+    nl = memchr(p, '\n', text + size - p);
+    chunk_start[i] = nl ? nl + 1 : text + size;
+  }
+  chunk_start[nparsers] = text + size;
+
+  /* Every chunk gets an output slice big enough for its smallest possible lines. */
+  for (capacity = i = 0; i < (size_t)nparsers; i++)
+  {
+    slice[i] = capacity;
+    capacity += (chunk_start[i + 1] - chunk_start[i]) / TARGETS_MIN_LINE + 1;
+  }
+
+  shm = mmap(NULL, nparsers * sizeof(ssize_t) + capacity * sizeof(uint32_t),
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shm == MAP_FAILED)
+    fatal_error("Cannot allocate memory to parse the target list.");
+
+  counts = shm;
+  out = (uint32_t *)(counts + nparsers);
+
+  for (i = 0; i < (size_t)nparsers; i++)
+  {
+    size_t n;
+
+    /* The last chunk is parsed by this process. */
+    if (i + 1 < (size_t)nparsers)
+    {
+      if ((pids[i] = fork()) == -1)
+        fatal_error("Error creating target list parser process: %s.", strerror(errno));
+
+      if (pids[i] != 0)
+        continue;
+    }
+
+    counts[i] = parse_targets_chunk(chunk_start[i], chunk_start[i + 1], out + slice[i], &n) ?
+                (ssize_t)n : -1;
+
+    if (i + 1 < (size_t)nparsers)
+      _exit(0);
+  }
+
+  for (i = 0; i + 1 < (size_t)nparsers; i++)
+    if (waitpid(pids[i], NULL, 0) == -1)
+      fatal_error("Error waiting for target list parser: %s.", strerror(errno));
+
+  for (count = i = 0; i < (size_t)nparsers; i++)
+  {
+    if (counts[i] < 0)
+      fatal_error("Invalid target list.");
+
+    count += counts[i];
+  }
+
+  if (count > UINT32_MAX)
+    fatal_error("Too many addresses on target list.");
+
+  if ((result = malloc((count ? count : 1) * sizeof(uint32_t))) == NULL)
+    fatal_error("Cannot allocate memory to the target list.");
+
+  for (j = i = 0; i < (size_t)nparsers; i++)
+  {
+    memcpy(result + j, out + slice[i], counts[i] * sizeof(uint32_t));
+    j += counts[i];
+  }
+
+  munmap(shm, nparsers * sizeof(ssize_t) + capacity * sizeof(uint32_t));
+
+  /* Sort and remove duplicates. */
+  sort_targets(result, count);
+
+  for (j = i = 0; i < count; i++)
+    if (!j || result[j - 1] != result[i])
+      result[j++] = result[i];
+
+  *addrs = result;
+  return j;
+}
+
+/* LSD radix sort (4 passes of 8 bits). Linear time on millions of addresses. */
+static void sort_targets(uint32_t *v, size_t n)
+{
+  uint32_t *tmp, *src, *dst, *t;
+  size_t hist[256], i, sum, c;
+  unsigned shift;
+
+  if (n < 2)
+    return;
+
+  if ((tmp = malloc(n * sizeof(uint32_t))) == NULL)
+    fatal_error("Cannot allocate memory to sort the target list.");
+
+  src = v;
+  dst = tmp;
+
+  for (shift = 0; shift < 32; shift += 8)
+  {
+    memset(hist, 0, sizeof(hist));
+
+    for (i = 0; i < n; i++)
+      hist[(src[i] >> shift) & 0xff]++;
+
+    for (sum = i = 0; i < 256; i++)
+    {
+      c = hist[i];
+      hist[i] = sum;
+      sum += c;
+    }
+
+    for (i = 0; i < n; i++)
+      dst[hist[(src[i] >> shift) & 0xff]++] = src[i];
+
+    t = src; src = dst; dst = t;
+  }
+
+  /* After an even number of passes the result is back on 'v'. */
+  free(tmp);
+}
@@ -0,0 +1,347 @@
+/* vim: set ts=2 et sw=2 : */
+/** @file uring.c */
+/*
+ *  T50 - Experimental Mixed Packet Injector
+ *
+ *  Copyright (C) 2010 - 2015 - T50 developers
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <common.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* NOTE: No liburing. The ring is small enough to be handled here,
+         with the raw system calls. */
+
+/* A send in flight: its own copy of the packet and of the message. */
+struct uring_slot
+{
+  struct msghdr           msg;
+  struct iovec            iov;
+  struct sockaddr_storage name;
+  uint8_t                 control[URING_MAX_CONTROL];   /* SCM_TXTIME. */
+  size_t                  size;     /* IP packet size (statistics). */
+  uint8_t                 data[URING_MAX_PACKET];
+};
+
+static struct
+{
+  int                 fd;
+  unsigned            depth;
+  unsigned            batch;
+
+  /* Submission queue. */
+  void                *sq_ring;
+  size_t              sq_ring_size;
+  unsigned            *sq_tail;
+  unsigned            sq_mask;
+  struct io_uring_sqe *sqes;
+  size_t              sqes_size;
+  unsigned            tail;         /* local tail.                  */
+  unsigned            to_submit;    /* queued, not submitted yet.   */
+
+  /* Completion queue. */
+  void                *cq_ring;
+  size_t              cq_ring_size;
+  unsigned            *cq_head;
+  unsigned            *cq_tail;
+  unsigned            cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* Buffer pool. */
+  struct uring_slot   *slots;
+  unsigned            *free_slots;
+  unsigned            nfree;
+} ur = { .fd = -1 };
+
+static void setup_ring(void);
+static void submit(int);
+static void reap(void);
+
+/**
+ * Sets up the io_uring parameters.
+ *
+ * The ring itself is created by each worker, on its first packet:
+ * rings aren't shared between processes.
+ *
+ * @param depth Number of sends in flight (buffer pool size).
+ * @param batch Number of sends submitted at once.
+ */
+void config_uring(unsigned depth, unsigned batch)
+{
+  ur.depth = depth;
+  ur.batch = (batch && batch <= depth) ? batch : depth;
+}
+
+/**
+ * Queues a packet.
+ *
+ * The packet is copied to a slot of the buffer pool, so the caller may
+ * build the next one right away. Sends are submitted in batches, and
+ * their completions reaped at submission time: the kernel sends while
+ * we build. Failed sends are taken back from the statistics when their
+ * completions are reaped.
+ *
+ * @param fd Socket.
+ * @param msg Message (the total length must be up to URING_MAX_PACKET).
+ * @param size IP packet size (statistics).
+ * @return TRUE.
+ */
+int uring_send(socket_t fd, const struct msghdr *msg, size_t size)
+{
+  struct uring_slot *s;
+  struct io_uring_sqe *sqe;
+  unsigned idx, i;
+  size_t len = 0;
+
+  if (unlikely(ur.fd == -1))
+    setup_ring();
+
+  /* Pool exhausted? Waits for the oldest sends. */
+  while (unlikely(!ur.nfree))
+    submit(TRUE);
+
+  idx = ur.free_slots[--ur.nfree];
+  s = &ur.slots[idx];
+
+  for (i = 0; i < msg->msg_iovlen; i++)
+  {
+    memcpy(s->data + len, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+    len += msg->msg_iov[i].iov_len;
+  }
+
+  s->iov.iov_len = len;
+  s->size = size;
+  s->msg.msg_namelen = msg->msg_namelen;
+  if (msg->msg_namelen)
+    memcpy(&s->name, msg->msg_name, msg->msg_namelen);
+  s->msg.msg_name = msg->msg_namelen ? &s->name : NULL;
+
+  assert(msg->msg_controllen <= URING_MAX_CONTROL);
+  s->msg.msg_controllen = msg->msg_controllen;
+  if (msg->msg_controllen)
+    memcpy(s->control, msg->msg_control, msg->msg_controllen);
+  s->msg.msg_control = msg->msg_controllen ? s->control : NULL;
+
+  sqe = &ur.sqes[ur.tail & ur.sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode    = IORING_OP_SENDMSG;
+  sqe->fd        = fd;
+  sqe->addr      = (uintptr_t)&s->msg;
+  sqe->len       = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = idx;
+
+  ur.tail++;
+  if (++ur.to_submit >= ur.batch)
+    submit(FALSE);
+
+  return TRUE;
+}
+
+/**
+ * Submits the queued sends and waits for every completion.
+ *
+ * Called by each worker before it ends.
+ */
+void uring_flush(void)
+{
+  if (ur.fd == -1)
+    return;
+
+  while (ur.to_submit || ur.nfree < ur.depth)
+    submit(ur.nfree < ur.depth);
+}
+
+/**
+ * Releases the ring and the buffer pool.
+ */
+void close_uring(void)
+{
+  if (ur.fd == -1)
+    return;
+
+  munmap(ur.sqes, ur.sqes_size);
+  if (ur.cq_ring != ur.sq_ring)
+    munmap(ur.cq_ring, ur.cq_ring_size);
+  munmap(ur.sq_ring, ur.sq_ring_size);
+  munmap(ur.slots, ur.depth * sizeof(struct uring_slot));
+  free(ur.free_slots);
+  close(ur.fd);
+
+  ur.fd = -1;
+}
+
+/* Creates the ring (SQ, CQ and SQEs) and the buffer pool. */
+static void setup_ring(void)
+{
+  struct io_uring_params p;
+  unsigned i, *array;
+
+  /* A single process submits and reaps. Tells the kernel, if it knows about it. */
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+  if ((ur.fd = syscall(__NR_io_uring_setup, ur.depth, &p)) == -1 && errno == EINVAL)
+  {
+    memset(&p, 0, sizeof(p));
+    ur.fd = syscall(__NR_io_uring_setup, ur.depth, &p);
+  }
+
+  if (ur.fd == -1)
+    #ifdef __HAVE_DEBUG__
+    fatal_error("Error creating io_uring: \"%s\"", strerror(errno));
+    #else
+    fatal_error("Error creating io_uring (not supported or not allowed?)");
+    #endif
+
+  ur.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ur.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  /* Newer kernels map both rings at once. */
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ur.cq_ring_size > ur.sq_ring_size)
+      ur.sq_ring_size = ur.cq_ring_size;
+    ur.cq_ring_size = ur.sq_ring_size;
+  }
+
+  ur.sq_ring = mmap(NULL, ur.sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ur.fd, IORING_OFF_SQ_RING);
+  if (ur.sq_ring == MAP_FAILED)
+    fatal_error("Error mapping io_uring submission queue.");
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ur.cq_ring = ur.sq_ring;
+  else if ((ur.cq_ring = mmap(NULL, ur.cq_ring_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ur.fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    fatal_error("Error mapping io_uring completion queue.");
+
+  ur.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  if ((ur.sqes = mmap(NULL, ur.sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ur.fd, IORING_OFF_SQES)) == MAP_FAILED)
+    fatal_error("Error mapping io_uring submission entries.");
+
+  ur.sq_tail = (unsigned *)((uint8_t *)ur.sq_ring + p.sq_off.tail);
+  ur.sq_mask = *(unsigned *)((uint8_t *)ur.sq_ring + p.sq_off.ring_mask);
+  ur.tail    = *ur.sq_tail;
+
+  /* SQE 'i' always goes on SQ slot 'i'. */
+  array = (unsigned *)((uint8_t *)ur.sq_ring + p.sq_off.array);
+  for (i = 0; i < p.sq_entries; i++)
+    array[i] = i;
+
+  ur.cq_head = (unsigned *)((uint8_t *)ur.cq_ring + p.cq_off.head);
+  ur.cq_tail = (unsigned *)((uint8_t *)ur.cq_ring + p.cq_off.tail);
+  ur.cq_mask = *(unsigned *)((uint8_t *)ur.cq_ring + p.cq_off.ring_mask);
+  ur.cqes    = (struct io_uring_cqe *)((uint8_t *)ur.cq_ring + p.cq_off.cqes);
+
+  /* The buffer pool. Never more sends in flight than SQ entries,
+     so the CQ (twice as big) never overflows. */
+  if (ur.depth > p.sq_entries)
+    ur.depth = p.sq_entries;
+
+  ur.slots = mmap(NULL, ur.depth * sizeof(struct uring_slot), PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (ur.slots == MAP_FAILED || (ur.free_slots = malloc(ur.depth * sizeof(unsigned))) == NULL)
+    fatal_error("Cannot allocate the io_uring buffer pool.");
+
+  for (i = 0; i < ur.depth; i++)
+  {
+    ur.slots[i].iov.iov_base = ur.slots[i].data;
+    ur.slots[i].msg.msg_iov = &ur.slots[i].iov;
+    ur.slots[i].msg.msg_iovlen = 1;
+    ur.free_slots[i] = ur.depth - 1 - i;
+  }
+  ur.nfree = ur.depth;
+
+  if (ur.batch > ur.depth)
+    ur.batch = ur.depth;
+}
+
+/* Submits the queued sends (waiting for a completion, if asked to)
+   and reaps the completions. */
+static void submit(int wait)
+{
+  int r;
+
+  /* Makes the SQEs visible to the kernel. */
+  __atomic_store_n(ur.sq_tail, ur.tail, __ATOMIC_RELEASE);
+
+  do
+    r = syscall(__NR_io_uring_enter, ur.fd, ur.to_submit, wait ? 1 : 0,
+                wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  while (unlikely(r == -1 && errno == EINTR));
+
+  if (unlikely(r == -1))
+  {
+    /* EAGAIN/EBUSY: the kernel is short of resources. Try again later. */
+    if (errno != EAGAIN && errno != EBUSY)
+      #ifdef __HAVE_DEBUG__
+      fatal_error("Error submitting to io_uring: \"%s\"", strerror(errno));
+      #else
+      fatal_error("Error submitting to io_uring");
+      #endif
+  }
+  else
+    ur.to_submit -= r;
+
+  reap();
+}
+
+/* Gives the slots of completed sends back to the pool. */
+static void reap(void)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head, tail;
+
+  head = *ur.cq_head;
+  tail = __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++)
+  {
+    cqe = &ur.cqes[head & ur.cq_mask];
+
+    if (unlikely(cqe->res < 0))
+    {
+      if (cqe->res == -EPERM)
+        fatal_error("Error sending packet (Permission!). Please check your firewall rules (iptables?).");
+
+      /* It was counted as sent when queued. */
+      wstats->packets--;
+      wstats->bytes -= ur.slots[cqe->user_data].size;
+
+      /* NOTE: The device queue was full. It's too late to wait: whatever
+               --on-full says, the packet was dropped. */
+      if (cqe->res == -ENOBUFS || cqe->res == -EAGAIN)
+      {
+        wstats->full++;
+        wstats->drops++;
+      }
+      else
+        wstats->errors++;
+
+#ifdef __HAVE_DEBUG__
+      error("Packet (%zu bytes long) not sent: \"%s\"",
+            ur.slots[cqe->user_data].size, strerror(-cqe->res));
+#endif
+    }
+
+    ur.free_slots[ur.nfree++] = cqe->user_data;
+  }
+
+  __atomic_store_n(ur.cq_head, head, __ATOMIC_RELEASE);
+}